@@ -295,11 +295,16 @@ bool AsyncFrameDecoder::CopyAndDecodeCameraFrame(std::shared_ptr<CameraCPUFrame>
 
 	if (rawTexture.StagingBuffer == VK_NULL_HANDLE)
 	{
-		CopyHostImageToGPU(m_device, rawTexture, *inFrame->FrameBuffer.get());
+		CopyHostImageToGPU(m_device, rawTexture, inFrame->GetFrameData());
+	}
+	else if (inFrame->UploadBuffer.get())
+	{
+		// The frame was captured straight into upload memory, copy from it without staging.
+		CopyBufferToTextureGPU(m_commandBuffer, inFrame->UploadBuffer->Buffer, rawTexture, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 	}
 	else
 	{
-		memcpy(rawTexture.MappedMemory, inFrame->FrameBuffer->data(), inFrame->FrameBuffer->size());
+		memcpy(rawTexture.MappedMemory, inFrame->GetFrameData(), inFrame->RawFrameDataBytes);
 		CopyTextureToGPU(m_commandBuffer, rawTexture, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 	}
 
@@ -96,13 +96,21 @@ AsyncRenderer::~AsyncRenderer()
 
 	m_frameDecoder.Deinit();
 
+	if (m_uploadBufferPool.get())
+	{
+		m_uploadBufferPool->Deinit();
+	}
+
 	DestroyTexture(m_bwRectifiedCameraTexture);
 	DestroyTexture(m_disparityTexture);
 	DestroyTexture(m_confidenceTexture);
 	DestroyTexture(m_rawCameraTexture);
-	for (int i = 0; i < NUM_BUFFERED_FRAMES; i++)
+	for (int i = 0; i < CAMERA_GPU_FRAME_QUEUE_SIZE; i++)
 	{
 		DestroyTexture(m_sharedCameraTexture[i]);
+	}
+	for (int i = 0; i < NUM_BUFFERED_FRAMES; i++)
+	{
 		DestroyTexture(m_outputTexture[i]);
 	}
 
@@ -560,6 +568,8 @@ bool AsyncRenderer::InitRenderer()
 		return false;
 	}
 
+	m_uploadBufferPool = std::make_shared<CameraUploadBufferPool>(m_device, m_memProps);
+
 	g_logger->info("Asynchronous depth renderer initialized");
 
 	return true;
@@ -994,6 +1004,219 @@ void AsyncRenderer::DestroyTexture(VulkanTexture& texture)
 }
 
 
+CameraUploadBufferPool::~CameraUploadBufferPool()
+{
+	Deinit();
+}
+
+
+std::shared_ptr<CameraUploadBuffer> CameraUploadBufferPool::AcquireBuffer(VkDeviceSize size)
+{
+	CameraUploadBuffer* buffer = nullptr;
+
+	{
+		std::lock_guard<std::mutex> lock(m_poolMutex);
+
+		if (m_device == VK_NULL_HANDLE)
+		{
+			return nullptr;
+		}
+
+		// Use the smallest free buffer the frame fits in.
+		auto bestIt = m_freeBuffers.end();
+		for (auto it = m_freeBuffers.begin(); it != m_freeBuffers.end(); it++)
+		{
+			if ((*it)->Size >= size && (bestIt == m_freeBuffers.end() || (*it)->Size < (*bestIt)->Size))
+			{
+				bestIt = it;
+			}
+		}
+
+		if (bestIt != m_freeBuffers.end())
+		{
+			buffer = *bestIt;
+			m_freeBuffers.erase(bestIt);
+		}
+		else
+		{
+			buffer = CreateBuffer(size);
+		}
+
+		if (buffer)
+		{
+			m_usedBuffers.push_back(buffer);
+		}
+	}
+
+	if (!buffer)
+	{
+		return nullptr;
+	}
+
+	std::shared_ptr<CameraUploadBufferPool> pool = shared_from_this();
+	return std::shared_ptr<CameraUploadBuffer>(buffer, [pool](CameraUploadBuffer* returned) { pool->ReturnBuffer(returned); });
+}
+
+
+void CameraUploadBufferPool::Deinit()
+{
+	std::lock_guard<std::mutex> lock(m_poolMutex);
+
+	for (CameraUploadBuffer* buffer : m_freeBuffers)
+	{
+		DestroyBuffer(buffer);
+	}
+	m_freeBuffers.clear();
+
+	// Frames may still hold buffers, keep the structs alive until they are returned.
+	for (CameraUploadBuffer* buffer : m_usedBuffers)
+	{
+		ReleaseBufferResources(buffer);
+	}
+	m_usedBuffers.clear();
+
+	m_device = VK_NULL_HANDLE;
+}
+
+
+CameraUploadBuffer* CameraUploadBufferPool::CreateBuffer(VkDeviceSize size)
+{
+	VkDeviceSize alignedSize = ((size + UPLOAD_BUFFER_PAGE_SIZE - 1) / UPLOAD_BUFFER_PAGE_SIZE) * UPLOAD_BUFFER_PAGE_SIZE;
+
+	VkBufferCreateInfo bufferInfo{ VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.size = alignedSize;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	CameraUploadBuffer* buffer = new CameraUploadBuffer();
+	buffer->Pool = this;
+	buffer->Size = alignedSize;
+
+	if (vkCreateBuffer(m_device, &bufferInfo, nullptr, &buffer->Buffer) != VK_SUCCESS)
+	{
+		g_logger->error("Upload buffer creation failure!");
+		delete buffer;
+		return nullptr;
+	}
+
+	VkMemoryRequirements memReq{};
+	vkGetBufferMemoryRequirements(m_device, buffer->Buffer, &memReq);
+
+	// The stereo reconstruction reads the frames on the CPU, so prefer cached memory over write combined.
+	const VkMemoryPropertyFlags requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	int memoryType = -1;
+
+	for (uint32_t i = 0; i < m_memProps.memoryTypeCount; i++)
+	{
+		VkMemoryPropertyFlags flags = m_memProps.memoryTypes[i].propertyFlags;
+		if ((memReq.memoryTypeBits & (1 << i)) == 0 || (flags & requiredFlags) != requiredFlags)
+		{
+			continue;
+		}
+
+		if (memoryType < 0 || (flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT))
+		{
+			memoryType = i;
+		}
+		if (flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT)
+		{
+			break;
+		}
+	}
+
+	VkMemoryAllocateInfo allocInfo{ VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+	allocInfo.allocationSize = memReq.size;
+	allocInfo.memoryTypeIndex = memoryType;
+
+	if (memoryType < 0 || vkAllocateMemory(m_device, &allocInfo, nullptr, &buffer->Memory) != VK_SUCCESS)
+	{
+		g_logger->error("Upload buffer allocation failure!");
+		DestroyBuffer(buffer);
+		return nullptr;
+	}
+
+	if (vkBindBufferMemory(m_device, buffer->Buffer, buffer->Memory, 0) != VK_SUCCESS ||
+		vkMapMemory(m_device, buffer->Memory, 0, VK_WHOLE_SIZE, 0, reinterpret_cast<void**>(&buffer->MappedMemory)) != VK_SUCCESS)
+	{
+		g_logger->error("Failed to map upload buffer!");
+		DestroyBuffer(buffer);
+		return nullptr;
+	}
+
+	return buffer;
+}
+
+
+void CameraUploadBufferPool::ReleaseBufferResources(CameraUploadBuffer* buffer)
+{
+	if (buffer->Memory != VK_NULL_HANDLE)
+	{
+		vkFreeMemory(m_device, buffer->Memory, nullptr);
+		buffer->Memory = VK_NULL_HANDLE;
+	}
+	if (buffer->Buffer != VK_NULL_HANDLE)
+	{
+		vkDestroyBuffer(m_device, buffer->Buffer, nullptr);
+		buffer->Buffer = VK_NULL_HANDLE;
+	}
+	buffer->MappedMemory = nullptr;
+	buffer->Size = 0;
+}
+
+
+void CameraUploadBufferPool::DestroyBuffer(CameraUploadBuffer* buffer)
+{
+	ReleaseBufferResources(buffer);
+	delete buffer;
+}
+
+
+void CameraUploadBufferPool::ReturnBuffer(CameraUploadBuffer* buffer)
+{
+	std::lock_guard<std::mutex> lock(m_poolMutex);
+
+	// The Vulkan objects were already destroyed in Deinit.
+	if (m_device == VK_NULL_HANDLE)
+	{
+		delete buffer;
+		return;
+	}
+
+	auto usedIt = std::find(m_usedBuffers.begin(), m_usedBuffers.end(), buffer);
+	if (usedIt != m_usedBuffers.end())
+	{
+		m_usedBuffers.erase(usedIt);
+	}
+
+	if (m_freeBuffers.size() >= MAX_FREE_UPLOAD_BUFFERS)
+	{
+		DestroyBuffer(buffer);
+		return;
+	}
+
+	m_freeBuffers.push_back(buffer);
+}
+
+
+bool AsyncRenderer::GetCameraUploadBuffer(std::shared_ptr<CameraUploadBuffer>& buffer, VkDeviceSize size)
+{
+	std::shared_lock accessLock(m_accessMutex);
+	if (!m_bIsInitialized || !m_uploadBufferPool.get())
+	{
+		buffer.reset();
+		return false;
+	}
+
+	if (buffer.get() && buffer->Pool == m_uploadBufferPool.get() && buffer->Size >= size)
+	{
+		return true;
+	}
+
+	buffer = m_uploadBufferPool->AcquireBuffer(size);
+	return buffer.get() != nullptr;
+}
+
+
 bool AsyncRenderer::CopyAndDecodeCameraFrame(std::shared_ptr<CameraCPUFrame> inFrame, void** nativeTexture)
 {
 	std::shared_lock acessLock(m_accessMutex);
@@ -1002,7 +1225,7 @@ bool AsyncRenderer::CopyAndDecodeCameraFrame(std::shared_ptr<CameraCPUFrame> inF
 		return false; 
 	}
 
-	m_cameraTextureIndex = (m_cameraTextureIndex + 1) % NUM_BUFFERED_FRAMES;
+	m_cameraTextureIndex = (m_cameraTextureIndex + 1) % CAMERA_GPU_FRAME_QUEUE_SIZE;
 	VulkanTexture& sharedTexture = m_sharedCameraTexture[m_cameraTextureIndex];
 
 	VkFormat rawFormat = CameraFrameFormatToVulkan(inFrame->RawFrameFormat);
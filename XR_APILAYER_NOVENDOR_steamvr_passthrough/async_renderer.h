@@ -22,8 +22,58 @@ namespace
 
 #define NUM_BUFFERED_FRAMES 4
 
+// Buffer sizes are rounded up to whole pages.
+#define UPLOAD_BUFFER_PAGE_SIZE 4096
+#define MAX_FREE_UPLOAD_BUFFERS 8
 
-class AsyncRenderer
+
+// Pool of camera upload buffers. Buffers are returned to the pool when the last frame referencing them is released.
+class CameraUploadBufferPool : public std::enable_shared_from_this<CameraUploadBufferPool>
+{
+public:
+	CameraUploadBufferPool(VkDevice device, const VkPhysicalDeviceMemoryProperties& memProps)
+		: m_device(device)
+		, m_memProps(memProps)
+	{}
+	~CameraUploadBufferPool();
+	std::shared_ptr<CameraUploadBuffer> AcquireBuffer(VkDeviceSize size);
+
+	// Frees all buffers before the device is destroyed. Buffers still referenced by frames lose their
+	// Vulkan objects and mapping here, and only the bookkeeping is deleted when they are returned.
+	void Deinit();
+
+private:
+	CameraUploadBuffer* CreateBuffer(VkDeviceSize size);
+	void ReleaseBufferResources(CameraUploadBuffer* buffer);
+	void DestroyBuffer(CameraUploadBuffer* buffer);
+	void ReturnBuffer(CameraUploadBuffer* buffer);
+
+	VkDevice m_device;
+	VkPhysicalDeviceMemoryProperties m_memProps;
+	std::mutex m_poolMutex;
+	std::vector<CameraUploadBuffer*> m_freeBuffers;
+	std::vector<CameraUploadBuffer*> m_usedBuffers;
+};
+
+
+// The parts of the async renderer the camera managers and the depth reconstruction use.
+// Lets them be built without the Vulkan renderer, such as in the stereo benchmark.
+class IAsyncRenderer
+{
+public:
+	virtual ~IAsyncRenderer() {};
+
+	virtual bool CopyAndDecodeCameraFrame(std::shared_ptr<CameraCPUFrame> inFrame, void** nativeTexture) = 0;
+	virtual bool GetCameraUploadBuffer(std::shared_ptr<CameraUploadBuffer>& buffer, VkDeviceSize size) = 0;
+	virtual bool BeginRender(std::shared_ptr<DepthFrame> depthFrame, const Config_Stereo& stereoConf) = 0;
+	virtual void CopyDisparityToGPU(std::vector<uint8_t>& buffer) = 0;
+	virtual void CopyConfidenceToGPU(std::vector<uint8_t>& buffer) = 0;
+	virtual void CopyBWRectifiedCameraFrameToGPU(std::vector<uint8_t>& buffer) = 0;
+	virtual void Render(std::shared_ptr<DepthFrame> depthFrame, const Config_Stereo& stereoConf) = 0;
+};
+
+
+class AsyncRenderer : public IAsyncRenderer
 {
 public:
 	AsyncRenderer(std::shared_ptr<ConfigManager> configManager, std::shared_ptr<IPassthroughRenderer> baseRenderer)
@@ -36,6 +86,8 @@ public:
 	bool InitRenderer();
 	bool CreatePipeline();
 	bool CopyAndDecodeCameraFrame(std::shared_ptr<CameraCPUFrame> inFrame, void** nativeTexture);
+	// Makes the buffer point to an upload buffer of at least the given size, keeping the current one if it fits.
+	bool GetCameraUploadBuffer(std::shared_ptr<CameraUploadBuffer>& buffer, VkDeviceSize size);
 	bool BeginRender(std::shared_ptr<DepthFrame> depthFrame, const Config_Stereo& stereoConf);
 	void CopyDisparityToGPU(std::vector<uint8_t>& buffer);
 	void CopyConfidenceToGPU(std::vector<uint8_t>& buffer);
@@ -86,7 +138,8 @@ private:
 	VkSampler m_sampler = VK_NULL_HANDLE;
 
 	VulkanTexture m_rawCameraTexture = {};
-	VulkanTexture m_sharedCameraTexture[NUM_BUFFERED_FRAMES] = {};
+	std::shared_ptr<CameraUploadBufferPool> m_uploadBufferPool;
+	VulkanTexture m_sharedCameraTexture[CAMERA_GPU_FRAME_QUEUE_SIZE] = {};
 	int m_cameraTextureIndex = -1;
 
 	VulkanTexture m_bwRectifiedCameraTexture;
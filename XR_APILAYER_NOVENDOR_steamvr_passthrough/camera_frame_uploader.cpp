@@ -0,0 +1,186 @@
+#include "pch.h"
+
+#include "camera_frame_uploader.h"
+#include "async_renderer.h"
+#include "config_manager.h"
+#include "frame_conversion.h"
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+
+// How long the upload thread waits for a new frame before checking if it should exit.
+#define UPLOAD_WAIT_INTERVAL (std::chrono::milliseconds(10))
+
+
+CameraFrameUploader::CameraFrameUploader(std::shared_ptr<IAsyncRenderer> asyncRenderer, std::shared_ptr<ConfigManager> configManager, LockFreeFrameQueue<CameraCPUFrame>& cpuFrameQueue, LockFreeFrameQueue<CameraGPUFrame>& gpuFrameQueue)
+    : m_asyncRenderer(asyncRenderer)
+    , m_configManager(configManager)
+    , m_cpuFrameQueue(cpuFrameQueue)
+    , m_gpuFrameQueue(gpuFrameQueue)
+{
+}
+
+CameraFrameUploader::~CameraFrameUploader()
+{
+    Stop();
+}
+
+void CameraFrameUploader::Start()
+{
+    if (m_uploadThread.joinable())
+    {
+        return;
+    }
+
+    m_bRunThread = true;
+    m_uploadThread = std::thread(&CameraFrameUploader::UploadFrames, this);
+}
+
+void CameraFrameUploader::Stop()
+{
+    m_bRunThread = false;
+
+    if (m_uploadThread.joinable())
+    {
+        m_uploadThread.join();
+    }
+}
+
+void CameraFrameUploader::UploadFrames()
+{
+    uint64_t lastFrameSequence = 0;
+
+    while (m_bRunThread)
+    {
+        FramePtr<CameraCPUFrame> cpuFrame = m_cpuFrameQueue.WaitForRead(lastFrameSequence, UPLOAD_WAIT_INTERVAL);
+        if (!cpuFrame.HasFrame() || !cpuFrame->bIsValid)
+        {
+            continue;
+        }
+
+        m_uploadQueueTimer.AveragesAddTimeToNow(cpuFrame->FrameReadyTime);
+
+        CopyCPUFrameToGPU(cpuFrame.GetSharedPointer());
+    }
+}
+
+void CameraFrameUploader::CopyCPUFrameToGPU(std::shared_ptr<CameraCPUFrame> inFrame)
+{
+    m_uploadTimer.StartPerfTimer();
+
+    std::shared_ptr<IAsyncRenderer> asyncRenderer = m_asyncRenderer.lock();
+    if (!asyncRenderer.get())
+    {
+        return;
+    }
+
+    FramePtr<CameraGPUFrame> gpuFrame = m_gpuFrameQueue.AcquireWrite();
+    if (!gpuFrame.HasFrame())
+    {
+        g_logger->warn("Camera GPU frame underrun!");
+        return;
+    }
+
+    std::shared_ptr<CameraCPUFrame> decodeFrame = inFrame;
+    if (inFrame->RawFrameFormat == FrameFormat_MJPEG || inFrame->RawFrameFormat == FrameFormat_BAYER16BG || inFrame->RawFrameFormat == FrameFormat_RAW10)
+    {
+        decodeFrame = DecodeFrame(*inFrame, asyncRenderer) ? m_decodedFrame : nullptr;
+    }
+
+    if (decodeFrame.get() && asyncRenderer->CopyAndDecodeCameraFrame(decodeFrame, &gpuFrame->FrameTextureResource))
+    {
+        gpuFrame->bIsValid = true;
+        gpuFrame->FrameLayout = inFrame->FrameLayout;
+        gpuFrame->FrameSequence = inFrame->FrameSequence;
+        gpuFrame->FrameExposureTimestamp = inFrame->FrameExposureTimestamp;
+        gpuFrame->CameraLeft.ViewToWorld = inFrame->CameraViewToWorldLeft;
+        gpuFrame->CameraRight.ViewToWorld = inFrame->CameraViewToWorldRight;
+        gpuFrame->bColorsPreadjusted = m_configManager->CheckEnableAsyncColorAdjustment();
+        gpuFrame->bisRectifiedFrame = false;
+        gpuFrame->FrameSize = inFrame->FrameSize;
+
+        gpuFrame.CommitWrite();
+    }
+    else
+    {
+        gpuFrame->bIsValid = false;
+    }
+
+    m_uploadTimer.EndPerfTimer();
+}
+
+// Converts the frame to RGBX in an upload buffer of its own, the same way a camera provider without GPU decoding of the format would.
+bool CameraFrameUploader::DecodeFrame(const CameraCPUFrame& inFrame, std::shared_ptr<IAsyncRenderer>& asyncRenderer)
+{
+    uint32_t width = inFrame.RawFrameSize.width;
+    uint32_t height = inFrame.RawFrameSize.height;
+    uint32_t decodedBytes = width * height * 4;
+
+    if (!m_decodedFrame.get())
+    {
+        m_decodedFrame = std::make_shared<CameraCPUFrame>();
+    }
+
+    if (!asyncRenderer->GetCameraUploadBuffer(m_decodedFrame->UploadBuffer, decodedBytes) &&
+        (m_decodedFrame->FrameBuffer.get() == nullptr || m_decodedFrame->FrameBuffer->size() < decodedBytes))
+    {
+        m_decodedFrame->FrameBuffer = std::make_shared<std::vector<uint8_t>>(decodedBytes);
+    }
+
+    cv::Mat output(height, width, CV_8UC4, m_decodedFrame->GetFrameData());
+
+    switch (inFrame.RawFrameFormat)
+    {
+    case FrameFormat_MJPEG:
+    {
+        m_decodeBuffer = cv::imdecode(cv::Mat(1, inFrame.RawFrameDataBytes, CV_8UC1, inFrame.GetFrameData()), cv::IMREAD_COLOR, &m_decodeBuffer);
+
+        if (m_decodeBuffer.cols != (int)width || m_decodeBuffer.rows != (int)height)
+        {
+            g_logger->warn("Failed to decode MJPEG camera frame!");
+            return false;
+        }
+
+        cv::cvtColor(m_decodeBuffer, output, cv::COLOR_BGR2RGBA);
+        break;
+    }
+    case FrameFormat_BAYER16BG:
+    {
+        cv::Mat bayer(height, width, CV_16UC1, inFrame.GetFrameData());
+        cv::cvtColor(bayer, m_decodeBuffer, cv::COLOR_BayerBG2RGB);
+        m_decodeBuffer.convertTo(m_decodeBuffer, CV_8UC3, 1.0 / 4.0);
+        cv::cvtColor(m_decodeBuffer, output, cv::COLOR_RGB2RGBA);
+        break;
+    }
+    case FrameFormat_RAW10:
+    {
+        // Packed rows with 4 pixels in 5 bytes.
+        if (width % 4 != 0)
+        {
+            g_logger->warn("RAW10 camera frame width {} is not divisible into 4 pixel groups, skipping frame!", width);
+            return false;
+        }
+
+        cv::Mat packed(height, width * 5 / 4, CV_8UC1, inFrame.GetFrameData());
+        ConvertRAW10ToGray(packed, m_decodeBuffer);
+        cv::cvtColor(m_decodeBuffer, output, cv::COLOR_GRAY2RGBA);
+        break;
+    }
+    default:
+        return false;
+    }
+
+    m_decodedFrame->bIsValid = true;
+    m_decodedFrame->bIsRaw = true;
+    m_decodedFrame->RawFrameFormat = FrameFormat_RGBX32;
+    m_decodedFrame->RawFrameDataBytes = decodedBytes;
+    m_decodedFrame->RawFrameSize = inFrame.RawFrameSize;
+    m_decodedFrame->FrameSize = inFrame.FrameSize;
+    m_decodedFrame->FrameLayout = inFrame.FrameLayout;
+    m_decodedFrame->FrameSequence = inFrame.FrameSequence;
+    m_decodedFrame->FrameExposureTimestamp = inFrame.FrameExposureTimestamp;
+    m_decodedFrame->CameraViewToWorldLeft = inFrame.CameraViewToWorldLeft;
+    m_decodedFrame->CameraViewToWorldRight = inFrame.CameraViewToWorldRight;
+
+    return true;
+}
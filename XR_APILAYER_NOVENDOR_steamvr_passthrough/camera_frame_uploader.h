@@ -0,0 +1,48 @@
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <opencv2/core.hpp>
+#include "layer_structs.h"
+#include "frame_queue.h"
+#include "perfutil.h"
+
+class IAsyncRenderer;
+class ConfigManager;
+
+
+// Uploads the frames from a camera CPU frame queue to the GPU frame queue through the async renderer, on a thread of its own
+// so that waiting on the upload does not delay the next capture. Formats the async frame decoder does not handle are converted to RGBX on the CPU first.
+class CameraFrameUploader
+{
+public:
+	CameraFrameUploader(std::shared_ptr<IAsyncRenderer> asyncRenderer, std::shared_ptr<ConfigManager> configManager, LockFreeFrameQueue<CameraCPUFrame>& cpuFrameQueue, LockFreeFrameQueue<CameraGPUFrame>& gpuFrameQueue);
+	~CameraFrameUploader();
+
+	void Start();
+	void Stop();
+
+	float GetUploadPerfTime() { return m_uploadTimer.GetAverageTimeMS(); }
+	float GetUploadQueueLatency() { return m_uploadQueueTimer.GetAverageTimeMS(); }
+
+private:
+	void UploadFrames();
+	void CopyCPUFrameToGPU(std::shared_ptr<CameraCPUFrame> inFrame);
+	bool DecodeFrame(const CameraCPUFrame& inFrame, std::shared_ptr<IAsyncRenderer>& asyncRenderer);
+
+	std::weak_ptr<IAsyncRenderer> m_asyncRenderer;
+	std::shared_ptr<ConfigManager> m_configManager;
+
+	// The CPU queue is only read here, and the GPU queue only written.
+	LockFreeFrameQueue<CameraCPUFrame>& m_cpuFrameQueue;
+	LockFreeFrameQueue<CameraGPUFrame>& m_gpuFrameQueue;
+
+	std::thread m_uploadThread;
+	std::atomic_bool m_bRunThread = false;
+
+	cv::Mat m_decodeBuffer;
+	std::shared_ptr<CameraCPUFrame> m_decodedFrame;
+
+	PerfTimer m_uploadTimer{ 20 };
+	PerfTimer m_uploadQueueTimer{ 20 };
+};
@@ -4,7 +4,6 @@
 #include <atomic>
 #include <xr_linear.h>
 #include "layer_structs.h"
-#include "passthrough_renderer.h"
 #include "async_renderer.h"
 #include "openvr_manager.h"
 #include "mesh.h"
@@ -13,6 +12,10 @@
 #include "pathutil.h"
 #include "perfutil.h"
 #include "frame_queue.h"
+#include "synthetic_frame_source.h"
+#include "camera_frame_uploader.h"
+
+class IPassthroughRenderer;
 
 
 enum ETrackedCameraFrameType
@@ -29,8 +32,15 @@ struct ECameraDistortionCoefficients
 
 #define POSTFRAME_SLEEP_INTERVAL (std::chrono::milliseconds(10))
 #define FRAME_POLL_INTERVAL (std::chrono::microseconds(100))
+#define FRAME_POLL_MARGIN_MS 2.0f
 #define FRAME_TIMEOUT_MS 1000
 
+// Maximum number of OpenVR block queue blocks held by camera frames at a time. Frames are copied instead when reached, so the queue does not run out of blocks.
+#define OPENVR_MAX_BORROWED_BLOCKS 2
+
+// How often the OpenCV camera looks for the configured tracked device while it is not connected.
+#define TRACKED_DEVICE_SEARCH_INTERVAL_S 1.0
+
 class ICameraManager
 {
 public:
@@ -55,12 +65,22 @@ public:
 	virtual float GetGPUFrameRetrievalPerfTime() { return -1.0f; }
 	virtual float GetCPUFrameRetrievalPerfTime() { return -1.0f; }
 	virtual FramePtr<CameraGPUFrame> AcquireCameraGPUFrame() = 0;
+	// Returns the kept frame with the exposure time closest to the given one.
+	virtual FramePtr<CameraGPUFrame> AcquireCameraGPUFrameForTime(const uint64_t exposureTime) = 0;
 	virtual void ReleaseCameraGPUFrame(std::shared_ptr<CameraGPUFrame> frame) = 0;
 	virtual FramePtr<CameraCPUFrame> AcquireCameraCPUFrame() = 0;
-
-	const void DumpCameraFrameTexture(const std::shared_ptr<std::vector<uint8_t>> frameBuffer, const uint32_t width, const uint32_t height, const std::string cameraProvider)
+	// Blocks until a CPU frame newer than the one lastSequence was set from is available, or until the timeout expires.
+	virtual FramePtr<CameraCPUFrame> WaitForCameraCPUFrame(uint64_t& lastSequence, const std::chrono::microseconds timeout) = 0;
+	virtual float GetServeThreadWakeupRate() { return -1.0f; }
+	// Latency added after the frame is received, by the capture stage and by waiting for the upload stage.
+	virtual float GetCaptureStageLatency() { return -1.0f; }
+	virtual float GetUploadQueueLatency() { return -1.0f; }
+	virtual FrameQueueStats GetGPUFrameQueueStats() const { return FrameQueueStats(); }
+	virtual FrameQueueStats GetCPUFrameQueueStats() const { return FrameQueueStats(); }
+
+	const void DumpCameraFrameTexture(const uint8_t* frameData, const size_t frameDataSize, const uint32_t width, const uint32_t height, const std::string cameraProvider)
 	{
-		if (!frameBuffer.get() || frameBuffer->size() == 0)
+		if (!frameData || frameDataSize == 0)
 		{
 			g_logger->warn("No framebuffer to write!");
 			return;
@@ -70,7 +90,7 @@ public:
 	
 		const std::string fileName = GetLocalAppData() + std::format("\\{} Camera Frame {:%Y-%m-%d %H-%M-%S}.png", cameraProvider, time);
 
-		uint32_t error = lodepng::encode(fileName, frameBuffer->data(), width, height);
+		uint32_t error = lodepng::encode(fileName, frameData, width, height);
 
 		if (error)
 		{
@@ -109,13 +129,19 @@ public:
 	void UpdateStaticCameraParameters();
 	float GetGPUFrameRetrievalPerfTime() { return m_gpuFrameTimer.GetAverageTimeMS(); }
 	float GetCPUFrameRetrievalPerfTime() { return m_cpuFrameTimer.GetAverageTimeMS(); }
+	float GetServeThreadWakeupRate() { return m_serveWakeupCounter.GetRatePerSecond() + m_blockQueueWakeupCounter.GetRatePerSecond(); }
+	FrameQueueStats GetGPUFrameQueueStats() const { return m_gpuFrameQueue.GetStats(); }
+	FrameQueueStats GetCPUFrameQueueStats() const { return m_cpuFrameQueue.GetStats(); }
 	FramePtr<CameraGPUFrame> AcquireCameraGPUFrame();
+	FramePtr<CameraGPUFrame> AcquireCameraGPUFrameForTime(const uint64_t exposureTime);
 	void ReleaseCameraGPUFrame(std::shared_ptr<CameraGPUFrame> frame);
 	FramePtr<CameraCPUFrame> AcquireCameraCPUFrame();
+	FramePtr<CameraCPUFrame> WaitForCameraCPUFrame(uint64_t& lastSequence, const std::chrono::microseconds timeout);
 
 private:
 	void ServeFrames();
 	void ServeBlockQueueFrames();
+	void ReadBlockQueueFrames();
 	void CopyCPUFrameToGPU(std::shared_ptr<CameraCPUFrame> frame);
 	bool GetHMDPoseForTime(XrMatrix4x4f& headToTrackingPose, const uint64_t time);
 	void GetTrackedCameraEyePoses(XrMatrix4x4f& LeftPose, XrMatrix4x4f& RightPose, bool bForceOpenVRValue);
@@ -160,6 +186,9 @@ private:
 	bool m_bPoseAvailable = false;
 	std::atomic_bool m_bUseBlockQueue = false;
 
+	// Shared with the release callbacks of the borrowed blocks, which may outlive the manager.
+	std::shared_ptr<std::atomic_int> m_numBorrowedBlocks = std::make_shared<std::atomic_int>(0);
+
 	FrameQueue<CameraGPUFrame> m_gpuFrameQueue;
 	FrameQueue<CameraCPUFrame> m_cpuFrameQueue;
 
@@ -179,6 +208,8 @@ private:
 
 	PerfTimer m_gpuFrameTimer{ 20 };
 	PerfTimer m_cpuFrameTimer{ 20 };
+	RateCounter m_serveWakeupCounter;
+	RateCounter m_blockQueueWakeupCounter;
 };
 
 
@@ -206,15 +237,23 @@ public:
 	bool IsUsingFisheyeModel() const;
 	XrMatrix4x4f GetLeftToRightCameraTransform() const;
 	void UpdateStaticCameraParameters();
-	float GetGPUFrameRetrievalPerfTime() { return m_gpuFrameTimer.GetAverageTimeMS(); }
+	float GetGPUFrameRetrievalPerfTime() { return m_frameUploader.GetUploadPerfTime(); }
 	float GetCPUFrameRetrievalPerfTime() { return m_cpuFrameTimer.GetAverageTimeMS(); }
+	float GetServeThreadWakeupRate() { return m_serveWakeupCounter.GetRatePerSecond(); }
+	float GetCaptureStageLatency() { return m_captureStageTimer.GetAverageTimeMS(); }
+	float GetUploadQueueLatency() { return m_frameUploader.GetUploadQueueLatency(); }
+	FrameQueueStats GetGPUFrameQueueStats() const { return m_gpuFrameQueue.GetStats(); }
+	FrameQueueStats GetCPUFrameQueueStats() const { return m_cpuFrameQueue.GetStats(); }
 	FramePtr<CameraGPUFrame> AcquireCameraGPUFrame();
+	FramePtr<CameraGPUFrame> AcquireCameraGPUFrameForTime(const uint64_t exposureTime);
 	void ReleaseCameraGPUFrame(std::shared_ptr<CameraGPUFrame> frame);
 	FramePtr<CameraCPUFrame> AcquireCameraCPUFrame();
+	FramePtr<CameraCPUFrame> WaitForCameraCPUFrame(uint64_t& lastSequence, const std::chrono::microseconds timeout);
 
 private:
 	void ServeFrames();
-	void CopyCPUFrameToGPU(std::shared_ptr<CameraCPUFrame> frame);
+	int GetTrackedDeviceIndex(vr::IVRSystem* vrSystem, const Config_Camera& cameraConf, const uint64_t currentTime);
+	void UpdateCameraExtrinsics(const Config_Camera& cameraConf);
 
 	std::shared_ptr<ConfigManager> m_configManager;
 	std::shared_ptr<OpenVRManager> m_openVRManager;
@@ -228,10 +267,13 @@ private:
 	uint32_t m_cameraTextureWidth = 0;
 	uint32_t m_cameraTextureHeight = 0;
 	uint32_t m_cameraFrameBufferSize = 0;
+	ECameraFrameFormat m_captureFormat = FrameFormat_RGBX32;
 
 	uint32_t m_cameraFrameWidth = 0;
 	uint32_t m_cameraFrameHeight = 0;
 
+	cv::Mat m_mjpegDecodeBuffer;
+
 	float m_projectionDistanceFar;
 	bool m_useAlternateProjectionCalc;
 
@@ -245,12 +287,88 @@ private:
 	std::mutex m_serveMutex;
 	std::mutex m_serveMutexCPU;
 
-	FrameQueue<CameraGPUFrame> m_gpuFrameQueue;
-	FrameQueue<CameraCPUFrame> m_cpuFrameQueue;
+	// The CPU queue is only written from the serve thread, and the GPU queue from the upload thread.
+	LockFreeFrameQueue<CameraGPUFrame> m_gpuFrameQueue;
+	LockFreeFrameQueue<CameraCPUFrame> m_cpuFrameQueue;
+	CameraFrameUploader m_frameUploader;
 
 	int m_hmdDeviceId = -1;
 	EStereoFrameLayout m_frameLayout;
 
-	PerfTimer m_gpuFrameTimer{ 20 };
+	// Cached from the camera config, and only updated when the config revision changes.
+	int m_trackedDeviceIndex = -1;
+	uint32_t m_trackedDeviceConfigRevision = 0;
+	uint64_t m_lastTrackedDeviceSearchTime = 0;
+	XrMatrix4x4f m_camera0Pose;
+	XrMatrix4x4f m_camera1Pose;
+	uint32_t m_extrinsicsConfigRevision = 0;
+	bool m_bExtrinsicsValid = false;
+
+	PerfTimer m_cpuFrameTimer{ 20 };
+	PerfTimer m_captureStageTimer{ 20 };
+	RateCounter m_serveWakeupCounter;
+};
+
+
+// Serves frames from a procedural test scene or a video file, with scripted HMD poses.
+// Does not use SteamVR or a physical camera, so the processing pipeline can be run under repeatable load.
+class CameraManagerSynthetic : public ICameraManager
+{
+public:
+
+	CameraManagerSynthetic(std::shared_ptr<IAsyncRenderer> asyncRenderer, std::shared_ptr<ConfigManager> configManager);
+	~CameraManagerSynthetic();
+
+	bool InitCamera();
+	void DeinitCamera();
+	void SetPaused(bool bIsPaused)
+	{
+		m_bIsPaused = bIsPaused;
+	}
+
+	EPassthroughCameraState GetCameraState() const;
+	void GetCameraDisplayStats(uint32_t& width, uint32_t& height, float& fps, ECameraProvider& provider, bool& bIsActive) const;
+	void GetDistortedTextureSize(uint32_t& width, uint32_t& height) const;
+	void GetDistortedFrameSize(uint32_t& width, uint32_t& height) const;
+	void GetIntrinsics(const ERenderEye cameraEye, XrVector2f& focalLength, XrVector2f& center) const;
+	void GetDistortionCoefficients(ECameraDistortionCoefficients& coeffs) const;
+	EStereoFrameLayout GetFrameLayout() const;
+	bool IsUsingFisheyeModel() const;
+	XrMatrix4x4f GetLeftToRightCameraTransform() const;
+	void UpdateStaticCameraParameters();
+	float GetGPUFrameRetrievalPerfTime() { return m_frameUploader.GetUploadPerfTime(); }
+	float GetCPUFrameRetrievalPerfTime() { return m_cpuFrameTimer.GetAverageTimeMS(); }
+	float GetServeThreadWakeupRate() { return m_serveWakeupCounter.GetRatePerSecond(); }
+	float GetCaptureStageLatency() { return m_captureStageTimer.GetAverageTimeMS(); }
+	float GetUploadQueueLatency() { return m_frameUploader.GetUploadQueueLatency(); }
+	FrameQueueStats GetGPUFrameQueueStats() const { return m_gpuFrameQueue.GetStats(); }
+	FrameQueueStats GetCPUFrameQueueStats() const { return m_cpuFrameQueue.GetStats(); }
+	FramePtr<CameraGPUFrame> AcquireCameraGPUFrame();
+	FramePtr<CameraGPUFrame> AcquireCameraGPUFrameForTime(const uint64_t exposureTime);
+	void ReleaseCameraGPUFrame(std::shared_ptr<CameraGPUFrame> frame);
+	FramePtr<CameraCPUFrame> AcquireCameraCPUFrame();
+	FramePtr<CameraCPUFrame> WaitForCameraCPUFrame(uint64_t& lastSequence, const std::chrono::microseconds timeout);
+
+private:
+	void ServeFrames();
+
+	std::shared_ptr<ConfigManager> m_configManager;
+
+	bool m_bCameraInitialized = false;
+	bool m_bIsPaused = false;
+
+	SyntheticFrameSource m_frameSource;
+
+	std::weak_ptr<IAsyncRenderer> m_asyncRenderer;
+	std::thread m_serveThread;
+	std::atomic_bool m_bRunThread = true;
+	uint64_t m_startTime = 0;
+
+	LockFreeFrameQueue<CameraGPUFrame> m_gpuFrameQueue;
+	LockFreeFrameQueue<CameraCPUFrame> m_cpuFrameQueue;
+	CameraFrameUploader m_frameUploader;
+
 	PerfTimer m_cpuFrameTimer{ 20 };
-};
\ No newline at end of file
+	PerfTimer m_captureStageTimer{ 20 };
+	RateCounter m_serveWakeupCounter;
+};
@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include "mathutil.h"
 #include "perfutil.h"
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
 
 
 
@@ -23,8 +25,9 @@ CameraManagerOpenCV::CameraManagerOpenCV(std::shared_ptr<IPassthroughRenderer> i
     , m_useAlternateProjectionCalc(false)
     , m_videoCapture()
     , m_bIsAugmented(bIsAugmented)
-    , m_gpuFrameQueue(4)
-    , m_cpuFrameQueue(3)
+    , m_gpuFrameQueue(CAMERA_GPU_FRAME_QUEUE_SIZE, CAMERA_FRAME_HISTORY_DEPTH)
+    , m_cpuFrameQueue(4)
+    , m_frameUploader(asyncRenderer, configManager, m_cpuFrameQueue, m_gpuFrameQueue)
 {
 }
 
@@ -32,11 +35,14 @@ CameraManagerOpenCV::~CameraManagerOpenCV()
 {
     DeinitCamera();
 
+    m_bRunThread = false;
+
     if (m_serveThread.joinable())
     {
-        m_bRunThread = false;
         m_serveThread.join();
     }
+
+    m_frameUploader.Stop();
 }
 
 bool CameraManagerOpenCV::InitCamera()
@@ -50,15 +56,27 @@ bool CameraManagerOpenCV::InitCamera()
     // Prevent long startup times on cams with many modes when using MSMF
     _putenv_s("OPENCV_VIDEOIO_MSMF_ENABLE_HW_TRANSFORMS", "0");
 
+    int nativeFourCC = 0;
+    if (cameraConf.CameraCaptureFormat == CameraCaptureFormat_NativeYUYV)
+    {
+        nativeFourCC = cv::VideoWriter::fourcc('Y', 'U', 'Y', '2');
+    }
+    else if (cameraConf.CameraCaptureFormat == CameraCaptureFormat_NativeMJPEG)
+    {
+        nativeFourCC = cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
+    }
+
     if (cameraConf.RequestCustomFrameSize)
     {
         std::vector<int> props = { cv::CAP_PROP_FRAME_WIDTH, cameraConf.CustomFrameDimensions[0], cv::CAP_PROP_FRAME_HEIGHT,  cameraConf.CustomFrameDimensions[1], cv::CAP_PROP_FPS, cameraConf.CustomFrameRate };
+        if (nativeFourCC != 0) { props.insert(props.end(), { cv::CAP_PROP_FOURCC, nativeFourCC }); }
         m_videoCapture.open(cameraConf.Camera0DeviceIndex, cv::CAP_ANY, props);
     }
     else
     {
         // Prioritize FPS is no frame paramters set
         std::vector<int> props = { cv::CAP_PROP_FPS, 1000 };
+        if (nativeFourCC != 0) { props.insert(props.end(), { cv::CAP_PROP_FOURCC, nativeFourCC }); }
         m_videoCapture.open(cameraConf.Camera0DeviceIndex, cv::CAP_ANY, props);
     }
 
@@ -70,6 +88,22 @@ bool CameraManagerOpenCV::InitCamera()
 
     g_logger->info("OpenCV Video capture opened using API: {}", m_videoCapture.getBackendName());
 
+    // Pass the native stream on unconverted if the camera accepted the requested format.
+    m_captureFormat = FrameFormat_RGBX32;
+    if (nativeFourCC != 0)
+    {
+        if ((int)m_videoCapture.get(cv::CAP_PROP_FOURCC) == nativeFourCC && m_videoCapture.set(cv::CAP_PROP_CONVERT_RGB, 0))
+        {
+            m_captureFormat = cameraConf.CameraCaptureFormat == CameraCaptureFormat_NativeMJPEG ? FrameFormat_MJPEG : FrameFormat_YUYV16;
+            g_logger->info("Capturing native camera stream in format {}", (int32_t)m_captureFormat);
+        }
+        else
+        {
+            m_videoCapture.set(cv::CAP_PROP_CONVERT_RGB, 1);
+            g_logger->warn("Camera does not support the requested native capture format, converting frames to RGB");
+        }
+    }
+
     if (cameraConf.AutoExposureEnable)
     {
         m_videoCapture.set(cv::CAP_PROP_AUTO_EXPOSURE, 1);
@@ -94,6 +128,8 @@ bool CameraManagerOpenCV::InitCamera()
         m_serveThread = std::thread(&CameraManagerOpenCV::ServeFrames, this);
     }
 
+    m_frameUploader.Start();
+
     return true;
 }
 
@@ -108,6 +144,8 @@ void CameraManagerOpenCV::DeinitCamera()
         m_serveThread.join();
     }
 
+    m_frameUploader.Stop();
+
     m_videoCapture.release();
 }
 
@@ -279,6 +317,13 @@ FramePtr<CameraGPUFrame> CameraManagerOpenCV::AcquireCameraGPUFrame()
     return m_gpuFrameQueue.AcquireRead();
 }
 
+FramePtr<CameraGPUFrame> CameraManagerOpenCV::AcquireCameraGPUFrameForTime(const uint64_t exposureTime)
+{
+    if (!m_bCameraInitialized) { return FramePtr<CameraGPUFrame>(); }
+
+    return m_gpuFrameQueue.AcquireReadForTime(exposureTime);
+}
+
 void CameraManagerOpenCV::ReleaseCameraGPUFrame(std::shared_ptr<CameraGPUFrame> frame)
 {
     m_gpuFrameQueue.ReleaseRead(frame);
@@ -291,6 +336,17 @@ FramePtr<CameraCPUFrame> CameraManagerOpenCV::AcquireCameraCPUFrame()
     return m_cpuFrameQueue.AcquireRead();
 }
 
+FramePtr<CameraCPUFrame> CameraManagerOpenCV::WaitForCameraCPUFrame(uint64_t& lastSequence, const std::chrono::microseconds timeout)
+{
+    if (!m_bCameraInitialized)
+    {
+        std::this_thread::sleep_for(timeout);
+        return FramePtr<CameraCPUFrame>();
+    }
+
+    return m_cpuFrameQueue.WaitForRead(lastSequence, timeout);
+}
+
 void CameraManagerOpenCV::ServeFrames()
 {
     vr::IVRSystem* vrSystem = m_openVRManager->GetVRSystem();
@@ -299,12 +355,13 @@ void CameraManagerOpenCV::ServeFrames()
     if (!m_videoCapture.isOpened()) { return; }
 
     uint32_t frameSequence = 0;
-    vr::TrackedDevicePose_t trackedDevicePoseArray[vr::k_unMaxTrackedDeviceCount];
     cv::Mat frameBuffer;
     uint64_t tickFreq = GetSytemTickFrequency();
 
     while (m_bRunThread && m_videoCapture.isOpened())
     {
+        m_serveWakeupCounter.AddEvent();
+
         if (m_bIsPaused)
         { 
             std::this_thread::sleep_for(POSTFRAME_SLEEP_INTERVAL);
@@ -346,8 +403,6 @@ void CameraManagerOpenCV::ServeFrames()
         // Frame latency is approximated from when grab() returns.
         uint64_t currentTime = GetCurrentTimeSytemTicks();
 
-        vrSystem->GetDeviceToAbsoluteTrackingPose(vr::TrackingUniverseStanding, -cameraConf.FrameDelayOffset, trackedDevicePoseArray, vr::k_unMaxTrackedDeviceCount);
-
         uint64_t delayOffsetTicks = (uint64_t)(cameraConf.FrameDelayOffset * tickFreq);
         cpuFrame->FrameExposureTimestamp = (currentTime - delayOffsetTicks);
 
@@ -359,84 +414,105 @@ void CameraManagerOpenCV::ServeFrames()
 
         if (!m_bRunThread) { return; }
 
-        if (cpuFrame->FrameBuffer.get() == nullptr)
+        // Native frames are passed on as is, the MJPEG size varies per frame.
+        uint32_t frameDataBytes = m_cameraFrameBufferSize;
+        if (m_captureFormat != FrameFormat_RGBX32)
         {
-            cpuFrame->FrameBuffer = std::make_shared<std::vector<uint8_t>>(m_cameraFrameBufferSize);
+            frameDataBytes = (uint32_t)(frameBuffer.total() * frameBuffer.elemSize());
+
+            if (!frameBuffer.isContinuous() || frameDataBytes == 0 ||
+                (m_captureFormat == FrameFormat_YUYV16 && frameDataBytes < m_cameraTextureWidth * m_cameraTextureHeight * 2))
+            {
+                g_logger->warn("Invalid native camera frame received, size {}", frameDataBytes);
+                continue;
+            }
+        }
+
+        // Decode MJPEG frames here, so that the upload and the stereo reconstruction share the same decoded frame.
+        if (m_captureFormat == FrameFormat_MJPEG)
+        {
+            m_mjpegDecodeBuffer = cv::imdecode(frameBuffer, cv::IMREAD_COLOR, &m_mjpegDecodeBuffer);
+
+            if (m_mjpegDecodeBuffer.cols != (int)m_cameraTextureWidth || m_mjpegDecodeBuffer.rows != (int)m_cameraTextureHeight)
+            {
+                g_logger->warn("Failed to decode MJPEG camera frame!");
+                continue;
+            }
+
+            frameDataBytes = m_cameraFrameBufferSize;
+        }
+
+        // Write straight into GPU upload memory when the frames are decoded on the async renderer.
+        std::shared_ptr<AsyncRenderer> asyncRenderer = m_asyncRenderer.lock();
+        if (!asyncRenderer.get() || !asyncRenderer->GetCameraUploadBuffer(cpuFrame->UploadBuffer, frameDataBytes))
+        {
+            cpuFrame->UploadBuffer.reset();
+
+            if (cpuFrame->FrameBuffer.get() == nullptr || cpuFrame->FrameBuffer->size() < frameDataBytes)
+            {
+                cpuFrame->FrameBuffer = std::make_shared<std::vector<uint8_t>>(frameDataBytes);
+            }
         }
 
-        cv::Mat paddedBuffer = cv::Mat(frameBuffer.rows, frameBuffer.cols, CV_8UC4, (void*)cpuFrame->FrameBuffer->data());
+        if (m_captureFormat == FrameFormat_MJPEG)
+        {
+            cv::Mat paddedBuffer = cv::Mat(m_mjpegDecodeBuffer.rows, m_mjpegDecodeBuffer.cols, CV_8UC4, (void*)cpuFrame->GetFrameData());
+            cv::cvtColor(m_mjpegDecodeBuffer, paddedBuffer, cv::COLOR_BGR2RGBA);
+        }
+        else if (m_captureFormat != FrameFormat_RGBX32)
+        {
+            memcpy(cpuFrame->GetFrameData(), frameBuffer.data, frameDataBytes);
+        }
+        else
+        {
+            cv::Mat paddedBuffer = cv::Mat(frameBuffer.rows, frameBuffer.cols, CV_8UC4, (void*)cpuFrame->GetFrameData());
 
-        int from_to[] = { 0,2, 1,1, 2,0, -1,3 };
-        cv::mixChannels(&frameBuffer, 1, &paddedBuffer, 1, from_to, frameBuffer.channels());
+            int from_to[] = { 0,2, 1,1, 2,0, -1,3 };
+            cv::mixChannels(&frameBuffer, 1, &paddedBuffer, 1, from_to, frameBuffer.channels());
+        }
 
         cpuFrame->bIsRaw = true;
-        cpuFrame->RawFrameFormat = FrameFormat_RGBX32;
-        cpuFrame->RawFrameDataBytes = m_cameraFrameBufferSize;
-        cpuFrame->RawFrameSize = { (uint32_t)frameBuffer.cols, (uint32_t)frameBuffer.rows };
+        cpuFrame->RawFrameFormat = m_captureFormat == FrameFormat_MJPEG ? FrameFormat_RGBX32 : m_captureFormat;
+        cpuFrame->RawFrameDataBytes = frameDataBytes;
+        cpuFrame->RawFrameSize = { m_cameraTextureWidth, m_cameraTextureHeight };
 
 
-        if (m_configManager->CheckFrameTextureDumpPending())
+        if (cpuFrame->RawFrameFormat == FrameFormat_RGBX32 && m_configManager->CheckFrameTextureDumpPending())
         {
-            DumpCameraFrameTexture(cpuFrame->FrameBuffer, m_cameraTextureWidth, m_cameraTextureHeight, "OpenCV");
+            DumpCameraFrameTexture(cpuFrame->GetFrameData(), cpuFrame->GetFrameDataSize(), m_cameraTextureWidth, m_cameraTextureHeight, "OpenCV");
         }
       
         XrMatrix4x4f trackedDevicePose;
 
         if (cameraConf.UseTrackedDevice)
-        {
-            int trackedDeviceIndex = 0;
-            char buffer[128] = { 0 };
-            for (int i = 0; i < vr::k_unMaxTrackedDeviceCount; i++)
-            {
-                if (!vrSystem->IsTrackedDeviceConnected(i))
-                {
-                    break;
-                }
-                vrSystem->GetStringTrackedDeviceProperty(i, vr::Prop_SerialNumber_String, buffer, 127);
-                if (strncmp(buffer, cameraConf.TrackedDeviceSerialNumber, MAX_CAMERA_SERIAL_NUMBER_SIZE) == 0)
-                {
-                    trackedDeviceIndex = i;
-                    break;
-                }
-
-            }
-            trackedDevicePose = ToXRMatrix4x4(trackedDevicePoseArray[trackedDeviceIndex].mDeviceToAbsoluteTracking);
-        }
-        else
         {
             vr::HmdMatrix34_t pose = { 0 };
             pose.m[0][0] = 1.0;
             pose.m[1][1] = 1.0;
             pose.m[2][2] = 1.0;
+            m_openVRManager->GetPoseHistory()->GetDevicePoseForTime(GetTrackedDeviceIndex(vrSystem, cameraConf, currentTime), cpuFrame->FrameExposureTimestamp, pose);
             trackedDevicePose = ToXRMatrix4x4(pose);
         }
-    
-
-        XrMatrix4x4f camera0ToWorld, camera1ToWorld, camera0Pose, camera1Pose, transMatrix, rotMatrix, temp;
+        else
+        {
+            XrMatrix4x4f_CreateIdentity(&trackedDevicePose);
+        }
 
-        XrMatrix4x4f_CreateTranslation(&transMatrix, -cameraConf.Camera0_Translation[0], -cameraConf.Camera0_Translation[1], -cameraConf.Camera0_Translation[2]);
-        XrMatrix4x4f_CreateRotation(&rotMatrix, -cameraConf.Camera0_Rotation[0], -cameraConf.Camera0_Rotation[1], -cameraConf.Camera0_Rotation[2]);
+        UpdateCameraExtrinsics(cameraConf);
 
-        XrMatrix4x4f_Multiply(&temp, &rotMatrix, &transMatrix);
-        XrMatrix4x4f_Invert(&camera0Pose, &temp);
+        XrMatrix4x4f camera0ToWorld, camera1ToWorld;
 
         if (m_frameLayout == EStereoFrameLayout::FrameLayout_Mono)
         {
-            XrMatrix4x4f_Multiply(&camera0ToWorld, &trackedDevicePose, &camera0Pose);
+            XrMatrix4x4f_Multiply(&camera0ToWorld, &trackedDevicePose, &m_camera0Pose);
 
             cpuFrame->CameraViewToWorldLeft = camera0ToWorld;
             cpuFrame->CameraViewToWorldRight = camera0ToWorld;
         }
         else
         {
-            XrMatrix4x4f_CreateTranslation(&transMatrix, -cameraConf.Camera1_Translation[0], -cameraConf.Camera1_Translation[1], -cameraConf.Camera1_Translation[2]);
-            XrMatrix4x4f_CreateRotation(&rotMatrix, -cameraConf.Camera1_Rotation[0], -cameraConf.Camera1_Rotation[1], -cameraConf.Camera1_Rotation[2]);
-
-            XrMatrix4x4f_Multiply(&temp, &rotMatrix, &transMatrix);
-            XrMatrix4x4f_Invert(&camera1Pose, &temp);
-
-            XrMatrix4x4f_Multiply(&camera0ToWorld, &trackedDevicePose, &camera0Pose);
-            XrMatrix4x4f_Multiply(&camera1ToWorld, &trackedDevicePose, &camera1Pose);
+            XrMatrix4x4f_Multiply(&camera0ToWorld, &trackedDevicePose, &m_camera0Pose);
+            XrMatrix4x4f_Multiply(&camera1ToWorld, &trackedDevicePose, &m_camera1Pose);
 
             cpuFrame->CameraViewToWorldLeft = camera0ToWorld;
             cpuFrame->CameraViewToWorldRight = camera1ToWorld;
@@ -451,48 +527,78 @@ void CameraManagerOpenCV::ServeFrames()
 
         m_cpuFrameTimer.EndPerfTimer();
 
-        cpuFrame.CommitWriteAndAcquireRead();
-        CopyCPUFrameToGPU(cpuFrame.GetSharedPointer());
+        cpuFrame->FrameReadyTime = GetCurrentTimeSytemTicks();
+        m_captureStageTimer.AveragesAddTimeInterval(currentTime, cpuFrame->FrameReadyTime);
+
+        cpuFrame.CommitWrite();
     }
 }
 
 
-void CameraManagerOpenCV::CopyCPUFrameToGPU(std::shared_ptr<CameraCPUFrame> inFrame)
+int CameraManagerOpenCV::GetTrackedDeviceIndex(vr::IVRSystem* vrSystem, const Config_Camera& cameraConf, const uint64_t currentTime)
 {
-    m_gpuFrameTimer.StartPerfTimer();
+    uint32_t configRevision = m_configManager->GetCameraConfigRevision();
 
-    std::shared_ptr<AsyncRenderer> asyncRenderer = m_asyncRenderer.lock();
-    if (!asyncRenderer.get())
+    if (configRevision != m_trackedDeviceConfigRevision)
     {
-        return;
+        m_trackedDeviceConfigRevision = configRevision;
+        m_trackedDeviceIndex = -1;
+        m_lastTrackedDeviceSearchTime = 0;
     }
 
-    FramePtr<CameraGPUFrame> gpuFrame = m_gpuFrameQueue.AcquireWrite();
-    if (!gpuFrame.HasFrame())
+    // The layer can't poll the OpenVR events without taking them from the runtime, so disconnects
+    // are detected from the cached device, and missing devices are searched for at an interval.
+    if (m_trackedDeviceIndex >= 0 && !vrSystem->IsTrackedDeviceConnected(m_trackedDeviceIndex))
     {
-        g_logger->warn("Camera GPU frame underrun!");
-        return;
+        m_trackedDeviceIndex = -1;
+        m_lastTrackedDeviceSearchTime = 0;
     }
 
-    if (asyncRenderer->CopyAndDecodeCameraFrame(inFrame, &gpuFrame->FrameTextureResource))
+    if (m_trackedDeviceIndex < 0 &&
+        (m_lastTrackedDeviceSearchTime == 0 || GetPerfTimeDiffSeconds(m_lastTrackedDeviceSearchTime, currentTime) >= TRACKED_DEVICE_SEARCH_INTERVAL_S))
     {
-        gpuFrame->bIsValid = true;
-        gpuFrame->FrameLayout = m_frameLayout;
-        gpuFrame->FrameSequence = inFrame->FrameSequence;
-        gpuFrame->FrameExposureTimestamp = inFrame->FrameExposureTimestamp;
-        gpuFrame->CameraLeft.ViewToWorld = inFrame->CameraViewToWorldLeft;
-        gpuFrame->CameraRight.ViewToWorld = inFrame->CameraViewToWorldRight;
-        gpuFrame->bColorsPreadjusted = m_configManager->CheckEnableAsyncColorAdjustment();
-        gpuFrame->bisRectifiedFrame = false;
-        gpuFrame->FrameSize = inFrame->FrameSize;
-
-        gpuFrame.CommitWrite();
-    }
-    else
-    {
-        gpuFrame->bIsValid = false;
+        m_lastTrackedDeviceSearchTime = currentTime;
+
+        char buffer[128] = { 0 };
+        for (int i = 0; i < vr::k_unMaxTrackedDeviceCount; i++)
+        {
+            if (!vrSystem->IsTrackedDeviceConnected(i))
+            {
+                break;
+            }
+            vrSystem->GetStringTrackedDeviceProperty(i, vr::Prop_SerialNumber_String, buffer, 127);
+            if (strncmp(buffer, cameraConf.TrackedDeviceSerialNumber, MAX_CAMERA_SERIAL_NUMBER_SIZE) == 0)
+            {
+                m_trackedDeviceIndex = i;
+                break;
+            }
+        }
     }
 
-    m_gpuFrameTimer.EndPerfTimer();
+    // Use the HMD pose if the device is not found.
+    return m_trackedDeviceIndex >= 0 ? m_trackedDeviceIndex : 0;
 }
 
+void CameraManagerOpenCV::UpdateCameraExtrinsics(const Config_Camera& cameraConf)
+{
+    uint32_t configRevision = m_configManager->GetCameraConfigRevision();
+
+    if (m_bExtrinsicsValid && configRevision == m_extrinsicsConfigRevision) { return; }
+
+    m_extrinsicsConfigRevision = configRevision;
+    m_bExtrinsicsValid = true;
+
+    XrMatrix4x4f transMatrix, rotMatrix, temp;
+
+    XrMatrix4x4f_CreateTranslation(&transMatrix, -cameraConf.Camera0_Translation[0], -cameraConf.Camera0_Translation[1], -cameraConf.Camera0_Translation[2]);
+    XrMatrix4x4f_CreateRotation(&rotMatrix, -cameraConf.Camera0_Rotation[0], -cameraConf.Camera0_Rotation[1], -cameraConf.Camera0_Rotation[2]);
+
+    XrMatrix4x4f_Multiply(&temp, &rotMatrix, &transMatrix);
+    XrMatrix4x4f_Invert(&m_camera0Pose, &temp);
+
+    XrMatrix4x4f_CreateTranslation(&transMatrix, -cameraConf.Camera1_Translation[0], -cameraConf.Camera1_Translation[1], -cameraConf.Camera1_Translation[2]);
+    XrMatrix4x4f_CreateRotation(&rotMatrix, -cameraConf.Camera1_Rotation[0], -cameraConf.Camera1_Rotation[1], -cameraConf.Camera1_Rotation[2]);
+
+    XrMatrix4x4f_Multiply(&temp, &rotMatrix, &transMatrix);
+    XrMatrix4x4f_Invert(&m_camera1Pose, &temp);
+}
@@ -1,6 +1,7 @@
 
 #include "pch.h"
 #include "camera_manager.h"
+#include "passthrough_renderer.h"
 #include "layer_structs.h"
 #include "mathutil.h"
 #include "perfutil.h"
@@ -18,9 +19,18 @@ CameraManagerOpenVR::CameraManagerOpenVR(std::shared_ptr<IPassthroughRenderer> i
     , m_frameLayout(EStereoFrameLayout::FrameLayout_Mono)
     , m_projectionDistanceFar(5.0f)
     , m_useAlternateProjectionCalc(false)
-    , m_gpuFrameQueue(4)
+    , m_gpuFrameQueue(CAMERA_GPU_FRAME_QUEUE_SIZE, CAMERA_FRAME_HISTORY_DEPTH)
     , m_cpuFrameQueue(3)
 {
+    // Return borrowed block queue blocks as soon as the frame is no longer readable, instead of when the slot is written again.
+    m_cpuFrameQueue.SetRetireCallback([](CameraCPUFrame& frame)
+    {
+        if (frame.BorrowedFrameData.get())
+        {
+            frame.BorrowedFrameData.reset();
+            frame.bIsValid = false;
+        }
+    });
 }
 
 CameraManagerOpenVR::~CameraManagerOpenVR()
@@ -491,6 +501,13 @@ FramePtr<CameraGPUFrame> CameraManagerOpenVR::AcquireCameraGPUFrame()
     return m_gpuFrameQueue.AcquireRead();
 }
 
+FramePtr<CameraGPUFrame> CameraManagerOpenVR::AcquireCameraGPUFrameForTime(const uint64_t exposureTime)
+{
+    if (!m_bCameraInitialized) { return FramePtr<CameraGPUFrame>(); }
+
+    return m_gpuFrameQueue.AcquireReadForTime(exposureTime);
+}
+
 void CameraManagerOpenVR::ReleaseCameraGPUFrame(std::shared_ptr<CameraGPUFrame> frame)
 {
     m_gpuFrameQueue.ReleaseRead(frame);
@@ -503,6 +520,17 @@ FramePtr<CameraCPUFrame> CameraManagerOpenVR::AcquireCameraCPUFrame()
     return m_cpuFrameQueue.AcquireRead();
 }
 
+FramePtr<CameraCPUFrame> CameraManagerOpenVR::WaitForCameraCPUFrame(uint64_t& lastSequence, const std::chrono::microseconds timeout)
+{
+    if (!m_bCameraInitialized)
+    {
+        std::this_thread::sleep_for(timeout);
+        return FramePtr<CameraCPUFrame>();
+    }
+
+    return m_cpuFrameQueue.WaitForRead(lastSequence, timeout);
+}
+
 
 
 void CameraManagerOpenVR::ServeFrames()
@@ -525,6 +553,10 @@ void CameraManagerOpenVR::ServeFrames()
 
     m_bWaitingForCamera = true;
     uint32_t lastFrameSequence = 0;
+    uint64_t lastFrameExposureTime = 0;
+    uint64_t lastFrameArrivalTime = 0;
+    PerfTimer frameIntervalTimer{ 20 };
+    bool bHasFrameInterval = false;
 
     while (m_bRunThread)
     {
@@ -551,12 +583,25 @@ void CameraManagerOpenVR::ServeFrames()
         {
             continue;
         }
-        
+
+        // There is no way to wait on the tracked camera for a new frame, so sleep until shortly
+        // before the next one is expected, and only poll for the remainder.
+        if (bHasFrameInterval && !m_bWaitingForCamera)
+        {
+            float sinceLastFrameMS = (float)GetPerfTimeDiffSeconds(lastFrameArrivalTime, GetCurrentTimeSytemTicks()) * 1000.0f;
+            float untilNextFrameMS = frameIntervalTimer.GetAverageTimeMS() - sinceLastFrameMS - FRAME_POLL_MARGIN_MS;
+
+            if (untilNextFrameMS > 0.0f)
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds((int64_t)(untilNextFrameMS * 1000.0f)));
+            }
+        }
 
         vr::CameraVideoStreamFrameHeader_t frameHeader{};
 
         while (true)
         {
+            m_serveWakeupCounter.AddEvent();
             m_gpuFrameTimer.StartPerfTimer();
 
             vr::EVRTrackedCameraFrameType frameType = m_projectionMode == Projection_RoomView2D ? vr::VRTrackedCameraFrameType_MaximumUndistorted : vr::VRTrackedCameraFrameType_Distorted;
@@ -600,7 +645,14 @@ void CameraManagerOpenVR::ServeFrames()
 
         if (!m_bRunThread) { return; }
 
-
+        // Only consecutive frames give a valid frame interval.
+        if (!m_bWaitingForCamera && lastFrameExposureTime != 0 && frameHeader.nFrameSequence == lastFrameSequence + 1)
+        {
+            frameIntervalTimer.AveragesAddTimeInterval(lastFrameExposureTime, frameHeader.ulFrameExposureTime);
+            bHasFrameInterval = true;
+        }
+        lastFrameExposureTime = frameHeader.ulFrameExposureTime;
+        lastFrameArrivalTime = GetCurrentTimeSytemTicks();
 
         FramePtr<CameraGPUFrame> gpuFrame = m_gpuFrameQueue.AcquireWrite();
         if (!gpuFrame.HasFrame())
@@ -719,6 +771,7 @@ void CameraManagerOpenVR::ServeFrames()
         }
 
         bool bGotCPUFrame = false;
+        cpuFrame->UploadBuffer.reset();
 
         // Get the CPU frame for depth reconstruction.
         if(m_appRenderAPI == RenderAPI_Direct3D11 || m_appRenderAPI == RenderAPI_Direct3D12)
@@ -775,7 +828,7 @@ void CameraManagerOpenVR::ServeFrames()
 
             if (m_configManager->CheckFrameTextureDumpPending())
             {
-                DumpCameraFrameTexture(cpuFrame->FrameBuffer, m_cameraTextureWidth, m_cameraTextureHeight, "OpenVR");
+                DumpCameraFrameTexture(cpuFrame->GetFrameData(), cpuFrame->GetFrameDataSize(), m_cameraTextureWidth, m_cameraTextureHeight, "OpenVR");
             }
 
             cpuFrame.CommitWrite();
@@ -788,6 +841,15 @@ void CameraManagerOpenVR::ServeFrames()
 
 
 void CameraManagerOpenVR::ServeBlockQueueFrames()
+{
+    ReadBlockQueueFrames();
+
+    // Don't keep any blocks borrowed after the thread exits.
+    m_cpuFrameQueue.RetireFrames();
+}
+
+
+void CameraManagerOpenVR::ReadBlockQueueFrames()
 {
     Config_Main& mainConf = m_configManager->GetConfig_Main();
     Config_Camera& cameraConf = m_configManager->GetConfig_Camera();
@@ -880,14 +942,25 @@ void CameraManagerOpenVR::ServeBlockQueueFrames()
     uint64_t lastFrameSequence = 0;
     vr::PropertyContainerHandle_t readHandle = 0;
     uint8_t* readBuffer = nullptr;
+    bool bBorrowedFramesRetired = false;
 
     while (m_bRunThread)
     {
-        std::this_thread::sleep_for(FRAME_POLL_INTERVAL);
+        // The block queue read below waits for the next frame, so the loop only needs to sleep while idle.
+        if (m_bIsPaused || !m_bUseBlockQueue)
+        {
+            // Return the borrowed blocks once the block queue is turned off.
+            if (!m_bUseBlockQueue && !bBorrowedFramesRetired)
+            {
+                m_cpuFrameQueue.RetireFrames();
+                bBorrowedFramesRetired = true;
+            }
 
-        if (!m_bRunThread) { return; }
+            std::this_thread::sleep_for(POSTFRAME_SLEEP_INTERVAL);
+            continue;
+        }
 
-        if (m_bIsPaused || !m_bUseBlockQueue) { continue; }
+        bBorrowedFramesRetired = false;
 
         bool bUseBlockQueueColor = cameraConf.OpenVR_UseBlockQueueForDepth &&
             cameraConf.OpenVR_UseBlockQueueForColor &&
@@ -909,6 +982,8 @@ void CameraManagerOpenVR::ServeBlockQueueFrames()
                 break;
             }
 
+            m_blockQueueWakeupCounter.AddEvent();
+
             queueError = vrBlockQueue->WaitAndAcquireReadOnlyBlock(rawFrameQueue, &readHandle, (void**)&readBuffer, vr::EBlockQueueReadType_BlockQueueRead_Next, 10);
             if (queueError == vr::EBlockQueueError_BlockQueueError_BlockNotAvailable)
             {
@@ -1046,22 +1121,60 @@ void CameraManagerOpenVR::ServeBlockQueueFrames()
             continue;
         }
 
-        if (cpuFrame->FrameBuffer.get() == nullptr || cpuFrame->FrameBuffer->size() < rawFrameDataBytes)
+        // Return any block the slot is still holding before deciding whether to borrow this one.
+        cpuFrame->BorrowedFrameData.reset();
+
+        std::shared_ptr<AsyncRenderer> asyncRenderer = m_asyncRenderer.lock();
+        if (cameraConf.OpenVR_BorrowBlockQueueFrames && m_numBorrowedBlocks->load() < OPENVR_MAX_BORROWED_BLOCKS)
+        {
+            // The frame references the block directly, and releases it once the frame is no longer readable.
+            cpuFrame->UploadBuffer.reset();
+
+            std::shared_ptr<std::atomic_int> numBorrowedBlocks = m_numBorrowedBlocks;
+            (*numBorrowedBlocks)++;
+
+            cpuFrame->BorrowedFrameData = std::shared_ptr<uint8_t>(readBuffer, [vrBlockQueue, rawFrameQueue, readHandle, numBorrowedBlocks](uint8_t*)
+            {
+                vr::EBlockQueueError releaseError = vrBlockQueue->ReleaseReadOnlyBlock(rawFrameQueue, readHandle);
+                if (releaseError != vr::EBlockQueueError_BlockQueueError_None)
+                {
+                    g_logger->error("ReleaseReadOnlyBlock error {}", static_cast<int32_t>(releaseError));
+                }
+                (*numBorrowedBlocks)--;
+            });
+        }
+        // Capture straight into GPU upload memory when the frames are decoded on the async renderer.
+        else if (bUseBlockQueueColor && asyncRenderer.get() && asyncRenderer->GetCameraUploadBuffer(cpuFrame->UploadBuffer, rawFrameDataBytes))
+        {
+            memcpy(cpuFrame->UploadBuffer->MappedMemory, readBuffer, rawFrameDataBytes);
+        }
+        else
         {
-            cpuFrame->FrameBuffer = std::make_shared<std::vector<uint8_t>>(rawFrameDataBytes);
+            cpuFrame->UploadBuffer.reset();
+
+            if (cpuFrame->FrameBuffer.get() == nullptr || cpuFrame->FrameBuffer->size() < rawFrameDataBytes)
+            {
+                cpuFrame->FrameBuffer = std::make_shared<std::vector<uint8_t>>(rawFrameDataBytes);
+            }
+
+            memcpy(cpuFrame->FrameBuffer->data(), readBuffer, rawFrameDataBytes);
         }
+        asyncRenderer.reset();
 
-        memcpy(cpuFrame->FrameBuffer->data(), readBuffer, rawFrameDataBytes);
+        cpuFrame->RawFrameDataBytes = rawFrameDataBytes;
 
-        queueError = vrBlockQueue->ReleaseReadOnlyBlock(rawFrameQueue, readHandle);
-        if (queueError != vr::EBlockQueueError_BlockQueueError_None)
+        if (!cpuFrame->BorrowedFrameData.get())
         {
-            g_logger->error("ReleaseReadOnlyBlock error {}", static_cast<int32_t>(queueError));
+            queueError = vrBlockQueue->ReleaseReadOnlyBlock(rawFrameQueue, readHandle);
+            if (queueError != vr::EBlockQueueError_BlockQueueError_None)
+            {
+                g_logger->error("ReleaseReadOnlyBlock error {}", static_cast<int32_t>(queueError));
+            }
         }
 
         if (m_configManager->CheckFrameTextureDumpPending())
         {
-            DumpCameraFrameTexture(cpuFrame->FrameBuffer, rawFrameWidth, rawFrameHeight, "OpenVR-BlockQueue");
+            DumpCameraFrameTexture(cpuFrame->GetFrameData(), cpuFrame->GetFrameDataSize(), rawFrameWidth, rawFrameHeight, "OpenVR-BlockQueue");
         }
 
         bWaitingForCamera = false;
@@ -1074,7 +1187,6 @@ void CameraManagerOpenVR::ServeBlockQueueFrames()
         cpuFrame->RawFrameFormat = frameFormat;
         cpuFrame->FrameSize = { m_cameraTextureWidth, m_cameraTextureHeight };
         cpuFrame->RawFrameSize = { (uint32_t)rawFrameWidth, (uint32_t)rawFrameHeight };
-        cpuFrame->RawFrameDataBytes = rawFrameDataBytes;
         cpuFrame->FrameExposureTimestamp = frameExposureTimestamp;
         cpuFrame->FrameSequence = (uint32_t)frameSequence;
 
@@ -1140,14 +1252,15 @@ void CameraManagerOpenVR::CopyCPUFrameToGPU(std::shared_ptr<CameraCPUFrame> inFr
 
 bool CameraManagerOpenVR::GetHMDPoseForTime(XrMatrix4x4f& headToTrackingPose, const uint64_t time)
 {
-    vr::TrackedDevicePose_t hmdPose;
-
-    double exposureTimeInPastSeconds = GetPerfTimeDiffSeconds(GetCurrentTimeSytemTicks(), time);
+    vr::HmdMatrix34_t hmdPose;
 
-    m_openVRManager->GetVRSystem()->GetDeviceToAbsoluteTrackingPose(vr::TrackingUniverseStanding, (float)exposureTimeInPastSeconds, &hmdPose, 1);
+    if (!m_openVRManager->GetPoseHistory()->GetDevicePoseForTime(vr::k_unTrackedDeviceIndex_Hmd, time, hmdPose))
+    {
+        return false;
+    }
 
-    headToTrackingPose = ToXRMatrix4x4(hmdPose.mDeviceToAbsoluteTracking);
-    return hmdPose.bPoseIsValid;
+    headToTrackingPose = ToXRMatrix4x4(hmdPose);
+    return true;
 }
 
 void CameraManagerOpenVR::UpdateRoomViewProjectionMatrix()
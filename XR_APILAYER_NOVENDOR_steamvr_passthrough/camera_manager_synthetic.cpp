@@ -0,0 +1,278 @@
+#include "pch.h"
+
+#include "camera_manager.h"
+#include "layer_structs.h"
+#include "mathutil.h"
+#include "perfutil.h"
+
+
+CameraManagerSynthetic::CameraManagerSynthetic(std::shared_ptr<IAsyncRenderer> asyncRenderer, std::shared_ptr<ConfigManager> configManager)
+    : m_configManager(configManager)
+    , m_asyncRenderer(asyncRenderer)
+    , m_gpuFrameQueue(CAMERA_GPU_FRAME_QUEUE_SIZE, CAMERA_FRAME_HISTORY_DEPTH)
+    , m_cpuFrameQueue(4)
+    , m_frameUploader(asyncRenderer, configManager, m_cpuFrameQueue, m_gpuFrameQueue)
+{
+}
+
+CameraManagerSynthetic::~CameraManagerSynthetic()
+{
+    DeinitCamera();
+
+    m_bRunThread = false;
+
+    if (m_serveThread.joinable())
+    {
+        m_serveThread.join();
+    }
+
+    m_frameUploader.Stop();
+}
+
+bool CameraManagerSynthetic::InitCamera()
+{
+    if (m_bCameraInitialized) { return true; }
+
+    if (!m_frameSource.Init(m_configManager->GetConfig_Camera()))
+    {
+        return false;
+    }
+
+    g_logger->info("Synthetic camera initalized: {} x {} @ {:.1f}, format {}", m_frameSource.GetTextureWidth(), m_frameSource.GetTextureHeight(), m_frameSource.GetFrameRate(), (int32_t)m_frameSource.GetFrameFormat());
+
+    m_startTime = GetCurrentTimeSytemTicks();
+    m_bCameraInitialized = true;
+    m_bRunThread = true;
+    m_bIsPaused = false;
+
+    if (!m_serveThread.joinable())
+    {
+        m_serveThread = std::thread(&CameraManagerSynthetic::ServeFrames, this);
+    }
+
+    m_frameUploader.Start();
+
+    return true;
+}
+
+void CameraManagerSynthetic::DeinitCamera()
+{
+    if (!m_bCameraInitialized) { return; }
+    m_bCameraInitialized = false;
+    m_bRunThread = false;
+
+    if (m_serveThread.joinable())
+    {
+        m_serveThread.join();
+    }
+
+    m_frameUploader.Stop();
+    m_frameSource.Deinit();
+}
+
+EPassthroughCameraState CameraManagerSynthetic::GetCameraState() const
+{
+    if (!m_bCameraInitialized)
+    {
+        return CameraState_Uninitialized;
+    }
+    else if (m_bIsPaused)
+    {
+        return CameraState_Idle;
+    }
+    else
+    {
+        return CameraState_Active;
+    }
+}
+
+void CameraManagerSynthetic::GetCameraDisplayStats(uint32_t& width, uint32_t& height, float& fps, ECameraProvider& provider, bool& bIsActive) const
+{
+    width = m_bCameraInitialized ? m_frameSource.GetTextureWidth() : 0;
+    height = m_bCameraInitialized ? m_frameSource.GetTextureHeight() : 0;
+    fps = m_bCameraInitialized ? m_frameSource.GetFrameRate() : 0.0f;
+    provider = CameraProvider_Synthetic;
+    bIsActive = m_bCameraInitialized;
+}
+
+void CameraManagerSynthetic::GetDistortedTextureSize(uint32_t& width, uint32_t& height) const
+{
+    width = m_frameSource.GetTextureWidth();
+    height = m_frameSource.GetTextureHeight();
+}
+
+void CameraManagerSynthetic::GetDistortedFrameSize(uint32_t& width, uint32_t& height) const
+{
+    width = m_frameSource.GetFrameWidth();
+    height = m_frameSource.GetFrameHeight();
+}
+
+void CameraManagerSynthetic::GetIntrinsics(const ERenderEye cameraEye, XrVector2f& focalLength, XrVector2f& center) const
+{
+    // Both eyes use the same pinhole camera.
+    focalLength = m_frameSource.GetFocalLength();
+    center = m_frameSource.GetCenter();
+}
+
+void CameraManagerSynthetic::GetDistortionCoefficients(ECameraDistortionCoefficients& coeffs) const
+{
+    memset(coeffs.v, 0, sizeof(coeffs.v));
+
+    const float* distortion = m_frameSource.GetDistortion();
+
+    for (int i = 0; i < 4; i++)
+    {
+        coeffs.v[i] = distortion[i];
+        coeffs.v[8 + i] = distortion[i];
+    }
+}
+
+EStereoFrameLayout CameraManagerSynthetic::GetFrameLayout() const
+{
+    return m_frameSource.GetFrameLayout();
+}
+
+bool CameraManagerSynthetic::IsUsingFisheyeModel() const
+{
+    return false;
+}
+
+XrMatrix4x4f CameraManagerSynthetic::GetLeftToRightCameraTransform() const
+{
+    XrMatrix4x4f result;
+
+    if (m_frameSource.GetFrameLayout() == EStereoFrameLayout::FrameLayout_Mono)
+    {
+        XrMatrix4x4f_CreateIdentity(&result);
+    }
+    else
+    {
+        XrMatrix4x4f_CreateTranslation(&result, -m_frameSource.GetBaseline(), 0.0f, 0.0f);
+    }
+
+    return result;
+}
+
+void CameraManagerSynthetic::UpdateStaticCameraParameters()
+{
+    m_frameSource.UpdateParameters(m_configManager->GetConfig_Camera());
+}
+
+FramePtr<CameraGPUFrame> CameraManagerSynthetic::AcquireCameraGPUFrame()
+{
+    if (!m_bCameraInitialized) { return FramePtr<CameraGPUFrame>(); }
+
+    return m_gpuFrameQueue.AcquireRead();
+}
+
+FramePtr<CameraGPUFrame> CameraManagerSynthetic::AcquireCameraGPUFrameForTime(const uint64_t exposureTime)
+{
+    if (!m_bCameraInitialized) { return FramePtr<CameraGPUFrame>(); }
+
+    return m_gpuFrameQueue.AcquireReadForTime(exposureTime);
+}
+
+void CameraManagerSynthetic::ReleaseCameraGPUFrame(std::shared_ptr<CameraGPUFrame> frame)
+{
+    m_gpuFrameQueue.ReleaseRead(frame);
+}
+
+FramePtr<CameraCPUFrame> CameraManagerSynthetic::AcquireCameraCPUFrame()
+{
+    if (!m_bCameraInitialized) { return FramePtr<CameraCPUFrame>(); }
+
+    return m_cpuFrameQueue.AcquireRead();
+}
+
+FramePtr<CameraCPUFrame> CameraManagerSynthetic::WaitForCameraCPUFrame(uint64_t& lastSequence, const std::chrono::microseconds timeout)
+{
+    if (!m_bCameraInitialized)
+    {
+        std::this_thread::sleep_for(timeout);
+        return FramePtr<CameraCPUFrame>();
+    }
+
+    return m_cpuFrameQueue.WaitForRead(lastSequence, timeout);
+}
+
+void CameraManagerSynthetic::ServeFrames()
+{
+    uint32_t frameSequence = 0;
+    auto nextFrameTime = std::chrono::steady_clock::now();
+
+    while (m_bRunThread)
+    {
+        m_serveWakeupCounter.AddEvent();
+
+        if (m_bIsPaused)
+        {
+            std::this_thread::sleep_for(POSTFRAME_SLEEP_INTERVAL);
+            nextFrameTime = std::chrono::steady_clock::now();
+            continue;
+        }
+
+        nextFrameTime += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / m_frameSource.GetFrameRate()));
+
+        auto now = std::chrono::steady_clock::now();
+        if (nextFrameTime < now)
+        {
+            // Running behind, don't try to catch up.
+            nextFrameTime = now;
+        }
+        else
+        {
+            std::this_thread::sleep_until(nextFrameTime);
+        }
+
+        if (!m_bRunThread) { return; }
+
+        FramePtr<CameraCPUFrame> cpuFrame = m_cpuFrameQueue.AcquireWrite();
+        if (!cpuFrame.HasFrame())
+        {
+            g_logger->warn("Camera CPU frame underrun!");
+            continue;
+        }
+
+        m_cpuFrameTimer.StartPerfTimer();
+
+        uint64_t currentTime = GetCurrentTimeSytemTicks();
+
+        if (!m_frameSource.RenderFrame(GetPerfTimeDiffSeconds(m_startTime, currentTime), *cpuFrame))
+        {
+            continue;
+        }
+
+        uint32_t frameDataBytes = cpuFrame->RawFrameDataBytes;
+
+        std::shared_ptr<IAsyncRenderer> asyncRenderer = m_asyncRenderer.lock();
+        if (!asyncRenderer.get() || !asyncRenderer->GetCameraUploadBuffer(cpuFrame->UploadBuffer, frameDataBytes))
+        {
+            cpuFrame->UploadBuffer.reset();
+
+            if (cpuFrame->FrameBuffer.get() == nullptr || cpuFrame->FrameBuffer->size() < frameDataBytes)
+            {
+                cpuFrame->FrameBuffer = std::make_shared<std::vector<uint8_t>>(frameDataBytes);
+            }
+        }
+
+        m_frameSource.EncodeFrame(cpuFrame->GetFrameData());
+
+        if (m_configManager->CheckFrameTextureDumpPending())
+        {
+            const cv::Mat& renderedFrame = m_frameSource.GetRenderedFrame();
+            DumpCameraFrameTexture(renderedFrame.data, (uint32_t)(renderedFrame.total() * renderedFrame.elemSize()), renderedFrame.cols, renderedFrame.rows, "Synthetic");
+        }
+
+        cpuFrame->FrameExposureTimestamp = currentTime;
+
+        cpuFrame->FrameSequence = frameSequence;
+        frameSequence = (frameSequence + 1) % 16;
+
+        m_cpuFrameTimer.EndPerfTimer();
+
+        cpuFrame->FrameReadyTime = GetCurrentTimeSytemTicks();
+        m_captureStageTimer.AveragesAddTimeInterval(currentTime, cpuFrame->FrameReadyTime);
+
+        cpuFrame.CommitWrite();
+    }
+}
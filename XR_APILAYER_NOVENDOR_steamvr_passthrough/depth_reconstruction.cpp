@@ -4,12 +4,29 @@
 
 #include "mathutil.h"
 #include "perfutil.h"
+#include "frame_conversion.h"
 
+#include <cfloat>
 #include <opencv2/imgcodecs.hpp>
 
 
-DepthReconstruction::DepthReconstruction(std::shared_ptr<ConfigManager> configManager, std::shared_ptr<OpenVRManager> openVRManager, std::shared_ptr<ICameraManager> cameraManager, std::shared_ptr<AsyncRenderer> asyncRenderer)
+static const StereoGovernorLevel g_stereoGovernorLevels[STEREO_GOVERNOR_NUM_LEVELS] =
+{
+    { 0, false, 0, 0 },
+    { 16, false, 0, 0 },
+    { 32, false, 0, 0 },
+    { 32, true, 0, 0 },
+    { 32, true, 1, 0 },
+    { 32, true, 2, 0 },
+    { 32, true, 2, 1 },
+    { 32, true, 2, 2 },
+};
+
+
+DepthReconstruction::DepthReconstruction(std::shared_ptr<ConfigManager> configManager, std::shared_ptr<OpenVRManager> openVRManager, std::shared_ptr<ICameraManager> cameraManager, std::shared_ptr<IAsyncRenderer> asyncRenderer)
     : m_depthFrameQueue(4)
+    , m_inputQueue(STEREO_PIPELINE_QUEUE_SIZE)
+    , m_disparityQueue(STEREO_PIPELINE_QUEUE_SIZE)
     , m_asyncRenderer(asyncRenderer)
     , m_configManager(configManager)
     , m_openVRManager(openVRManager)
@@ -31,15 +48,36 @@ DepthReconstruction::DepthReconstruction(std::shared_ptr<ConfigManager> configMa
     InitReconstruction();
 
     m_bRunThread = true;
-    m_thread = std::thread(&DepthReconstruction::RunThread, this);
+    m_bRunEyeWorker = true;
+    m_eyeWorkerThread = std::thread(&DepthReconstruction::RunEyeWorkerThread, this);
+    m_inputThread = std::thread(&DepthReconstruction::RunInputThread, this);
+    m_matchingThread = std::thread(&DepthReconstruction::RunMatchingThread, this);
+    m_outputThread = std::thread(&DepthReconstruction::RunOutputThread, this);
 }
 
 DepthReconstruction::~DepthReconstruction()
 {
-    if (m_thread.joinable())
+    m_bRunThread = false;
+
+    if (m_inputThread.joinable())
+    {
+        m_inputThread.join();
+    }
+    if (m_matchingThread.joinable())
+    {
+        m_matchingThread.join();
+    }
+    if (m_outputThread.joinable())
+    {
+        m_outputThread.join();
+    }
+
+    // Only stop the eye worker after the matching thread can no longer dispatch to it.
+    m_bRunEyeWorker = false;
+
+    if (m_eyeWorkerThread.joinable())
     {
-        m_bRunThread = false;
-        m_thread.join();
+        m_eyeWorkerThread.join();
     }
 }
 
@@ -174,6 +212,9 @@ void DepthReconstruction::InitReconstruction()
         cv::initUndistortRectifyMap(m_intrinsicsRight, m_distortionParamsRight, R2, P2, textureSize, CV_32FC1, m_rightMap1, m_rightMap2);
     }
 
+    CreateScaledRectifyMaps(m_intrinsicsLeft, m_distortionParamsLeft, R1, P1, m_scaledLeftMap1, m_scaledLeftMap2, m_prefilterLeftMap1, m_prefilterLeftMap2);
+    CreateScaledRectifyMaps(m_intrinsicsRight, m_distortionParamsRight, R2, P2, m_scaledRightMap1, m_scaledRightMap2, m_prefilterRightMap1, m_prefilterRightMap2);
+
     m_fishEyeProjectionLeft = CVMatToXrMatrix(P1);
     m_fishEyeProjectionRight = CVMatToXrMatrix(P2);
 
@@ -182,29 +223,71 @@ void DepthReconstruction::InitReconstruction()
 
     XrMatrix4x4f XR_Q = CVMatToXrMatrix(Q);
     XrMatrix4x4f_Transpose(&m_disparityToDepth, &XR_Q);
+
+    // Disparity at the matcher resolution is this scale divided by the depth along the rectified view axis.
+    double baseline = (m_frameLayout != FrameLayout_Mono && Q.at<double>(3, 2) != 0.0) ? 1.0 / Q.at<double>(3, 2) : 0.0;
+    m_disparityDepthScale = (float)(P1.at<double>(0, 0) * m_cvImageWidth / m_cameraFrameWidth * baseline);
+
+    // Rectified intrinsics at the matcher resolution, scaled the same way as in CreateScaledRectifyMaps.
+    m_rectifiedFocalLength.x = (float)(P1.at<double>(0, 0) * m_cvImageWidth / m_cameraFrameWidth);
+    m_rectifiedFocalLength.y = (float)(P1.at<double>(1, 1) * m_cvImageHeight / m_cameraFrameHeight);
+    m_rectifiedCenter.x = (float)((P1.at<double>(0, 2) + 0.5) * m_cvImageWidth / m_cameraFrameWidth - 0.5);
+    m_rectifiedCenter.y = (float)((P1.at<double>(1, 2) + 0.5) * m_cvImageHeight / m_cameraFrameHeight - 0.5);
+
+    if (!R1.empty())
+    {
+        m_rectifiedDepthAxis[0] = (float)R1.at<double>(2, 0);
+        m_rectifiedDepthAxis[1] = (float)R1.at<double>(2, 1);
+        m_rectifiedDepthAxis[2] = (float)R1.at<double>(2, 2);
+    }
     
     CreateDistortionMap();
 
     int frameFormat = m_bUseColor ? CV_8UC3 : CV_8U;
 
-    int disparityWidth = m_bDisparityBothEyes ? m_cvImageWidth + m_maxDisparity * 2 : m_cvImageWidth + m_maxDisparity;
-
     m_inputFrameLeft = cv::Mat(m_cameraFrameHeight, m_cameraFrameWidth, frameFormat);
     m_inputFrameRight = cv::Mat(m_cameraFrameHeight, m_cameraFrameWidth, frameFormat);
-    m_rectifiedFrameLeft = cv::Mat(m_cvImageHeight, m_cvImageWidth, frameFormat);
-    m_rectifiedFrameRight = cv::Mat(m_cvImageHeight, m_cvImageWidth, frameFormat);
-    m_scaledFrameLeft = cv::Mat(m_cvImageHeight, m_cvImageWidth, frameFormat);
-    m_scaledFrameRight = cv::Mat(m_cvImageHeight, m_cvImageWidth, frameFormat);
-    m_scaledExtFrameLeft = cv::Mat(m_cvImageHeight, disparityWidth, frameFormat);
-    m_scaledExtFrameRight = cv::Mat(m_cvImageHeight, disparityWidth, frameFormat);
-    
+    m_prefilteredFrameLeft = cv::Mat(m_cvImageHeight, m_cvImageWidth, frameFormat);
+    m_prefilteredFrameRight = cv::Mat(m_cvImageHeight, m_cvImageWidth, frameFormat);
+
+    // The pipeline queue entries and disparity buffers are sized per frame by the stages that own them.
+}
+
+
+// Creates fixed point rectification maps that output directly at the stereo matcher resolution.
+// The prefilter maps sample from a source frame that has been area downscaled to the same resolution.
+void DepthReconstruction::CreateScaledRectifyMaps(const cv::Mat& intrinsics, const cv::Mat& distortion, const cv::Mat& R, const cv::Mat& P, cv::Mat& outMap1, cv::Mat& outMap2, cv::Mat& outPrefilterMap1, cv::Mat& outPrefilterMap2)
+{
+    cv::Size scaledSize(m_cvImageWidth, m_cvImageHeight);
+
+    // Scale the rectified projection to the output resolution, keeping pixel centers aligned the same way as cv::resize.
+    cv::Mat scaledP = P.clone();
+    scaledP.at<double>(0, 0) *= (double)m_cvImageWidth / m_cameraFrameWidth;
+    scaledP.at<double>(1, 1) *= (double)m_cvImageHeight / m_cameraFrameHeight;
+    scaledP.at<double>(0, 2) = (P.at<double>(0, 2) + 0.5) * m_cvImageWidth / m_cameraFrameWidth - 0.5;
+    scaledP.at<double>(1, 2) = (P.at<double>(1, 2) + 0.5) * m_cvImageHeight / m_cameraFrameHeight - 0.5;
+
+    cv::Mat mapX, mapY;
+
+    if (m_cameraManager->IsUsingFisheyeModel())
+    {
+        cv::fisheye::initUndistortRectifyMap(intrinsics, distortion, R, scaledP, scaledSize, CV_32FC1, mapX, mapY);
+    }
+    else
+    {
+        cv::initUndistortRectifyMap(intrinsics, distortion, R, scaledP, scaledSize, CV_32FC1, mapX, mapY);
+    }
 
-    m_rawDisparityLeft = cv::Mat(m_cvImageHeight, disparityWidth, CV_16S);
-    m_rawDisparityRight = cv::Mat(m_cvImageHeight, disparityWidth, CV_16S);
-    m_filteredDisparityLeft = cv::Mat(m_cvImageHeight, disparityWidth, CV_16S);
-    m_bilateralDisparityLeft = cv::Mat(m_cvImageHeight, disparityWidth, CV_16S);
-    m_filteredDisparityRight = cv::Mat(m_cvImageHeight, disparityWidth, CV_16S);
-    m_bilateralDisparityRight = cv::Mat(m_cvImageHeight, disparityWidth, CV_16S);
+    cv::convertMaps(mapX, mapY, outMap1, outMap2, CV_16SC2);
+
+    // Source coordinates in the area downscaled input frame.
+    double prefilterScaleX = (double)m_cvImageWidth / m_cameraFrameWidth;
+    double prefilterScaleY = (double)m_cvImageHeight / m_cameraFrameHeight;
+
+    mapX.convertTo(mapX, CV_32F, prefilterScaleX, 0.5 * prefilterScaleX - 0.5);
+    mapY.convertTo(mapY, CV_32F, prefilterScaleY, 0.5 * prefilterScaleY - 0.5);
+
+    cv::convertMaps(mapX, mapY, outPrefilterMap1, outPrefilterMap2, CV_16SC2);
 }
 
 
@@ -316,22 +399,145 @@ void DepthReconstruction::CreateDistortionMap()
 }
 
 
+void DepthReconstruction::UpdateStereoMatchers(const StereoFrameParams& frameParams)
+{
+    const Config_Stereo& stereoConfig = frameParams.StereoConfig;
+
+    StereoMatcherParams params;
+    params.ImageWidth = frameParams.ImageWidth;
+    params.ImageHeight = frameParams.ImageHeight;
+    params.MinDisparity = stereoConfig.StereoMinDisparity;
+    params.MaxDisparity = frameParams.MaxDisparity;
+    params.BlockSize = stereoConfig.StereoBlockSize;
+    params.Mode = stereoConfig.StereoSGBM_Mode;
+    params.P1 = stereoConfig.StereoSGBM_P1;
+    params.P2 = stereoConfig.StereoSGBM_P2;
+    params.DispMaxDiff = stereoConfig.StereoSGBM_DispMaxDiff;
+    params.PreFilterCap = stereoConfig.StereoSGBM_PreFilterCap;
+    params.UniquenessRatio = stereoConfig.StereoSGBM_UniquenessRatio;
+    params.SpeckleWindowSize = stereoConfig.StereoSGBM_SpeckleWindowSize;
+    params.SpeckleRange = stereoConfig.StereoSGBM_SpeckleRange;
+    params.bDisparityBothEyes = frameParams.bDisparityBothEyes;
+    params.bWLSEnable = stereoConfig.StereoFilteringWLS_Enable;
+    params.WLSLambda = stereoConfig.StereoFilteringWLS_Lambda;
+    params.WLSSigma = stereoConfig.StereoFilteringWLS_Sigma;
+    params.WLSConfidenceRadius = stereoConfig.StereoFilteringWLS_ConfidenceRadius;
+
+    if (m_bMatchersValid && params == m_matcherParams)
+    {
+        return;
+    }
+
+    m_matcherParams = params;
+    m_bMatchersValid = true;
+    m_matcherRebuildCount++;
+
+    int numDisparities = params.MaxDisparity - params.MinDisparity;
+    int filterMultiplier = params.BlockSize * params.BlockSize;
+    int speckleRange = params.SpeckleWindowSize > 0 ? params.SpeckleRange : 0;
+
+    m_stereoLeftMatcher = cv::StereoSGBM::create(params.MinDisparity, numDisparities, params.BlockSize,
+        params.P1 * filterMultiplier, params.P2 * filterMultiplier, params.DispMaxDiff,
+        params.PreFilterCap, params.UniquenessRatio,
+        params.SpeckleWindowSize, speckleRange,
+        (int)params.Mode);
+
+    if (params.bDisparityBothEyes)
+    {
+        m_stereoRightMatcher = cv::StereoSGBM::create(-params.MaxDisparity, numDisparities, params.BlockSize,
+            params.P1 * filterMultiplier, params.P2 * filterMultiplier, params.DispMaxDiff,
+            params.PreFilterCap, params.UniquenessRatio,
+            params.SpeckleWindowSize, speckleRange,
+            (int)params.Mode);
+    }
+    else if (params.bWLSEnable)
+    {
+        m_stereoRightMatcher = cv::ximgproc::createRightMatcher(m_stereoLeftMatcher);
+    }
+    else
+    {
+        m_stereoRightMatcher.release();
+    }
+
+    // The coarse-to-fine search runs separate matchers with the same settings, since the range is changed for every band.
+    auto createBandMatcher = [](const cv::Ptr<cv::StereoMatcher>& matcher)
+    {
+        cv::Ptr<cv::StereoSGBM> sgbm = matcher.dynamicCast<cv::StereoSGBM>();
+
+        return cv::StereoSGBM::create(sgbm->getMinDisparity(), sgbm->getNumDisparities(), sgbm->getBlockSize(),
+            sgbm->getP1(), sgbm->getP2(), sgbm->getDisp12MaxDiff(),
+            sgbm->getPreFilterCap(), sgbm->getUniquenessRatio(),
+            sgbm->getSpeckleWindowSize(), sgbm->getSpeckleRange(),
+            sgbm->getMode());
+    };
+
+    m_bandMatcherLeft = createBandMatcher(m_stereoLeftMatcher);
+    m_bandMatcherRight = m_stereoRightMatcher ? createBandMatcher(m_stereoRightMatcher) : nullptr;
+
+    // The coarse level is half the resolution, so the block size and disparity range are halved as well.
+    int coarseBlockSize = max(params.BlockSize / 2, 1) | 1;
+    int coarseFilterMultiplier = coarseBlockSize * coarseBlockSize;
+    int coarseNumDisparities = max(((numDisparities / 2 + 15) / 16) * 16, 16);
+
+    m_coarseMatcher = cv::StereoSGBM::create(params.MinDisparity / 2, coarseNumDisparities, coarseBlockSize,
+        params.P1 * coarseFilterMultiplier, params.P2 * coarseFilterMultiplier, params.DispMaxDiff,
+        params.PreFilterCap, params.UniquenessRatio,
+        params.SpeckleWindowSize / 4, speckleRange,
+        (int)params.Mode);
+
+    m_wlsFilterLeft.release();
+    m_wlsFilterRight.release();
 
+    if (params.bWLSEnable)
+    {
+        int discontinuityRadius = (int)ceil(params.WLSConfidenceRadius * params.BlockSize);
+
+        m_wlsFilterLeft = cv::ximgproc::createDisparityWLSFilter(m_stereoLeftMatcher);
+        m_wlsFilterLeft->setLambda(params.WLSLambda);
+        m_wlsFilterLeft->setSigmaColor(params.WLSSigma);
+        m_wlsFilterLeft->setDepthDiscontinuityRadius(discontinuityRadius);
+
+        if (params.bDisparityBothEyes)
+        {
+            m_wlsFilterRight = cv::ximgproc::createDisparityWLSFilter(m_stereoRightMatcher);
+            m_wlsFilterRight->setLambda(params.WLSLambda);
+            m_wlsFilterRight->setSigmaColor(params.WLSSigma);
+            m_wlsFilterRight->setDepthDiscontinuityRadius(discontinuityRadius);
+        }
+    }
+}
 
 
-void DepthReconstruction::RunThread()
+// Input stage: Converts camera frames to the matcher input format, rectifies and scales them.
+void DepthReconstruction::RunInputThread()
 {
+    uint64_t lastCameraQueueSequence = 0;
+
     while (m_bRunThread)
     {
-        std::this_thread::sleep_for(std::chrono::microseconds(100));
-
-        m_reconstructionTimer.StartPerfTimer();
+        m_inputWakeupCounter.AddEvent();
 
         // Make local copies for consistency
         Config_Main mainConfig = m_configManager->GetConfig_Main();
         Config_Stereo stereoConfig = m_configManager->GetConfig_Stereo();
         Config_Camera cameraConfig = m_configManager->GetConfig_Camera();
 
+        if (m_configManager->CheckStereoBenchmarkPending() && m_benchmarkPreset < 0)
+        {
+            g_logger->info("Starting stereo preset benchmark, {} frames per preset", STEREO_BENCHMARK_MEASURED_FRAMES);
+            m_benchmarkPreset = StereoPreset_VeryLow;
+            m_benchmarkFrameCount = 0;
+        }
+
+        // The presets are swept without touching the user selection.
+        if (m_benchmarkPreset >= 0)
+        {
+            stereoConfig = m_configManager->GetConfig_StereoPreset((EStereoPreset)m_benchmarkPreset);
+        }
+
+        // The governor is paused while benchmarking, so that the presets are measured as they are.
+        int governorLevel = (mainConfig.StereoGovernor_Enable && m_benchmarkPreset < 0) ? m_governorLevel.load() : 0;
+        ApplyGovernorLevel(stereoConfig, governorLevel);
 
         if (m_maxDisparity != stereoConfig.StereoMaxDisparity ||
             m_downscaleFactor != stereoConfig.StereoDownscaleFactor ||
@@ -354,16 +560,36 @@ void DepthReconstruction::RunThread()
             cv::setNumThreads(m_bUseMulticore ? -1 : 0);
         }
 
-        FramePtr<CameraCPUFrame> frame = m_cameraManager->AcquireCameraCPUFrame();
-        XrMatrix4x4f viewToWorldLeft, viewToWorldRight;
-        uint64_t frameTimestamp;
+        if (mainConfig.ProjectionMode != Projection_StereoReconstruction || mainConfig.DebugStereoReconstructionFreeze)
+        {
+            std::this_thread::sleep_for(POSTFRAME_SLEEP_INTERVAL);
+            continue;
+        }
 
-        if (mainConfig.ProjectionMode != Projection_StereoReconstruction || mainConfig.DebugStereoReconstructionFreeze || !frame.HasFrame())
+        // Wait for the matching stage to have room before picking the camera frame, so that the newest one gets used.
+        StereoInputFrame* inputFrame = m_inputQueue.BeginWrite(STEREO_PIPELINE_WAIT_TIMEOUT);
+        if (!inputFrame)
         {
             continue;
-        }     
+        }
+
+        XrMatrix4x4f viewToWorldLeft, viewToWorldRight;
+        uint64_t frameTimestamp;
+        uint64_t inputStartTime = 0;
+        bool bHasGroundTruth = false;
 
+        // Set if the eye input frames were already reduced to approximately the matcher resolution.
+        bool bInputPrescaled = false;
+
+        // The camera frame is only held until it has been converted.
         {
+            FramePtr<CameraCPUFrame> frame = m_cameraManager->WaitForCameraCPUFrame(lastCameraQueueSequence, STEREO_PIPELINE_WAIT_TIMEOUT);
+
+            if (!frame.HasFrame())
+            {
+                continue;
+            }
+
             cv::Rect frameROILeft, frameROIRight;
 
             if (m_frameLayout == FrameLayout_StereoHorizontal)
@@ -388,6 +614,9 @@ void DepthReconstruction::RunThread()
                     break;
 
                 case FrameFormat_RAW10:
+                    frameMinMemSize = frame->RawFrameSize.width * frame->RawFrameSize.height * 10 / 8;
+                    break;
+
                 case FrameFormat_YUYV16:
                 case FrameFormat_BAYER16BG:
                     frameMinMemSize = frame->RawFrameSize.width * frame->RawFrameSize.height * 2;
@@ -410,13 +639,24 @@ void DepthReconstruction::RunThread()
 
             if (!frame->bIsValid ||
                 frame->FrameLayout == FrameLayout_Mono ||
-                frame->FrameBuffer->size() < frameMinMemSize ||
+                frame->GetFrameDataSize() < frameMinMemSize ||
                 frame->FrameSequence == m_lastFrameSequence ||
                 frame->FrameSequence % (stereoConfig.StereoFrameSkip + 1) != 0)
             {
                 continue;
             }
 
+            // Rectify the ground truth the same way as the left eye image. Done before the stage timer, since it's not part of the regular pipeline.
+            bHasGroundTruth = frame->GroundTruthPoints.get() && frame->GroundTruthPoints->size() == (size_t)m_cameraFrameWidth * m_cameraFrameHeight * 3;
+
+            if (bHasGroundTruth)
+            {
+                cv::Mat points(m_cameraFrameHeight, m_cameraFrameWidth, CV_32FC3, frame->GroundTruthPoints->data());
+                cv::remap(points, m_groundTruthPoints, m_scaledLeftMap1, m_scaledLeftMap2, cv::INTER_NEAREST, cv::BORDER_CONSTANT);
+            }
+
+            inputStartTime = m_inputStageTimer.StartPerfTimer();
+
             m_lastFrameSequence = frame->FrameSequence;
 
             viewToWorldLeft = frame->CameraViewToWorldLeft;
@@ -429,7 +669,7 @@ void DepthReconstruction::RunThread()
                 {
                 case FrameFormat_RGBX32:
                 {
-                    m_inputFrame = cv::Mat(frame->RawFrameSize.height, frame->RawFrameSize.width, CV_8UC4, frame->FrameBuffer->data());
+                    m_inputFrame = cv::Mat(frame->RawFrameSize.height, frame->RawFrameSize.width, CV_8UC4, frame->GetFrameData());
 
                     if (m_bUseColor)
                     {
@@ -445,7 +685,7 @@ void DepthReconstruction::RunThread()
                 }
                 case FrameFormat_RGB24:
                 {
-                    m_inputFrame = cv::Mat(frame->RawFrameSize.height, frame->RawFrameSize.width, CV_8UC3, frame->FrameBuffer->data());
+                    m_inputFrame = cv::Mat(frame->RawFrameSize.height, frame->RawFrameSize.width, CV_8UC3, frame->GetFrameData());
 
                     if (m_bUseColor)
                     {
@@ -461,7 +701,7 @@ void DepthReconstruction::RunThread()
                 }
                 case FrameFormat_YUYV16:
                 {
-                    m_inputFrame = cv::Mat(frame->RawFrameSize.height, frame->RawFrameSize.width, CV_8UC2, frame->FrameBuffer->data());
+                    m_inputFrame = cv::Mat(frame->RawFrameSize.height, frame->RawFrameSize.width, CV_8UC2, frame->GetFrameData());
 
                     if (m_bUseColor)
                     {
@@ -473,61 +713,95 @@ void DepthReconstruction::RunThread()
                     else
                     {
                         // Convert to full range if the rectification is filtered for higher resolution in gradients.
-                        if (stereoConfig.StereoRectificationFiltering)
-                        {
-                            m_inputFrameRawIntermediate = cv::Mat(m_cameraTextureHeight, m_cameraTextureWidth, CV_8U);
-                            cv::cvtColor(m_inputFrame, m_inputFrameRawIntermediate, cv::COLOR_YUV2GRAY_YUY2);
-
-                            m_inputFrameRawIntermediate(frameROILeft).convertTo(m_inputFrameLeft, CV_8U, 256.0 / 219.0, -(16.0 / 219.0));
-                            m_inputFrameRawIntermediate(frameROIRight).convertTo(m_inputFrameRight, CV_8U, 256.0 / 219.0, -(16.0 / 219.0));
-                        }
-                        else
-                        {
-                            cv::cvtColor(m_inputFrame(frameROILeft), m_inputFrameLeft, cv::COLOR_YUV2GRAY_YUY2);
-                            cv::cvtColor(m_inputFrame(frameROIRight), m_inputFrameRight, cv::COLOR_YUV2GRAY_YUY2);
-                        }
+                        ConvertYUYVToGray(m_inputFrame(frameROILeft), m_inputFrameLeft, stereoConfig.StereoRectificationFiltering);
+                        ConvertYUYVToGray(m_inputFrame(frameROIRight), m_inputFrameRight, stereoConfig.StereoRectificationFiltering);
                     }
                     break;
                 }
                 case FrameFormat_NV12:
                 {
-                    m_inputFrame = cv::Mat(frame->RawFrameSize.height, frame->RawFrameSize.width, CV_8UC1, frame->FrameBuffer->data());
-
-                    m_inputFrameRawIntermediate = cv::Mat(m_cameraTextureHeight, m_cameraTextureWidth, CV_8UC3);
-
-                    cv::cvtColor(m_inputFrame, m_inputFrameRawIntermediate, cv::COLOR_YUV2RGB_NV12);
+                    // Luma plane followed by the interleaved half resolution chroma plane.
+                    m_inputFrame = cv::Mat(frame->RawFrameSize.height, frame->RawFrameSize.width, CV_8UC1, frame->GetFrameData());
 
                     if (m_bUseColor)
                     {
-                        m_inputFrameRawIntermediate(frameROILeft).copyTo(m_inputFrameLeft);
-                        m_inputFrameRawIntermediate(frameROIRight).copyTo(m_inputFrameRight);
+                        cv::Mat chromaPlane(frame->RawFrameSize.height / 2, frame->RawFrameSize.width / 2, CV_8UC2, frame->GetFrameData() + frame->RawFrameSize.width * frame->RawFrameSize.height);
+
+                        cv::Rect chromaROILeft(frameROILeft.x / 2, frameROILeft.y / 2, frameROILeft.width / 2, frameROILeft.height / 2);
+                        cv::Rect chromaROIRight(frameROIRight.x / 2, frameROIRight.y / 2, frameROIRight.width / 2, frameROIRight.height / 2);
+
+                        cv::cvtColorTwoPlane(m_inputFrame(frameROILeft), chromaPlane(chromaROILeft), m_inputFrameLeft, cv::COLOR_YUV2RGB_NV12);
+                        cv::cvtColorTwoPlane(m_inputFrame(frameROIRight), chromaPlane(chromaROIRight), m_inputFrameRight, cv::COLOR_YUV2RGB_NV12);
                     }
                     else
                     {
-                        cv::cvtColor(m_inputFrameRawIntermediate(frameROILeft), m_inputFrameLeft, cv::COLOR_RGB2GRAY);
-                        cv::cvtColor(m_inputFrameRawIntermediate(frameROIRight), m_inputFrameRight, cv::COLOR_RGB2GRAY);
+                        ConvertLumaToGray(m_inputFrame(frameROILeft), m_inputFrameLeft, true);
+                        ConvertLumaToGray(m_inputFrame(frameROIRight), m_inputFrameRight, true);
                     }
                     break;
                 }
                 case FrameFormat_BAYER16BG:
                 {
-                    m_inputFrame = cv::Mat(frame->RawFrameSize.height, frame->RawFrameSize.width, CV_16UC1, frame->FrameBuffer->data());
+                    m_inputFrame = cv::Mat(frame->RawFrameSize.height, frame->RawFrameSize.width, CV_16UC1, frame->GetFrameData());
 
                     if (m_bUseColor)
                     {
+                        // The matchers only take 8 bit input, scale down the 10 bit sensor values.
                         cv::cvtColor(m_inputFrame(frameROILeft), m_inputFrameLeft, cv::COLOR_BayerBG2RGB);
                         cv::cvtColor(m_inputFrame(frameROIRight), m_inputFrameRight, cv::COLOR_BayerBG2RGB);
+                        m_inputFrameLeft.convertTo(m_inputFrameLeft, CV_8U, 1.0 / 4.0);
+                        m_inputFrameRight.convertTo(m_inputFrameRight, CV_8U, 1.0 / 4.0);
+                    }
+                    else if (m_downscaleFactor >= 2 && !stereoConfig.StereoFilteringBilateral_Enable)
+                    {
+                        // The matcher input is downscaled anyway, so bin the Bayer quads instead of demosaicing.
+                        // Any 2x2 quad has the same mix of colors, so only the size needs to be rounded down to whole quads.
+                        cv::Rect binnedROILeft(frameROILeft.x, frameROILeft.y, frameROILeft.width & ~1, frameROILeft.height & ~1);
+                        cv::Rect binnedROIRight(frameROIRight.x, frameROIRight.y, frameROIRight.width & ~1, frameROIRight.height & ~1);
+
+                        ConvertBayer16BGToBinnedGray(m_inputFrame(binnedROILeft), m_inputFrameLeft);
+                        ConvertBayer16BGToBinnedGray(m_inputFrame(binnedROIRight), m_inputFrameRight);
+
+                        bInputPrescaled = true;
                     }
                     else
                     {
                         cv::cvtColor(m_inputFrame(frameROILeft), m_inputFrameLeft, cv::COLOR_BayerBG2GRAY);
                         cv::cvtColor(m_inputFrame(frameROIRight), m_inputFrameRight, cv::COLOR_BayerBG2GRAY);
+                        m_inputFrameLeft.convertTo(m_inputFrameLeft, CV_8U, 1.0 / 4.0);
+                        m_inputFrameRight.convertTo(m_inputFrameRight, CV_8U, 1.0 / 4.0);
                     }
                     break;
                 }
                 case FrameFormat_MJPEG:
                 {
-                    m_inputFrame = cv::imdecode(*frame->FrameBuffer.get(), cv::IMREAD_COLOR, &m_rawInputFrame);
+                    // Let the JPEG decoder scale down the DCT blocks when the full resolution isn't needed.
+                    // The bilateral filter needs the full resolution rectified frame.
+                    int decodeScale = 1;
+
+                    if (!stereoConfig.StereoFilteringBilateral_Enable)
+                    {
+                        decodeScale = m_downscaleFactor >= 8 ? 8 : m_downscaleFactor >= 4 ? 4 : m_downscaleFactor >= 2 ? 2 : 1;
+                    }
+
+                    int decodeFlags;
+
+                    switch (decodeScale)
+                    {
+                    case 8:
+                        decodeFlags = m_bUseColor ? cv::IMREAD_REDUCED_COLOR_8 : cv::IMREAD_REDUCED_GRAYSCALE_8;
+                        break;
+                    case 4:
+                        decodeFlags = m_bUseColor ? cv::IMREAD_REDUCED_COLOR_4 : cv::IMREAD_REDUCED_GRAYSCALE_4;
+                        break;
+                    case 2:
+                        decodeFlags = m_bUseColor ? cv::IMREAD_REDUCED_COLOR_2 : cv::IMREAD_REDUCED_GRAYSCALE_2;
+                        break;
+                    default:
+                        decodeFlags = m_bUseColor ? cv::IMREAD_COLOR : cv::IMREAD_GRAYSCALE;
+                    }
+
+                    m_inputFrame = cv::imdecode(cv::Mat(1, frame->RawFrameDataBytes, CV_8UC1, frame->GetFrameData()), decodeFlags, &m_rawInputFrame);
 
                     if (m_inputFrame.empty())
                     {
@@ -535,21 +809,79 @@ void DepthReconstruction::RunThread()
                         continue;
                     }
 
+                    cv::Rect decodedROILeft = frameROILeft;
+                    cv::Rect decodedROIRight = frameROIRight;
+
+                    if (decodeScale > 1)
+                    {
+                        decodedROILeft = cv::Rect(frameROILeft.x / decodeScale, frameROILeft.y / decodeScale, frameROILeft.width / decodeScale, frameROILeft.height / decodeScale);
+                        decodedROIRight = cv::Rect(frameROIRight.x / decodeScale, frameROIRight.y / decodeScale, frameROIRight.width / decodeScale, frameROIRight.height / decodeScale);
+
+                        decodedROILeft &= cv::Rect(0, 0, m_inputFrame.cols, m_inputFrame.rows);
+                        decodedROIRight &= cv::Rect(0, 0, m_inputFrame.cols, m_inputFrame.rows);
+
+                        bInputPrescaled = true;
+                    }
+
+                    if (m_bUseColor)
+                    {
+                        cv::cvtColor(m_inputFrame(decodedROILeft), m_inputFrameLeft, cv::COLOR_BGR2RGB);
+                        cv::cvtColor(m_inputFrame(decodedROIRight), m_inputFrameRight, cv::COLOR_BGR2RGB);
+                    }
+                    else
+                    {
+                        m_inputFrame(decodedROILeft).copyTo(m_inputFrameLeft);
+                        m_inputFrame(decodedROIRight).copyTo(m_inputFrameRight);
+                    }
+                    break;
+                }
+
+                case FrameFormat_NV12_2:
+                {
+                    if (m_bUseColor)
+                    {
+                        ConvertSplitNV12ToRGB(frame->GetFrameData(), frame->RawFrameSize.width, frame->RawFrameSize.height, frameROILeft, m_inputFrameLeft);
+                        ConvertSplitNV12ToRGB(frame->GetFrameData(), frame->RawFrameSize.width, frame->RawFrameSize.height, frameROIRight, m_inputFrameRight);
+                    }
+                    else
+                    {
+                        ConvertSplitNV12ToGray(frame->GetFrameData(), frame->RawFrameSize.width, frame->RawFrameSize.height, frameROILeft, m_inputFrameLeft, true);
+                        ConvertSplitNV12ToGray(frame->GetFrameData(), frame->RawFrameSize.width, frame->RawFrameSize.height, frameROIRight, m_inputFrameRight, true);
+                    }
+                    break;
+                }
+                case FrameFormat_RAW10:
+                {
+                    // Packed rows with 4 pixels in 5 bytes. The eye views must start and end on whole groups.
+                    if (frame->RawFrameSize.width % 4 != 0 || frameROILeft.x % 4 != 0 || frameROILeft.width % 4 != 0 ||
+                        frameROIRight.x % 4 != 0 || frameROIRight.width % 4 != 0)
+                    {
+                        g_logger->warn("RAW10 camera frame width {} is not divisible into 4 pixel groups per eye, skipping frame!", frame->RawFrameSize.width);
+                        continue;
+                    }
+
+                    m_inputFrame = cv::Mat(frame->RawFrameSize.height, frame->RawFrameSize.width * 5 / 4, CV_8UC1, frame->GetFrameData());
+
+                    cv::Rect packedROILeft(frameROILeft.x * 5 / 4, frameROILeft.y, frameROILeft.width * 5 / 4, frameROILeft.height);
+                    cv::Rect packedROIRight(frameROIRight.x * 5 / 4, frameROIRight.y, frameROIRight.width * 5 / 4, frameROIRight.height);
+
                     if (m_bUseColor)
                     {
-                        cv::cvtColor(m_inputFrame(frameROILeft), m_inputFrameLeft, cv::COLOR_BGR2RGB);
-                        cv::cvtColor(m_inputFrame(frameROIRight), m_inputFrameRight, cv::COLOR_BGR2RGB);
+                        // The sensor data has no color, but the matchers are set up for RGB input.
+                        ConvertRAW10ToGray(m_inputFrame(packedROILeft), m_inputFrameGrayLeft);
+                        ConvertRAW10ToGray(m_inputFrame(packedROIRight), m_inputFrameGrayRight);
+
+                        cv::cvtColor(m_inputFrameGrayLeft, m_inputFrameLeft, cv::COLOR_GRAY2RGB);
+                        cv::cvtColor(m_inputFrameGrayRight, m_inputFrameRight, cv::COLOR_GRAY2RGB);
                     }
                     else
                     {
-                        cv::cvtColor(m_inputFrame(frameROILeft), m_inputFrameLeft, cv::COLOR_BGR2GRAY);
-                        cv::cvtColor(m_inputFrame(frameROIRight), m_inputFrameRight, cv::COLOR_BGR2GRAY);
+                        ConvertRAW10ToGray(m_inputFrame(packedROILeft), m_inputFrameLeft);
+                        ConvertRAW10ToGray(m_inputFrame(packedROIRight), m_inputFrameRight);
                     }
                     break;
                 }
 
-                case FrameFormat_RAW10: // TODO
-                case FrameFormat_NV12_2: // TODO
                 default:
                 {
                     continue;
@@ -558,7 +890,7 @@ void DepthReconstruction::RunThread()
             }
             else
             {
-                m_inputFrame = cv::Mat(m_cameraTextureHeight, m_cameraTextureWidth, CV_8UC4, frame->FrameBuffer->data());
+                m_inputFrame = cv::Mat(m_cameraTextureHeight, m_cameraTextureWidth, CV_8UC4, frame->GetFrameData());
 
                 if (m_bUseColor)
                 {
@@ -582,370 +914,1375 @@ void DepthReconstruction::RunThread()
             }
         }
 
-        int filter = stereoConfig.StereoRectificationFiltering ? CV_INTER_LINEAR : CV_INTER_NN;
+        uint64_t convertEndTime = GetCurrentTimeSytemTicks();
 
-        cv::remap(m_inputFrameLeft, m_rectifiedFrameLeft, m_leftMap1, m_leftMap2, filter, cv::BORDER_CONSTANT);
-        cv::remap(m_inputFrameRight, m_rectifiedFrameRight, m_rightMap1, m_rightMap2, filter, cv::BORDER_CONSTANT);
-        
-        int resizeFilter = stereoConfig.StereoRectificationFiltering ? CV_INTER_AREA : CV_INTER_LINEAR;
+        // The combined remap also does the downscaling, so keep linear filtering whenever the frame is reduced.
+        // Nearest neighbour sampling is only used at full resolution, where the separate rectification used it before.
+        int filter = (stereoConfig.StereoRectificationFiltering || m_downscaleFactor > 1) ? CV_INTER_LINEAR : CV_INTER_NN;
 
-        cv::resize(m_rectifiedFrameLeft, m_scaledFrameLeft, cv::Size(m_cvImageWidth, m_cvImageHeight), resizeFilter);
-        cv::resize(m_rectifiedFrameRight, m_scaledFrameRight, cv::Size(m_cvImageWidth, m_cvImageHeight), resizeFilter);      
-        int minDisparity = stereoConfig.StereoMinDisparity;
         int numDisparities = m_maxDisparity - stereoConfig.StereoMinDisparity;
+        int disparityWidth = m_bDisparityBothEyes ? m_cvImageWidth + m_maxDisparity * 2 : m_cvImageWidth + m_maxDisparity;
 
-        m_scaledFrameLeft.copyTo(m_scaledExtFrameLeft(cv::Rect(numDisparities, 0, m_cvImageWidth, m_cvImageHeight)));
-        m_scaledFrameRight.copyTo(m_scaledExtFrameRight(cv::Rect(numDisparities, 0, m_cvImageWidth, m_cvImageHeight)));
+        inputFrame->ExtFrameLeft.create(m_cvImageHeight, disparityWidth, m_inputFrameLeft.type());
+        inputFrame->ExtFrameRight.create(m_cvImageHeight, disparityWidth, m_inputFrameRight.type());
 
-        int filterMultiplier = stereoConfig.StereoBlockSize * stereoConfig.StereoBlockSize;
-        int speckleRange = stereoConfig.StereoSGBM_SpeckleWindowSize > 0 ? stereoConfig.StereoSGBM_SpeckleRange : 0;
+        // Rectify and downscale in a single pass, straight into the matcher input.
+        cv::Mat scaledFrameLeft = inputFrame->ExtFrameLeft(cv::Rect(numDisparities, 0, m_cvImageWidth, m_cvImageHeight));
+        cv::Mat scaledFrameRight = inputFrame->ExtFrameRight(cv::Rect(numDisparities, 0, m_cvImageWidth, m_cvImageHeight));
 
-        m_stereoLeftMatcher = cv::StereoSGBM::create(minDisparity, numDisparities, stereoConfig.StereoBlockSize,
-            stereoConfig.StereoSGBM_P1 * filterMultiplier, stereoConfig.StereoSGBM_P2 * filterMultiplier, stereoConfig.StereoSGBM_DispMaxDiff,
-            stereoConfig.StereoSGBM_PreFilterCap, stereoConfig.StereoSGBM_UniquenessRatio,
-            stereoConfig.StereoSGBM_SpeckleWindowSize, speckleRange,
-            (int)stereoConfig.StereoSGBM_Mode);
+        if (bInputPrescaled || (stereoConfig.StereoRectificationFiltering && m_downscaleFactor > 1))
+        {
+            cv::Size scaledSize(m_cvImageWidth, m_cvImageHeight);
 
-        m_stereoLeftMatcher->compute(m_scaledExtFrameLeft, m_scaledExtFrameRight, m_rawDisparityLeft);
+            cv::Mat prefilteredLeft = m_inputFrameLeft;
+            cv::Mat prefilteredRight = m_inputFrameRight;
 
-        cv::Mat* outputMatrixLeft;
-        cv::Mat* outputMatrixRight;
+            // Prescaled inputs only need resizing if the reduction didn't exactly match the downscale factor.
+            if (m_inputFrameLeft.size() != scaledSize || m_inputFrameRight.size() != scaledSize)
+            {
+                cv::resize(m_inputFrameLeft, m_prefilteredFrameLeft, scaledSize, 0.0, 0.0, CV_INTER_AREA);
+                cv::resize(m_inputFrameRight, m_prefilteredFrameRight, scaledSize, 0.0, 0.0, CV_INTER_AREA);
 
-        cv::Mat* outputConfMatrixLeft;
-        cv::Mat* outputConfMatrixRight;
+                prefilteredLeft = m_prefilteredFrameLeft;
+                prefilteredRight = m_prefilteredFrameRight;
+            }
 
+            cv::remap(prefilteredLeft, scaledFrameLeft, m_prefilterLeftMap1, m_prefilterLeftMap2, filter, cv::BORDER_CONSTANT);
+            cv::remap(prefilteredRight, scaledFrameRight, m_prefilterRightMap1, m_prefilterRightMap2, filter, cv::BORDER_CONSTANT);
+        }
+        else
+        {
+            cv::remap(m_inputFrameLeft, scaledFrameLeft, m_scaledLeftMap1, m_scaledLeftMap2, filter, cv::BORDER_CONSTANT);
+            cv::remap(m_inputFrameRight, scaledFrameRight, m_scaledRightMap1, m_scaledRightMap2, filter, cv::BORDER_CONSTANT);
+        }
 
-        if (m_bDisparityBothEyes)
+        // Copy rectified camera frame associated with disparity
+        if (stereoConfig.StereoFilteringBilateral_Enable)
         {
-            m_stereoRightMatcher = cv::StereoSGBM::create(-m_maxDisparity, numDisparities, stereoConfig.StereoBlockSize,
-                stereoConfig.StereoSGBM_P1 * filterMultiplier, stereoConfig.StereoSGBM_P2 * filterMultiplier, stereoConfig.StereoSGBM_DispMaxDiff,
-                stereoConfig.StereoSGBM_PreFilterCap, stereoConfig.StereoSGBM_UniquenessRatio,
-                stereoConfig.StereoSGBM_SpeckleWindowSize, speckleRange,
-                (int)stereoConfig.StereoSGBM_Mode);
+            inputFrame->CameraFrameBuffer.resize(m_cameraFrameWidth * 2 * m_cameraFrameHeight);
+
+            m_outputCameraFrame = cv::Mat(m_cameraFrameHeight, m_cameraFrameWidth * 2, CV_8U, inputFrame->CameraFrameBuffer.data());
 
-            m_stereoRightMatcher->compute(m_scaledExtFrameRight, m_scaledExtFrameLeft, m_rawDisparityRight);
+            m_outputCameraFrameLeft = m_outputCameraFrame(cv::Rect(0, 0, m_cameraFrameWidth, m_cameraFrameHeight));
+            m_outputCameraFrameRight = m_outputCameraFrame(cv::Rect(m_cameraFrameWidth, 0, m_cameraFrameWidth, m_cameraFrameHeight));
 
-            outputMatrixLeft = &m_rawDisparityLeft;
-            outputMatrixRight = &m_rawDisparityRight;
+            // The full resolution rectified frames are only needed here.
+            if (m_bUseColor)
+            {
+                cv::remap(m_inputFrameLeft, m_rectifiedFrameLeft, m_leftMap1, m_leftMap2, filter, cv::BORDER_CONSTANT);
+                cv::remap(m_inputFrameRight, m_rectifiedFrameRight, m_rightMap1, m_rightMap2, filter, cv::BORDER_CONSTANT);
 
-            outputConfMatrixLeft = &m_confidenceLeft;
-            outputConfMatrixRight = &m_confidenceRight;
+                cv::cvtColor(m_rectifiedFrameLeft, m_outputCameraFrameLeft, cv::COLOR_RGB2GRAY);
+                cv::cvtColor(m_rectifiedFrameRight, m_outputCameraFrameRight, cv::COLOR_RGB2GRAY);
+            }
+            else
+            {
+                cv::remap(m_inputFrameLeft, m_outputCameraFrameLeft, m_leftMap1, m_leftMap2, filter, cv::BORDER_CONSTANT);
+                cv::remap(m_inputFrameRight, m_outputCameraFrameRight, m_rightMap1, m_rightMap2, filter, cv::BORDER_CONSTANT);
+            }
         }
-        else
+
+        StereoFrameParams& params = inputFrame->Params;
+        params.StereoConfig = stereoConfig;
+        params.ImageWidth = m_cvImageWidth;
+        params.ImageHeight = m_cvImageHeight;
+        params.CameraFrameWidth = m_cameraFrameWidth;
+        params.CameraFrameHeight = m_cameraFrameHeight;
+        params.DownscaleFactor = m_downscaleFactor;
+        params.MaxDisparity = m_maxDisparity;
+        params.bDisparityBothEyes = m_bDisparityBothEyes;
+        params.FrameTimestamp = frameTimestamp;
+        params.ViewToWorldLeft = viewToWorldLeft;
+        params.ViewToWorldRight = viewToWorldRight;
+        params.DisparityToDepth = m_disparityToDepth;
+        params.RectifiedRotationLeft = m_rectifiedRotationLeft;
+        params.RectifiedRotationRight = m_rectifiedRotationRight;
+        params.RectifiedFocalLength = m_rectifiedFocalLength;
+        params.RectifiedCenter = m_rectifiedCenter;
+        params.DisparityDepthScale = m_disparityDepthScale;
+
+        params.GovernorLevel = governorLevel;
+        params.BenchmarkPreset = m_benchmarkPreset;
+        params.bBenchmarkMeasured = m_benchmarkPreset >= 0 && m_benchmarkFrameCount >= STEREO_BENCHMARK_WARMUP_FRAMES;
+        params.bBenchmarkPresetEnd = m_benchmarkPreset >= 0 && m_benchmarkFrameCount + 1 >= STEREO_BENCHMARK_WARMUP_FRAMES + STEREO_BENCHMARK_MEASURED_FRAMES;
+        params.InputStartTime = inputStartTime;
+        params.StageTimesMS[StereoBenchmarkStage_Convert] = (float)(GetPerfTimeDiffSeconds(inputStartTime, convertEndTime) * 1000.0);
+        params.StageTimesMS[StereoBenchmarkStage_Rectify] = (float)(GetPerfTimeDiffSeconds(convertEndTime, GetCurrentTimeSytemTicks()) * 1000.0);
+
+        inputFrame->bHasGroundTruth = bHasGroundTruth;
+        if (bHasGroundTruth)
         {
-            outputMatrixLeft = &m_rawDisparityLeft;
-            outputMatrixRight = &m_rawDisparityLeft;
+            ComputeGroundTruthDisparity(inputFrame->GroundTruthDisparity);
+        }
 
-            outputConfMatrixLeft = &m_confidenceLeft;
-            outputConfMatrixRight = &m_confidenceLeft;
+        m_inputQueue.EndWrite();
+
+        m_inputStageTimer.EndPerfTimer();
+
+        if (m_benchmarkPreset >= 0 && ++m_benchmarkFrameCount >= STEREO_BENCHMARK_WARMUP_FRAMES + STEREO_BENCHMARK_MEASURED_FRAMES)
+        {
+            m_benchmarkFrameCount = 0;
+            m_benchmarkPreset = m_benchmarkPreset < StereoPreset_VeryHigh ? m_benchmarkPreset + 1 : -1;
         }
+    }
+}
 
 
-        if(stereoConfig.StereoFilteringWLS_Enable)
+// Matching stage: Runs the stereo matchers and WLS filtering.
+void DepthReconstruction::RunMatchingThread()
+{
+    while (m_bRunThread)
+    {
+        StereoInputFrame* inputFrame = m_inputQueue.BeginRead(STEREO_PIPELINE_WAIT_TIMEOUT);
+        if (!inputFrame)
         {
-            cv::Rect leftROI = cv::Rect(0, 0, m_cvImageWidth + numDisparities, m_cvImageHeight);
+            continue;
+        }
 
-            if (!m_bDisparityBothEyes)
-            {
-                m_stereoRightMatcher = cv::ximgproc::createRightMatcher(m_stereoLeftMatcher);
+        StereoDisparityFrame* outputFrame = m_disparityQueue.BeginWrite(STEREO_PIPELINE_WAIT_TIMEOUT);
+        if (!outputFrame)
+        {
+            continue;
+        }
 
-                m_stereoRightMatcher->compute(m_scaledExtFrameRight, m_scaledExtFrameLeft, m_rawDisparityRight);
+        uint64_t matchStartTime = m_matchingStageTimer.StartPerfTimer();
 
-                leftROI = cv::Rect();
-            }
+        const StereoFrameParams& params = inputFrame->Params;
+        const Config_Stereo& stereoConfig = params.StereoConfig;
+        bool bWLSEnable = stereoConfig.StereoFilteringWLS_Enable;
 
-            m_wlsFilterLeft = cv::ximgproc::createDisparityWLSFilter(m_stereoLeftMatcher);
+        UpdateStereoMatchers(params);
 
-            m_wlsFilterLeft->setLambda(stereoConfig.StereoFilteringWLS_Lambda);
-            m_wlsFilterLeft->setSigmaColor(stereoConfig.StereoFilteringWLS_Sigma);
-            m_wlsFilterLeft->setDepthDiscontinuityRadius((int)ceil(stereoConfig.StereoFilteringWLS_ConfidenceRadius * stereoConfig.StereoBlockSize));
+        int numDisparities = params.MaxDisparity - stereoConfig.StereoMinDisparity;
 
-            m_wlsFilterLeft->filter(m_rawDisparityLeft, m_scaledExtFrameLeft, m_filteredDisparityLeft, m_rawDisparityRight, leftROI, m_scaledExtFrameRight);
+        // Without filtering, the matchers write directly into the queue entry.
+        cv::Mat& disparityLeft = bWLSEnable ? m_rawDisparityLeft : outputFrame->DisparityLeft;
+        cv::Mat& disparityRight = bWLSEnable ? m_rawDisparityRight : outputFrame->DisparityRight;
 
+        // The right eye disparity is needed either for output or as the WLS cross-check input.
+        bool bComputeRight = params.bDisparityBothEyes || bWLSEnable;
+        bool bConcurrentEyes = stereoConfig.StereoUseMulticore;
 
-            if (m_bDisparityBothEyes)
-            {
-                m_wlsFilterRight = cv::ximgproc::createDisparityWLSFilter(m_stereoRightMatcher);
+        // Change detection marks the bands that can be copied from the cached result, which the band builders below take into account.
+        bool bChangeDetection = stereoConfig.StereoChangeDetection_Enable;
+        bool bPartialRecompute = false;
 
-                m_wlsFilterRight->setLambda(stereoConfig.StereoFilteringWLS_Lambda);
-                m_wlsFilterRight->setSigmaColor(stereoConfig.StereoFilteringWLS_Sigma);
-                m_wlsFilterRight->setDepthDiscontinuityRadius((int)ceil(stereoConfig.StereoFilteringWLS_ConfidenceRadius * stereoConfig.StereoBlockSize));
-                cv::Rect filterROI = cv::Rect(0, 0, m_cvImageWidth + numDisparities, m_cvImageHeight);
+        if (bChangeDetection)
+        {
+            bPartialRecompute = DetectChangedBands(*inputFrame);
+        }
+        else
+        {
+            m_bandChanged.clear();
+            m_bHasChangeReference = false;
+            m_recomputedFraction = 1.0f;
+        }
 
-                m_wlsFilterRight->filter(m_rawDisparityRight, m_scaledExtFrameRight, m_filteredDisparityRight, m_rawDisparityLeft, filterROI, m_scaledExtFrameLeft);
+        bool bReuseAll = bPartialRecompute && std::none_of(m_bandChanged.begin(), m_bandChanged.end(), [](uint8_t bChanged) { return bChanged != 0; });
 
-                m_confidenceLeft = m_wlsFilterLeft->getConfidenceMap();
-                m_confidenceRight = m_wlsFilterRight->getConfidenceMap();
+        // The motion predicted ranges take priority, with the coarse search used on frames that have no usable prediction.
+        bool bMotionPrediction = stereoConfig.StereoMotionPrediction_Enable;
+        bool bUseBands = !bReuseAll && bMotionPrediction && ComputePredictedDisparityBands(params);
 
-                outputMatrixLeft = &m_filteredDisparityLeft;
-                outputMatrixRight = &m_filteredDisparityRight;
-            }
-            else
-            {
-                m_confidenceLeft = m_wlsFilterLeft->getConfidenceMap();
-                m_confidenceRight = m_wlsFilterLeft->getConfidenceMap();
+        if (!bUseBands && !bReuseAll && stereoConfig.StereoCoarseToFine_Enable)
+        {
+            ComputeDisparityBands(*inputFrame);
+            bUseBands = true;
+        }
 
-                outputMatrixLeft = &m_filteredDisparityLeft;
-                outputMatrixRight = &m_filteredDisparityLeft;
-            }
+        if (!bUseBands && bPartialRecompute && !bReuseAll)
+        {
+            ComputeFullRangeBands(params);
+            bUseBands = true;
         }
 
+        if (bUseBands)
         {
-            FramePtr<DepthFrame> frame = m_depthFrameQueue.AcquireWrite();
+            UpdateDisparitySearchFraction(params);
+        }
+        else
+        {
+            m_disparitySearchFraction = bReuseAll ? 0.0f : 1.0f;
+        }
 
-            if (!frame.HasFrame())
+        auto matchLeft = [&]()
+        {
+            if (bUseBands)
             {
-                g_logger->warn("Depth reconstruction frame underrun!");
-                continue;
+                MatchDisparityBands(*m_bandMatcherLeft, inputFrame->ExtFrameLeft, inputFrame->ExtFrameRight, disparityLeft, m_bandDisparityLeft, m_cachedDisparityLeft, m_stereoLeftMatcher->getMinDisparity(), params.MaxDisparity, false);
             }
-
-            if (frame->DisparityTextureIndex < 0)
+            else
             {
-                frame->DisparityTextureIndex = m_depthFrameIndex++;
+                m_stereoLeftMatcher->compute(inputFrame->ExtFrameLeft, inputFrame->ExtFrameRight, disparityLeft);
             }
+        };
 
-            XrMatrix4x4f rectifiedRotationInvLeft;
-            XrMatrix4x4f_Transpose(&rectifiedRotationInvLeft, &m_rectifiedRotationLeft);
-            XrMatrix4x4f_Multiply(&frame->DisparityViewToWorldLeft, &viewToWorldLeft, &rectifiedRotationInvLeft);
-
-            if (m_bDisparityBothEyes)
+        auto matchRight = [&]()
+        {
+            if (bUseBands)
             {
-                XrMatrix4x4f rectifiedRotationInvRight;
-                XrMatrix4x4f_Transpose(&rectifiedRotationInvRight, &m_rectifiedRotationRight);
-                XrMatrix4x4f_Multiply(&frame->DisparityViewToWorldRight, &viewToWorldRight, &rectifiedRotationInvRight);
+                MatchDisparityBands(*m_bandMatcherRight, inputFrame->ExtFrameRight, inputFrame->ExtFrameLeft, disparityRight, m_bandDisparityRight, m_cachedDisparityRight, m_stereoRightMatcher->getMinDisparity(), params.MaxDisparity, true);
             }
             else
             {
-                frame->DisparityViewToWorldRight = frame->DisparityViewToWorldLeft;
+                m_stereoRightMatcher->compute(inputFrame->ExtFrameRight, inputFrame->ExtFrameLeft, disparityRight);
             }
+        };
 
-            int outputScale = stereoConfig.StereoFilteringBilateral_Enable ? stereoConfig.StereoFilteringBilateral_OutputScale : 1;
+        if (bReuseAll)
+        {
+            ReuseCachedOutput(*outputFrame);
+        }
+        else if (bComputeRight)
+        {
+            RunEyeTasks(matchLeft, matchRight, bConcurrentEyes);
+        }
+        else
+        {
+            matchLeft();
+        }
 
+        uint64_t matchEndTime = GetCurrentTimeSytemTicks();
 
-            // Precompute disparity-to-depth scaling factors for the shader inputs.
-            frame->DisparityToDepth = m_disparityToDepth;
-            frame->DisparityToDepth.m[0] *= (float)m_cvImageWidth;
-            frame->DisparityToDepth.m[5] *= -(float)m_cvImageHeight;
-            frame->DisparityToDepth.m[12] /= (float)m_downscaleFactor;
-            frame->DisparityToDepth.m[13] /= -(float)m_downscaleFactor;
-            frame->DisparityToDepth.m[14] /= -(float)m_downscaleFactor;
-            // Convert z to int16 range with 4 bit fixed decimal: 65536 / 2 / 16 = 2048
-            frame->DisparityToDepth.m[11] *= 2048.0f;
+        if (bWLSEnable && !bReuseAll)
+        {
+            cv::Rect filterROI = cv::Rect(0, 0, params.ImageWidth + numDisparities, params.ImageHeight);
 
-            frame->InputDisparityTextureSize = { m_cvImageWidth * 2, m_cvImageHeight };
-            frame->OutputDisparityTextureSize = 
-                { m_cvImageWidth * 2 * outputScale, m_cvImageHeight * outputScale };
-            frame->CameraFrameTextureSize = { m_cameraFrameWidth * 2, m_cameraFrameHeight };
-            frame->DisparityDownscaleFactor = (float)m_downscaleFactor / outputScale;
-            frame->FrameSequence = (frame->FrameSequence + 1) % 16;
-            frame->FrameExposureTimestamp = frameTimestamp;
+            auto filterLeft = [&]()
+            {
+                cv::Rect leftROI = params.bDisparityBothEyes ? filterROI : cv::Rect();
 
-            // Truncate valid range to deal with fixed point fractions
-            frame->MinDisparity = (stereoConfig.StereoMinDisparity + 4) / 2048.0f;
-            frame->MaxDisparity = (m_maxDisparity - 4) / 2048.0f;
-            frame->bIsValid = true;
+                m_wlsFilterLeft->filter(m_rawDisparityLeft, inputFrame->ExtFrameLeft, outputFrame->DisparityLeft, m_rawDisparityRight, leftROI, inputFrame->ExtFrameRight);
 
+                // The filter reuses its confidence buffer, so it needs to be copied before the next frame.
+                m_wlsFilterLeft->getConfidenceMap().copyTo(outputFrame->ConfidenceLeft);
+            };
 
-            m_reconstructionTimer.EndPerfTimer();
-            m_renderTimer.StartPerfTimer();
+            auto filterRight = [&]()
+            {
+                m_wlsFilterRight->filter(m_rawDisparityRight, inputFrame->ExtFrameRight, outputFrame->DisparityRight, m_rawDisparityLeft, filterROI, inputFrame->ExtFrameLeft);
 
+                m_wlsFilterRight->getConfidenceMap().copyTo(outputFrame->ConfidenceRight);
+            };
 
-            if (!m_asyncRenderer->BeginRender(frame.GetSharedPointer(), stereoConfig))
+            // Both filters need the raw disparity of both eyes, so they can only start after the matchers have joined.
+            if (params.bDisparityBothEyes)
             {
-                continue;
+                RunEyeTasks(filterLeft, filterRight, bConcurrentEyes);
+            }
+            else
+            {
+                filterLeft();
             }
+        }
 
-            // Write disparity and confidence to texture
+        if (bChangeDetection && !bReuseAll)
+        {
+            StoreChangeCache(*inputFrame, *outputFrame, disparityLeft, disparityRight, bPartialRecompute);
+        }
 
-            cv::Rect copySrcRegion = cv::Rect(numDisparities, 0, m_cvImageWidth, m_cvImageHeight);
+        outputFrame->bHasConfidence = bWLSEnable;
+        outputFrame->Params = params;
+        outputFrame->Params.StageTimesMS[StereoBenchmarkStage_Match] = (float)(GetPerfTimeDiffSeconds(matchStartTime, matchEndTime) * 1000.0);
+        outputFrame->Params.StageTimesMS[StereoBenchmarkStage_Filter] = (float)(GetPerfTimeDiffSeconds(matchEndTime, GetCurrentTimeSytemTicks()) * 1000.0);
+        outputFrame->CameraFrameBuffer.swap(inputFrame->CameraFrameBuffer);
+        cv::swap(outputFrame->GroundTruthDisparity, inputFrame->GroundTruthDisparity);
+        outputFrame->bHasGroundTruth = inputFrame->bHasGroundTruth;
 
-            m_outputDisparityBuffer.resize(m_cvImageHeight * 2 * m_cvImageWidth * 2);
+        if (bMotionPrediction)
+        {
+            StorePredictionPrior(*outputFrame);
+        }
+        else
+        {
+            m_bHasPredictionPrior = false;
+        }
 
-            m_outputDisparity = cv::Mat(m_cvImageHeight, m_cvImageWidth * 2, CV_16S, m_outputDisparityBuffer.data());
+        m_inputQueue.EndRead();
+        m_disparityQueue.EndWrite();
 
-            m_outputDisparityLeft = m_outputDisparity(cv::Rect(0, 0, m_cvImageWidth, m_cvImageHeight));
-            m_outputDisparityRight = m_outputDisparity(cv::Rect(m_cvImageWidth, 0, m_cvImageWidth, m_cvImageHeight));
+        m_matchingStageTimer.EndPerfTimer();
+    }
+}
 
-            (*outputMatrixLeft)(copySrcRegion).copyTo(m_outputDisparityLeft);
 
-            if (m_bDisparityBothEyes)
-            {
-                // Invert right eye disparity
-                (*outputMatrixRight)(copySrcRegion).convertTo(m_outputDisparityRight, CV_16S, -1);
-            }
-            else
-            {
-                (*outputMatrixRight)(copySrcRegion).copyTo(m_outputDisparityRight);
-            }
+// Runs the coarse matcher on a half resolution copy of the frame pair, and finds the range of disparities to search for each band of rows.
+// Bands where the coarse result is mostly invalid search the full range.
+void DepthReconstruction::ComputeDisparityBands(const StereoInputFrame& frame)
+{
+    const StereoFrameParams& params = frame.Params;
+    int minDisparity = params.StereoConfig.StereoMinDisparity;
+    int maxDisparity = params.MaxDisparity;
+    int numDisparities = maxDisparity - minDisparity;
+    int margin = params.StereoConfig.StereoCoarseToFine_Margin;
 
-            m_asyncRenderer->CopyDisparityToGPU(m_outputDisparityBuffer);
+    cv::resize(frame.ExtFrameLeft, m_coarseFrameLeft, cv::Size(), 0.5, 0.5, cv::INTER_AREA);
+    cv::resize(frame.ExtFrameRight, m_coarseFrameRight, cv::Size(), 0.5, 0.5, cv::INTER_AREA);
 
-            m_outputConfidenceBuffer.resize(m_cvImageHeight * 2 * m_cvImageWidth * 2);
+    m_coarseMatcher->compute(m_coarseFrameLeft, m_coarseFrameRight, m_coarseDisparity);
 
-            m_outputConfidence = cv::Mat(m_cvImageHeight, m_cvImageWidth * 2, CV_16S, m_outputConfidenceBuffer.data());
+    int coarseInvalidLimit = m_coarseMatcher->getMinDisparity() * 16;
+    int coarseStartColumn = numDisparities / 2;
+    int coarseWidth = min((int)params.ImageWidth / 2, m_coarseDisparity.cols - coarseStartColumn);
 
-            m_outputConfidenceLeft = m_outputConfidence(cv::Rect(0, 0, m_cvImageWidth, m_cvImageHeight));
-            m_outputConfidenceRight = m_outputConfidence(cv::Rect(m_cvImageWidth, 0, m_cvImageWidth, m_cvImageHeight));
+    m_disparityBands.clear();
 
-            if (stereoConfig.StereoFilteringWLS_Enable)
-            {
-                float confFactor = stereoConfig.StereoFilteringWLS_Enable ? 32768.0f / 255.0f : 32768.0f;
+    for (int startRow = 0; startRow < (int)params.ImageHeight; startRow += STEREO_COARSE_TO_FINE_BAND_HEIGHT)
+    {
+        int endRow = min(startRow + STEREO_COARSE_TO_FINE_BAND_HEIGHT, (int)params.ImageHeight);
+        int coarseStartRow = startRow / 2;
+        int coarseEndRow = min((endRow + 1) / 2, m_coarseDisparity.rows);
 
-                if ((uint32_t)outputConfMatrixLeft->size().width >= m_cvImageWidth + numDisparities)
-                {
-                    (*outputConfMatrixLeft)(copySrcRegion).convertTo(m_outputConfidenceLeft, CV_16S, confFactor);
+        int bandMin = INT16_MAX;
+        int bandMax = INT16_MIN;
+        int numValid = 0;
 
-                    if (!m_bDisparityBothEyes)
-                    {
-                        (*outputConfMatrixLeft)(copySrcRegion).convertTo(m_outputConfidenceRight, CV_16S, confFactor);
-                    }
+        for (int y = coarseStartRow; y < coarseEndRow; y++)
+        {
+            const int16_t* row = m_coarseDisparity.ptr<int16_t>(y) + coarseStartColumn;
+
+            for (int x = 0; x < coarseWidth; x++)
+            {
+                if (row[x] < coarseInvalidLimit) { continue; }
+
+                bandMin = min(bandMin, (int)row[x]);
+                bandMax = max(bandMax, (int)row[x]);
+                numValid++;
+            }
+        }
+
+        bool bHasEstimate = numValid > 0 && numValid >= STEREO_COARSE_TO_FINE_MIN_VALID_FRACTION * (coarseEndRow - coarseStartRow) * coarseWidth;
+
+        // The coarse disparities are in 1/16 pixels at half scale.
+        AddDisparityBand(params, startRow, endRow, bHasEstimate, bandMin / 8.0f, bandMax / 8.0f, margin);
+    }
+}
+
+
+// Appends a band searching the estimated disparities widened by the margin, or the full range if there is no estimate.
+// Adjacent bands with the same range are merged.
+void DepthReconstruction::AddDisparityBand(const StereoFrameParams& params, const int startRow, const int endRow, const bool bHasEstimate, const float estimateMin, const float estimateMax, const int margin)
+{
+    int minDisparity = params.StereoConfig.StereoMinDisparity;
+    int maxDisparity = params.MaxDisparity;
+    int numDisparities = maxDisparity - minDisparity;
+
+    bool bReuse = !m_bandChanged.empty() && !m_bandChanged[startRow / STEREO_COARSE_TO_FINE_BAND_HEIGHT];
+    StereoDisparityBand band = { startRow, endRow, minDisparity, numDisparities, bReuse };
+
+    if (bHasEstimate)
+    {
+        int low = max(minDisparity, (int)floorf(estimateMin) - margin);
+        int high = min(maxDisparity, (int)ceilf(estimateMax) + margin + 1);
+
+        // The matcher needs the range in multiples of 16, so it is widened upwards, or downwards at the top of the full range.
+        band.NumDisparities = min(numDisparities, max(((high - low + 15) / 16) * 16, 16));
+        band.MinDisparity = max(minDisparity, min(low, maxDisparity - band.NumDisparities));
+    }
+
+    if (!m_disparityBands.empty() &&
+        m_disparityBands.back().MinDisparity == band.MinDisparity &&
+        m_disparityBands.back().NumDisparities == band.NumDisparities &&
+        m_disparityBands.back().bReuse == band.bReuse)
+    {
+        m_disparityBands.back().EndRow = endRow;
+    }
+    else
+    {
+        m_disparityBands.push_back(band);
+    }
+}
+
+
+// Reprojects the disparity of the previous frame with the camera motion since then, and finds the range of disparities to search for each band of rows.
+// Pixels with low WLS confidence are left out, and bands with too few reprojected pixels search the full range.
+// Returns false if there is no usable previous frame, or if a periodic full range frame is due.
+bool DepthReconstruction::ComputePredictedDisparityBands(const StereoFrameParams& params)
+{
+    const StereoFrameParams& prior = m_predictionPriorParams;
+
+    if (!m_bHasPredictionPrior ||
+        prior.ImageWidth != params.ImageWidth ||
+        prior.ImageHeight != params.ImageHeight ||
+        prior.MaxDisparity != params.MaxDisparity ||
+        prior.StereoConfig.StereoMinDisparity != params.StereoConfig.StereoMinDisparity)
+    {
+        m_predictedFrameCount = 0;
+        return false;
+    }
+
+    // Occasionally search the full range, so that objects moving outside of the predicted range are picked up.
+    if (++m_predictedFrameCount > STEREO_MOTION_PREDICTION_REFRESH_INTERVAL)
+    {
+        m_predictedFrameCount = 0;
+        return false;
+    }
+
+    // Camera motion from the previous frame to the current one, changed to the OpenCV camera axes.
+    XrMatrix4x4f worldToCurrent, priorToCurrent;
+    XrMatrix4x4f_InvertRigidBody(&worldToCurrent, &params.ViewToWorldLeft);
+    XrMatrix4x4f_Multiply(&priorToCurrent, &worldToCurrent, &prior.ViewToWorldLeft);
+
+    const float basis[3] = { 1.0f, -1.0f, -1.0f };
+    cv::Matx33f motionRotation;
+    cv::Vec3f motionTranslation;
+
+    for (int row = 0; row < 3; row++)
+    {
+        for (int col = 0; col < 3; col++)
+        {
+            motionRotation(row, col) = basis[row] * basis[col] * priorToCurrent.m[col * 4 + row];
+        }
+        motionTranslation[row] = basis[row] * priorToCurrent.m[12 + row];
+    }
+
+    // The rectified rotations are stored transposed from the OpenCV matrices.
+    cv::Matx33f rectifyCurrent, rectifyPrior;
+
+    for (int row = 0; row < 3; row++)
+    {
+        for (int col = 0; col < 3; col++)
+        {
+            rectifyCurrent(row, col) = params.RectifiedRotationLeft.m[col + row * 4];
+            rectifyPrior(row, col) = prior.RectifiedRotationLeft.m[col + row * 4];
+        }
+    }
+
+    cv::Matx33f rotation = rectifyCurrent * motionRotation * rectifyPrior.t();
+    cv::Vec3f translation = rectifyCurrent * motionTranslation;
+
+    int minDisparity = params.StereoConfig.StereoMinDisparity;
+    int numDisparities = params.MaxDisparity - minDisparity;
+    int invalidLimit = minDisparity * 16;
+    bool bUseConfidence = !m_predictionPriorConfidence.empty();
+    int numBands = ((int)params.ImageHeight + STEREO_COARSE_TO_FINE_BAND_HEIGHT - 1) / STEREO_COARSE_TO_FINE_BAND_HEIGHT;
+
+    m_predictedBandMin.assign(numBands, FLT_MAX);
+    m_predictedBandMax.assign(numBands, -FLT_MAX);
+    m_predictedBandCount.assign(numBands, 0);
+
+    const float priorFocalX = prior.RectifiedFocalLength.x;
+    const float priorFocalY = prior.RectifiedFocalLength.y;
+
+    for (int y = 0; y < (int)prior.ImageHeight; y += STEREO_MOTION_PREDICTION_SAMPLE_STEP)
+    {
+        const int16_t* disparityRow = m_predictionPriorDisparity.ptr<int16_t>(y) + numDisparities;
+        const float* confidenceRow = bUseConfidence ? m_predictionPriorConfidence.ptr<float>(y) + numDisparities : nullptr;
+
+        for (int x = 0; x < (int)prior.ImageWidth; x += STEREO_MOTION_PREDICTION_SAMPLE_STEP)
+        {
+            if (disparityRow[x] < invalidLimit || disparityRow[x] <= 0) { continue; }
+            if (confidenceRow && confidenceRow[x] < STEREO_MOTION_PREDICTION_MIN_CONFIDENCE) { continue; }
+
+            float depth = prior.DisparityDepthScale * 16.0f / disparityRow[x];
+            cv::Vec3f point((x - prior.RectifiedCenter.x) * depth / priorFocalX, (y - prior.RectifiedCenter.y) * depth / priorFocalY, depth);
+
+            cv::Vec3f movedPoint = rotation * point + translation;
+            if (movedPoint[2] <= 0.0f) { continue; }
+
+            int movedY = (int)(params.RectifiedFocalLength.y * movedPoint[1] / movedPoint[2] + params.RectifiedCenter.y + 0.5f);
+            if (movedY < 0 || movedY >= (int)params.ImageHeight) { continue; }
+
+            int band = movedY / STEREO_COARSE_TO_FINE_BAND_HEIGHT;
+            float movedDisparity = params.DisparityDepthScale / movedPoint[2];
+
+            m_predictedBandMin[band] = min(m_predictedBandMin[band], movedDisparity);
+            m_predictedBandMax[band] = max(m_predictedBandMax[band], movedDisparity);
+            m_predictedBandCount[band]++;
+        }
+    }
+
+    int samplesPerRow = ((int)params.ImageWidth + STEREO_MOTION_PREDICTION_SAMPLE_STEP - 1) / STEREO_MOTION_PREDICTION_SAMPLE_STEP;
+    int margin = params.StereoConfig.StereoMotionPrediction_Margin;
+
+    m_disparityBands.clear();
+
+    for (int band = 0; band < numBands; band++)
+    {
+        int startRow = band * STEREO_COARSE_TO_FINE_BAND_HEIGHT;
+        int endRow = min(startRow + STEREO_COARSE_TO_FINE_BAND_HEIGHT, (int)params.ImageHeight);
+        int samplesPerBand = samplesPerRow * ((endRow - startRow + STEREO_MOTION_PREDICTION_SAMPLE_STEP - 1) / STEREO_MOTION_PREDICTION_SAMPLE_STEP);
+
+        bool bHasEstimate = m_predictedBandCount[band] > 0 && m_predictedBandCount[band] >= STEREO_COARSE_TO_FINE_MIN_VALID_FRACTION * samplesPerBand;
+
+        AddDisparityBand(params, startRow, endRow, bHasEstimate, m_predictedBandMin[band], m_predictedBandMax[band], margin);
+    }
+
+    return true;
+}
+
+
+// Keeps the left eye result of the current frame for predicting the disparity ranges of the next one.
+void DepthReconstruction::StorePredictionPrior(const StereoDisparityFrame& frame)
+{
+    frame.DisparityLeft.copyTo(m_predictionPriorDisparity);
+
+    if (frame.bHasConfidence)
+    {
+        frame.ConfidenceLeft.copyTo(m_predictionPriorConfidence);
+    }
+    else
+    {
+        m_predictionPriorConfidence.release();
+    }
+
+    m_predictionPriorParams = frame.Params;
+    m_bHasPredictionPrior = true;
+}
+
+
+// Splits the frame into full range bands, so that the unchanged ones can be reused when there are no range estimates.
+void DepthReconstruction::ComputeFullRangeBands(const StereoFrameParams& params)
+{
+    m_disparityBands.clear();
+
+    for (int startRow = 0; startRow < (int)params.ImageHeight; startRow += STEREO_COARSE_TO_FINE_BAND_HEIGHT)
+    {
+        int endRow = min(startRow + STEREO_COARSE_TO_FINE_BAND_HEIGHT, (int)params.ImageHeight);
+        AddDisparityBand(params, startRow, endRow, false, 0.0f, 0.0f, 0);
+    }
+}
+
+
+// Compares the rectified frames to the ones the cached results were computed from, and marks the bands of rows with changed tiles.
+// Returns false if everything needs to be recomputed, either because there is no usable cache, the headset has moved, or too much has changed.
+bool DepthReconstruction::DetectChangedBands(const StereoInputFrame& frame)
+{
+    const StereoFrameParams& params = frame.Params;
+    int numBands = ((int)params.ImageHeight + STEREO_COARSE_TO_FINE_BAND_HEIGHT - 1) / STEREO_COARSE_TO_FINE_BAND_HEIGHT;
+
+    m_bandChanged.assign(numBands, 1);
+    m_recomputedFraction = 1.0f;
+
+    if (!m_bHasChangeReference ||
+        !(m_changeReferenceMatcherParams == m_matcherParams) ||
+        m_changeReferenceLeft.size() != frame.ExtFrameLeft.size() ||
+        m_changeReferenceLeft.type() != frame.ExtFrameLeft.type())
+    {
+        return false;
+    }
+
+    // Any headset motion shifts the whole image, so the motion is compared to the pose of the last full recompute.
+    XrMatrix4x4f worldToReference, motion;
+    XrMatrix4x4f_InvertRigidBody(&worldToReference, &m_changeReferenceViewToWorld);
+    XrMatrix4x4f_Multiply(&motion, &worldToReference, &params.ViewToWorldLeft);
+
+    float translation = sqrtf(motion.m[12] * motion.m[12] + motion.m[13] * motion.m[13] + motion.m[14] * motion.m[14]);
+    float rotationCos = std::clamp((motion.m[0] + motion.m[5] + motion.m[10] - 1.0f) * 0.5f, -1.0f, 1.0f);
+
+    if (translation > STEREO_CHANGE_DETECTION_MAX_TRANSLATION || acosf(rotationCos) > DegToRad(STEREO_CHANGE_DETECTION_MAX_ROTATION_DEGREES))
+    {
+        return false;
+    }
+
+    int numDisparities = params.MaxDisparity - params.StereoConfig.StereoMinDisparity;
+    cv::Rect imageRect(numDisparities, 0, params.ImageWidth, params.ImageHeight);
+
+    cv::absdiff(frame.ExtFrameLeft(imageRect), m_changeReferenceLeft(imageRect), m_changeDiffLeft);
+    cv::absdiff(frame.ExtFrameRight(imageRect), m_changeReferenceRight(imageRect), m_changeDiffRight);
+    cv::max(m_changeDiffLeft, m_changeDiffRight, m_changeDiffLeft);
+
+    // Area downscaling gives the mean difference of each tile. Each band is reduced separately,
+    // so that the tiles cover exactly the band rows even when the image height is not a multiple of the band height.
+    int numTileColumns = ((int)params.ImageWidth + STEREO_CHANGE_DETECTION_TILE_WIDTH - 1) / STEREO_CHANGE_DETECTION_TILE_WIDTH;
+    m_changeTiles.create(numBands, numTileColumns, m_changeDiffLeft.type());
+
+    for (int band = 0; band < numBands; band++)
+    {
+        int startRow = band * STEREO_COARSE_TO_FINE_BAND_HEIGHT;
+        int endRow = min(startRow + STEREO_COARSE_TO_FINE_BAND_HEIGHT, (int)params.ImageHeight);
+
+        cv::Mat tileRow = m_changeTiles.row(band);
+        cv::resize(m_changeDiffLeft.rowRange(startRow, endRow), tileRow, tileRow.size(), 0.0, 0.0, cv::INTER_AREA);
+    }
+
+    float threshold = params.StereoConfig.StereoChangeDetection_Threshold;
+    int channels = m_changeTiles.channels();
+    int numChangedBands = 0;
+
+    for (int band = 0; band < numBands; band++)
+    {
+        const uint8_t* tileRow = m_changeTiles.ptr<uint8_t>(band);
+        bool bChanged = false;
+
+        for (int i = 0; i < numTileColumns * channels && !bChanged; i++)
+        {
+            bChanged = tileRow[i] > threshold;
+        }
+
+        m_bandChanged[band] = bChanged ? 1 : 0;
+        numChangedBands += bChanged ? 1 : 0;
+    }
+
+    if (numChangedBands > STEREO_CHANGE_DETECTION_MAX_CHANGED_FRACTION * numBands)
+    {
+        m_bandChanged.assign(numBands, 1);
+        return false;
+    }
+
+    m_recomputedFraction = (float)numChangedBands / numBands;
+    return true;
+}
+
+
+// Keeps the results of the current frame for reuse, along with the rectified inputs of the recomputed bands to compare later frames to.
+void DepthReconstruction::StoreChangeCache(const StereoInputFrame& inputFrame, const StereoDisparityFrame& outputFrame, const cv::Mat& disparityLeft, const cv::Mat& disparityRight, const bool bPartial)
+{
+    const StereoFrameParams& params = inputFrame.Params;
+    bool bComputeRight = params.bDisparityBothEyes || params.StereoConfig.StereoFilteringWLS_Enable;
+
+    disparityLeft.copyTo(m_cachedDisparityLeft);
+
+    if (bComputeRight)
+    {
+        disparityRight.copyTo(m_cachedDisparityRight);
+    }
+
+    if (params.StereoConfig.StereoFilteringWLS_Enable)
+    {
+        outputFrame.DisparityLeft.copyTo(m_cachedOutputLeft);
+        outputFrame.ConfidenceLeft.copyTo(m_cachedConfidenceLeft);
+
+        if (params.bDisparityBothEyes)
+        {
+            outputFrame.DisparityRight.copyTo(m_cachedOutputRight);
+            outputFrame.ConfidenceRight.copyTo(m_cachedConfidenceRight);
+        }
+    }
+
+    if (!bPartial)
+    {
+        inputFrame.ExtFrameLeft.copyTo(m_changeReferenceLeft);
+        inputFrame.ExtFrameRight.copyTo(m_changeReferenceRight);
+        m_changeReferenceViewToWorld = params.ViewToWorldLeft;
+        m_changeReferenceMatcherParams = m_matcherParams;
+        m_bHasChangeReference = true;
+        return;
+    }
+
+    for (const StereoDisparityBand& band : m_disparityBands)
+    {
+        if (band.bReuse) { continue; }
+
+        inputFrame.ExtFrameLeft.rowRange(band.StartRow, band.EndRow).copyTo(m_changeReferenceLeft.rowRange(band.StartRow, band.EndRow));
+        inputFrame.ExtFrameRight.rowRange(band.StartRow, band.EndRow).copyTo(m_changeReferenceRight.rowRange(band.StartRow, band.EndRow));
+    }
+}
+
+
+// Passes on the cached result when nothing has changed since it was computed.
+void DepthReconstruction::ReuseCachedOutput(StereoDisparityFrame& outputFrame)
+{
+    // Without filtering, the raw matcher output is the result.
+    if (!m_matcherParams.bWLSEnable)
+    {
+        m_cachedDisparityLeft.copyTo(outputFrame.DisparityLeft);
+
+        if (m_matcherParams.bDisparityBothEyes)
+        {
+            m_cachedDisparityRight.copyTo(outputFrame.DisparityRight);
+        }
+        return;
+    }
+
+    m_cachedOutputLeft.copyTo(outputFrame.DisparityLeft);
+    m_cachedConfidenceLeft.copyTo(outputFrame.ConfidenceLeft);
+
+    if (m_matcherParams.bDisparityBothEyes)
+    {
+        m_cachedOutputRight.copyTo(outputFrame.DisparityRight);
+        m_cachedConfidenceRight.copyTo(outputFrame.ConfidenceRight);
+    }
+}
+
+
+// Fraction of the full disparity range the current bands search, averaged over the rows.
+void DepthReconstruction::UpdateDisparitySearchFraction(const StereoFrameParams& params)
+{
+    int numDisparities = params.MaxDisparity - params.StereoConfig.StereoMinDisparity;
+    uint64_t searchedRows = 0;
+
+    for (const StereoDisparityBand& band : m_disparityBands)
+    {
+        if (band.bReuse) { continue; }
+
+        searchedRows += (uint64_t)band.NumDisparities * (band.EndRow - band.StartRow);
+    }
+
+    m_disparitySearchFraction = (float)searchedRows / ((float)numDisparities * params.ImageHeight);
+}
+
+
+// Matches each band of rows with its own disparity range. The matcher is given extra rows around the band,
+// so that the block matching and path aggregation have context at the band edges.
+// For the right eye, the band ranges are mirrored around the range of the full right eye matcher.
+void DepthReconstruction::MatchDisparityBands(cv::StereoSGBM& matcher, const cv::Mat& frameLeft, const cv::Mat& frameRight, cv::Mat& outDisparity, cv::Mat& bandDisparity, const cv::Mat& cachedDisparity, const int eyeMinDisparity, const int maxDisparity, const bool bRightEye)
+{
+    outDisparity.create(frameLeft.size(), CV_16S);
+
+    int overlap = STEREO_COARSE_TO_FINE_BAND_OVERLAP + matcher.getBlockSize() / 2;
+
+    // The matcher marks invalid pixels with one below its minimum, which needs to be consistent over the whole map.
+    int16_t invalidValue = (int16_t)((eyeMinDisparity - 1) * 16);
+
+    for (const StereoDisparityBand& band : m_disparityBands)
+    {
+        if (band.bReuse)
+        {
+            cachedDisparity.rowRange(band.StartRow, band.EndRow).copyTo(outDisparity.rowRange(band.StartRow, band.EndRow));
+            continue;
+        }
+
+        int bandMinDisparity = bRightEye ? eyeMinDisparity + maxDisparity - (band.MinDisparity + band.NumDisparities) : band.MinDisparity;
+
+        matcher.setMinDisparity(bandMinDisparity);
+        matcher.setNumDisparities(band.NumDisparities);
+
+        int startRow = max(band.StartRow - overlap, 0);
+        int endRow = min(band.EndRow + overlap, frameLeft.rows);
+        cv::Rect computeRect(0, startRow, frameLeft.cols, endRow - startRow);
+
+        matcher.compute(frameLeft(computeRect), frameRight(computeRect), bandDisparity);
+
+        cv::Mat outRows = outDisparity.rowRange(band.StartRow, band.EndRow);
+        bandDisparity.rowRange(band.StartRow - startRow, band.EndRow - startRow).copyTo(outRows);
+
+        if (bandMinDisparity != eyeMinDisparity)
+        {
+            outRows.setTo(invalidValue, outRows < bandMinDisparity * 16);
+        }
+    }
+}
+
+
+// Output stage: Packs the disparity and confidence maps and uploads them to the async renderer.
+void DepthReconstruction::RunOutputThread()
+{
+    while (m_bRunThread)
+    {
+        // Report once the last frame of the preset has been handled, even if it was dropped along the way.
+        if (m_bBenchmarkReportEnded)
+        {
+            LogBenchmarkResults();
+            m_benchmarkReportPreset = -1;
+            m_bBenchmarkReportEnded = false;
+        }
+
+        StereoDisparityFrame* disparityFrame = m_disparityQueue.BeginRead(STEREO_PIPELINE_WAIT_TIMEOUT);
+        if (!disparityFrame)
+        {
+            continue;
+        }
+
+        uint64_t outputStartTime = m_outputStageTimer.StartPerfTimer();
+
+        const StereoFrameParams& params = disparityFrame->Params;
+
+        // Also reports the previous preset if its last frame never got here.
+        if (params.BenchmarkPreset != m_benchmarkReportPreset)
+        {
+            if (m_benchmarkReportPreset >= 0)
+            {
+                LogBenchmarkResults();
+            }
+
+            m_benchmarkReportPreset = params.BenchmarkPreset;
+        }
+
+        m_bBenchmarkReportEnded = params.BenchmarkPreset >= 0 && params.bBenchmarkPresetEnd;
+
+        const Config_Stereo& stereoConfig = params.StereoConfig;
+        ESelectedDebugTexture debugTexture = m_configManager->GetConfig_Main().DebugTexture;
+
+        uint32_t imageWidth = params.ImageWidth;
+        uint32_t imageHeight = params.ImageHeight;
+        int numDisparities = params.MaxDisparity - stereoConfig.StereoMinDisparity;
+
+        cv::Mat* outputMatrixLeft = &disparityFrame->DisparityLeft;
+        cv::Mat* outputMatrixRight = params.bDisparityBothEyes ? &disparityFrame->DisparityRight : &disparityFrame->DisparityLeft;
+
+        cv::Mat* outputConfMatrixLeft = &disparityFrame->ConfidenceLeft;
+        cv::Mat* outputConfMatrixRight = params.bDisparityBothEyes ? &disparityFrame->ConfidenceRight : &disparityFrame->ConfidenceLeft;
+
+        {
+            FramePtr<DepthFrame> frame = m_depthFrameQueue.AcquireWrite();
+
+            if (!frame.HasFrame())
+            {
+                g_logger->warn("Depth reconstruction frame underrun!");
+                m_disparityQueue.EndRead();
+                continue;
+            }
+
+            if (frame->DisparityTextureIndex < 0)
+            {
+                frame->DisparityTextureIndex = m_depthFrameIndex++;
+            }
+
+            XrMatrix4x4f rectifiedRotationInvLeft;
+            XrMatrix4x4f_Transpose(&rectifiedRotationInvLeft, &params.RectifiedRotationLeft);
+            XrMatrix4x4f_Multiply(&frame->DisparityViewToWorldLeft, &params.ViewToWorldLeft, &rectifiedRotationInvLeft);
+
+            if (params.bDisparityBothEyes)
+            {
+                XrMatrix4x4f rectifiedRotationInvRight;
+                XrMatrix4x4f_Transpose(&rectifiedRotationInvRight, &params.RectifiedRotationRight);
+                XrMatrix4x4f_Multiply(&frame->DisparityViewToWorldRight, &params.ViewToWorldRight, &rectifiedRotationInvRight);
+            }
+            else
+            {
+                frame->DisparityViewToWorldRight = frame->DisparityViewToWorldLeft;
+            }
+
+            int outputScale = stereoConfig.StereoFilteringBilateral_Enable ? stereoConfig.StereoFilteringBilateral_OutputScale : 1;
+
+
+            // Precompute disparity-to-depth scaling factors for the shader inputs.
+            frame->DisparityToDepth = params.DisparityToDepth;
+            frame->DisparityToDepth.m[0] *= (float)imageWidth;
+            frame->DisparityToDepth.m[5] *= -(float)imageHeight;
+            frame->DisparityToDepth.m[12] /= (float)params.DownscaleFactor;
+            frame->DisparityToDepth.m[13] /= -(float)params.DownscaleFactor;
+            frame->DisparityToDepth.m[14] /= -(float)params.DownscaleFactor;
+            // Convert z to int16 range with 4 bit fixed decimal: 65536 / 2 / 16 = 2048
+            frame->DisparityToDepth.m[11] *= 2048.0f;
+
+            frame->InputDisparityTextureSize = { imageWidth * 2, imageHeight };
+            frame->OutputDisparityTextureSize =
+                { imageWidth * 2 * outputScale, imageHeight * outputScale };
+            frame->CameraFrameTextureSize = { params.CameraFrameWidth * 2, params.CameraFrameHeight };
+            frame->DisparityDownscaleFactor = (float)params.DownscaleFactor / outputScale;
+            frame->FrameSequence = (frame->FrameSequence + 1) % 16;
+            frame->FrameExposureTimestamp = params.FrameTimestamp;
+
+            // Truncate valid range to deal with fixed point fractions
+            frame->MinDisparity = (stereoConfig.StereoMinDisparity + 4) / 2048.0f;
+            frame->MaxDisparity = (params.MaxDisparity - 4) / 2048.0f;
+            frame->bIsValid = true;
+
+
+            // The async renderer is null when the reconstruction is driven by a standalone host without a runtime.
+            if (m_asyncRenderer.get() && !m_asyncRenderer->BeginRender(frame.GetSharedPointer(), stereoConfig))
+            {
+                m_disparityQueue.EndRead();
+                continue;
+            }
+
+            // Write disparity and confidence to texture
+
+            cv::Rect copySrcRegion = cv::Rect(numDisparities, 0, imageWidth, imageHeight);
+
+            m_outputDisparityBuffer.resize(imageHeight * 2 * imageWidth * 2);
+
+            m_outputDisparity = cv::Mat(imageHeight, imageWidth * 2, CV_16S, m_outputDisparityBuffer.data());
+
+            m_outputDisparityLeft = m_outputDisparity(cv::Rect(0, 0, imageWidth, imageHeight));
+            m_outputDisparityRight = m_outputDisparity(cv::Rect(imageWidth, 0, imageWidth, imageHeight));
+
+            (*outputMatrixLeft)(copySrcRegion).copyTo(m_outputDisparityLeft);
+
+            if (params.bDisparityBothEyes)
+            {
+                // Invert right eye disparity
+                (*outputMatrixRight)(copySrcRegion).convertTo(m_outputDisparityRight, CV_16S, -1);
+            }
+            else
+            {
+                (*outputMatrixRight)(copySrcRegion).copyTo(m_outputDisparityRight);
+            }
+
+            if (m_asyncRenderer.get())
+            {
+                m_asyncRenderer->CopyDisparityToGPU(m_outputDisparityBuffer);
+            }
+
+            m_outputConfidenceBuffer.resize(imageHeight * 2 * imageWidth * 2);
+
+            m_outputConfidence = cv::Mat(imageHeight, imageWidth * 2, CV_16S, m_outputConfidenceBuffer.data());
+
+            m_outputConfidenceLeft = m_outputConfidence(cv::Rect(0, 0, imageWidth, imageHeight));
+            m_outputConfidenceRight = m_outputConfidence(cv::Rect(imageWidth, 0, imageWidth, imageHeight));
+
+            if (disparityFrame->bHasConfidence)
+            {
+                float confFactor = 32768.0f / 255.0f;
+
+                if ((uint32_t)outputConfMatrixLeft->size().width >= imageWidth + numDisparities)
+                {
+                    (*outputConfMatrixLeft)(copySrcRegion).convertTo(m_outputConfidenceLeft, CV_16S, confFactor);
+
+                    if (!params.bDisparityBothEyes)
+                    {
+                        (*outputConfMatrixLeft)(copySrcRegion).convertTo(m_outputConfidenceRight, CV_16S, confFactor);
+                    }
                 }
                 else
                 {
-                    m_outputConfidenceLeft = cv::Mat::zeros(m_cvImageHeight, m_cvImageWidth, CV_16S);
+                    m_outputConfidenceLeft = cv::Mat::zeros(imageHeight, imageWidth, CV_16S);
 
-                    if (!m_bDisparityBothEyes)
+                    if (!params.bDisparityBothEyes)
                     {
-                        m_outputConfidenceRight = cv::Mat::zeros(m_cvImageHeight, m_cvImageWidth, CV_16S);
+                        m_outputConfidenceRight = cv::Mat::zeros(imageHeight, imageWidth, CV_16S);
                     }
                 }
 
-                if (m_bDisparityBothEyes)
+                if (params.bDisparityBothEyes)
                 {
-                    if ((uint32_t)(*outputConfMatrixRight).size().width >= m_cvImageWidth + numDisparities)
+                    if ((uint32_t)(*outputConfMatrixRight).size().width >= imageWidth + numDisparities)
                     {
                         (*outputConfMatrixRight)(copySrcRegion).convertTo(m_outputConfidenceRight, CV_16S, confFactor);
                     }
                     else
                     {
-                        m_outputConfidenceRight = cv::Mat::zeros(m_cvImageHeight, m_cvImageWidth, CV_16S);
+                        m_outputConfidenceRight = cv::Mat::zeros(imageHeight, imageWidth, CV_16S);
                     }
                 }
             }
             else
             {
-                m_outputConfidenceLeft = cv::Mat::zeros(m_cvImageHeight, m_cvImageWidth, CV_16S);
-                m_outputConfidenceRight = cv::Mat::zeros(m_cvImageHeight, m_cvImageWidth, CV_16S);
+                m_outputConfidenceLeft = cv::Mat::zeros(imageHeight, imageWidth, CV_16S);
+                m_outputConfidenceRight = cv::Mat::zeros(imageHeight, imageWidth, CV_16S);
             }
 
-            m_asyncRenderer->CopyConfidenceToGPU(m_outputConfidenceBuffer);
-
-            // Copy rectified camera frame associated with disparity
-            if(stereoConfig.StereoFilteringBilateral_Enable)
+            if (m_asyncRenderer.get())
             {
-                m_outputCameraFrameBuffer.resize(m_cameraFrameWidth * 2 * m_cameraFrameHeight);
+                m_asyncRenderer->CopyConfidenceToGPU(m_outputConfidenceBuffer);
 
-                m_outputCameraFrame = cv::Mat(m_cameraFrameHeight, m_cameraFrameWidth * 2, CV_8U, m_outputCameraFrameBuffer.data());
-
-                m_outputCameraFrameLeft = m_outputCameraFrame(cv::Rect(0, 0, m_cameraFrameWidth, m_cameraFrameHeight));
-                m_outputCameraFrameRight = m_outputCameraFrame(cv::Rect(m_cameraFrameWidth, 0, m_cameraFrameWidth, m_cameraFrameHeight));
-
-                if (m_bUseColor)
+                if (stereoConfig.StereoFilteringBilateral_Enable &&
+                    disparityFrame->CameraFrameBuffer.size() == params.CameraFrameWidth * 2 * params.CameraFrameHeight)
                 {
-                    cv::cvtColor(m_rectifiedFrameLeft, m_outputCameraFrameLeft, cv::COLOR_RGB2GRAY);
-                    cv::cvtColor(m_rectifiedFrameRight, m_outputCameraFrameRight, cv::COLOR_RGB2GRAY);
-                }
-                else
-                {
-                    m_rectifiedFrameLeft.copyTo(m_outputCameraFrameLeft);
-                    m_rectifiedFrameRight.copyTo(m_outputCameraFrameRight);
+                    m_asyncRenderer->CopyBWRectifiedCameraFrameToGPU(disparityFrame->CameraFrameBuffer);
                 }
 
-                m_asyncRenderer->CopyBWRectifiedCameraFrameToGPU(m_outputCameraFrameBuffer);
+                m_asyncRenderer->Render(frame.GetSharedPointer(), stereoConfig);
             }
 
-            m_asyncRenderer->Render(frame.GetSharedPointer(), stereoConfig);
-
             frame.CommitWrite();
         }
 
-        if (mainConfig.DebugTexture != DebugTexture_None)
+        if (debugTexture != DebugTexture_None)
         {
             DebugTexture& texture = m_configManager->GetDebugTexture();
             std::lock_guard<std::mutex> writelock(texture.RWMutex);
 
-            if (mainConfig.DebugTexture == DebugTexture_Disparity)
+            if (debugTexture == DebugTexture_Disparity)
             {
                 if (texture.CurrentTexture != DebugTexture_Disparity)
                 {
                     texture.Texture = std::vector<uint8_t>();
-                    texture.Texture.resize(m_cvImageWidth * 2 * m_cvImageHeight * sizeof(uint16_t));
+                    texture.Texture.resize(imageWidth * 2 * imageHeight * sizeof(uint16_t));
                 }
-                cv::Mat debugTextureMat(m_cvImageHeight, m_cvImageWidth * 2, CV_16S, texture.Texture.data());
+                cv::Mat debugTextureMat(imageHeight, imageWidth * 2, CV_16S, texture.Texture.data());
 
-                cv::Mat left = debugTextureMat(cv::Rect(0, 0, m_cvImageWidth, m_cvImageHeight));
-                cv::Mat right = debugTextureMat(cv::Rect(m_cvImageWidth, 0, m_cvImageWidth, m_cvImageHeight));
+                cv::Mat left = debugTextureMat(cv::Rect(0, 0, imageWidth, imageHeight));
+                cv::Mat right = debugTextureMat(cv::Rect(imageWidth, 0, imageWidth, imageHeight));
 
-                (*outputMatrixLeft)(cv::Rect(numDisparities, 0, m_cvImageWidth, m_cvImageHeight)).convertTo(left, CV_16S);
+                (*outputMatrixLeft)(cv::Rect(numDisparities, 0, imageWidth, imageHeight)).convertTo(left, CV_16S);
 
                 cv::Mat rightFlip;
-                (*outputMatrixRight)(cv::Rect(numDisparities, 0, m_cvImageWidth, m_cvImageHeight)).copyTo(rightFlip);
+                (*outputMatrixRight)(cv::Rect(numDisparities, 0, imageWidth, imageHeight)).copyTo(rightFlip);
 
                 rightFlip.convertTo(right, CV_16S);
 
                 debugTextureMat *= 8;
 
-                if (texture.TextureSize.width != m_cvImageWidth || texture.TextureSize.height != m_cvImageHeight)
+                if (texture.TextureSize.width != imageWidth || texture.TextureSize.height != imageHeight)
                 {
                     texture.bDimensionsUpdated = true;
                 }
 
-                texture.TextureSize.width = m_cvImageWidth * 2;
-                texture.TextureSize.height = m_cvImageHeight;
+                texture.TextureSize.width = imageWidth * 2;
+                texture.TextureSize.height = imageHeight;
                 texture.PixelSize = sizeof(uint16_t);
                 texture.Format = DebugTextureFormat_R16S;
                 texture.CurrentTexture = DebugTexture_Disparity;
 
             }
-            else if (mainConfig.DebugTexture == DebugTexture_Confidence)
+            else if (debugTexture == DebugTexture_Confidence)
             {
                 if (texture.CurrentTexture != DebugTexture_Confidence)
                 {
                     texture.Texture = std::vector<uint8_t>();
-                    texture.Texture.resize(m_cvImageWidth * 2 * m_cvImageHeight * sizeof(uint16_t));
+                    texture.Texture.resize(imageWidth * 2 * imageHeight * sizeof(uint16_t));
                 }
-                cv::Mat debugTextureMat(m_cvImageHeight, m_cvImageWidth * 2, CV_8U, texture.Texture.data());
+                cv::Mat debugTextureMat(imageHeight, imageWidth * 2, CV_8U, texture.Texture.data());
 
-                cv::Mat left = debugTextureMat(cv::Rect(0, 0, m_cvImageWidth, m_cvImageHeight));
-                cv::Mat right = debugTextureMat(cv::Rect(m_cvImageWidth, 0, m_cvImageWidth, m_cvImageHeight));
+                cv::Mat left = debugTextureMat(cv::Rect(0, 0, imageWidth, imageHeight));
+                cv::Mat right = debugTextureMat(cv::Rect(imageWidth, 0, imageWidth, imageHeight));
 
-                if (stereoConfig.StereoFilteringWLS_Enable)
+                if (disparityFrame->bHasConfidence)
                 {
-                    m_confidenceLeft = m_wlsFilterLeft->getConfidenceMap();
-                    if (m_bDisparityBothEyes)
+                    if ((uint32_t)outputConfMatrixLeft->size().width >= imageWidth + numDisparities)
                     {
-                        m_confidenceRight = m_wlsFilterRight->getConfidenceMap();
+                        (*outputConfMatrixLeft)(cv::Rect(numDisparities, 0, imageWidth, imageHeight)).convertTo(left, CV_8U);
                     }
-                    else
+                    if ((uint32_t)outputConfMatrixRight->size().width >= imageWidth + numDisparities)
                     {
-                        m_confidenceRight = m_wlsFilterLeft->getConfidenceMap();
+                        (*outputConfMatrixRight)(cv::Rect(numDisparities, 0, imageWidth, imageHeight)).convertTo(right, CV_8U);
                     }
                 }
 
-                if ((uint32_t)m_confidenceLeft.size().width >= m_cvImageWidth + numDisparities)
-                {
-                    m_confidenceLeft(cv::Rect(numDisparities, 0, m_cvImageWidth, m_cvImageHeight)).convertTo(left, CV_8U);
-                }
-                if ((uint32_t)m_confidenceRight.size().width >= m_cvImageWidth + numDisparities)
-                {
-                    m_confidenceRight(cv::Rect(numDisparities, 0, m_cvImageWidth, m_cvImageHeight)).convertTo(right, CV_8U);
-                }
-
-                if (texture.TextureSize.width != m_cvImageWidth || texture.TextureSize.height != m_cvImageHeight)
+                if (texture.TextureSize.width != imageWidth || texture.TextureSize.height != imageHeight)
                 {
                     texture.bDimensionsUpdated = true;
                 }
 
-                texture.TextureSize.width = m_cvImageWidth * 2;
-                texture.TextureSize.height = m_cvImageHeight;
+                texture.TextureSize.width = imageWidth * 2;
+                texture.TextureSize.height = imageHeight;
                 texture.PixelSize = sizeof(uint8_t);
                 texture.Format = DebugTextureFormat_R8;
                 texture.CurrentTexture = DebugTexture_Confidence;
 
             }
         }
-        
-        m_renderTimer.EndPerfTimer();
+
+        float badPixelRate = -1.0f;
+
+        if (disparityFrame->bHasGroundTruth)
+        {
+            float invalidPixelRate;
+            EvaluateGroundTruth(*outputMatrixLeft, disparityFrame->GroundTruthDisparity, stereoConfig, params.MaxDisparity, badPixelRate, invalidPixelRate);
+
+            // Smooth the displayed values, the per frame rates are noisy.
+            m_badPixelRate = m_bHasGroundTruth ? m_badPixelRate * 0.9f + badPixelRate * 0.1f : badPixelRate;
+            m_invalidPixelRate = m_bHasGroundTruth ? m_invalidPixelRate * 0.9f + invalidPixelRate * 0.1f : invalidPixelRate;
+        }
+        m_bHasGroundTruth = disparityFrame->bHasGroundTruth;
+
+        if (params.bBenchmarkMeasured)
+        {
+            RecordBenchmarkFrame(params, outputStartTime, badPixelRate);
+        }
+
+        if (params.BenchmarkPreset < 0)
+        {
+            UpdateGovernor(params);
+        }
+
+        m_disparityQueue.EndRead();
+
+        m_outputStageTimer.EndPerfTimer();
+    }
+}
+
+
+// Converts the rectified ground truth points to left eye disparity at the matcher resolution, with -1 where there is no ground truth.
+void DepthReconstruction::ComputeGroundTruthDisparity(cv::Mat& outDisparity)
+{
+    outDisparity.create(m_cvImageHeight, m_cvImageWidth, CV_32F);
+
+    for (uint32_t y = 0; y < m_cvImageHeight; y++)
+    {
+        const cv::Vec3f* pointRow = m_groundTruthPoints.ptr<cv::Vec3f>(y);
+        float* outRow = outDisparity.ptr<float>(y);
+
+        for (uint32_t x = 0; x < m_cvImageWidth; x++)
+        {
+            const cv::Vec3f& point = pointRow[x];
+            float depth = m_rectifiedDepthAxis[0] * point[0] + m_rectifiedDepthAxis[1] * point[1] + m_rectifiedDepthAxis[2] * point[2];
+
+            outRow[x] = (point[2] > 0.0f && depth > 0.0f) ? m_disparityDepthScale / depth : -1.0f;
+        }
+    }
+}
+
+
+// Compares the fixed point left eye disparity to the ground truth. Only pixels with the ground truth in the matched range are counted.
+// Pixels the matcher left invalid count as bad, and are also reported separately.
+void DepthReconstruction::EvaluateGroundTruth(const cv::Mat& disparity, const cv::Mat& groundTruth, const Config_Stereo& stereoConfig, const int maxDisparity, float& outBadRate, float& outInvalidRate)
+{
+    int numDisparities = maxDisparity - stereoConfig.StereoMinDisparity;
+    float minDisparity = (float)stereoConfig.StereoMinDisparity;
+    int invalidValue = stereoConfig.StereoMinDisparity * 16;
+
+    uint32_t numValid = 0;
+    uint32_t numBad = 0;
+    uint32_t numInvalid = 0;
+
+    for (int y = 0; y < groundTruth.rows; y++)
+    {
+        const float* truthRow = groundTruth.ptr<float>(y);
+        const int16_t* disparityRow = disparity.ptr<int16_t>(y) + numDisparities;
+
+        for (int x = 0; x < groundTruth.cols; x++)
+        {
+            float truth = truthRow[x];
+            if (truth < minDisparity || truth >= (float)maxDisparity) { continue; }
+
+            numValid++;
+
+            if (disparityRow[x] < invalidValue)
+            {
+                numInvalid++;
+                numBad++;
+            }
+            else if (fabsf(disparityRow[x] / 16.0f - truth) > STEREO_GROUND_TRUTH_BAD_PIXEL_THRESHOLD)
+            {
+                numBad++;
+            }
+        }
+    }
+
+    outBadRate = numValid > 0 ? (float)numBad / numValid : 0.0f;
+    outInvalidRate = numValid > 0 ? (float)numInvalid / numValid : 0.0f;
+}
+
+
+void DepthReconstruction::ApplyGovernorLevel(Config_Stereo& stereoConfig, const int level)
+{
+    const StereoGovernorLevel& reductions = g_stereoGovernorLevels[std::clamp(level, 0, STEREO_GOVERNOR_NUM_LEVELS - 1)];
+
+    // The disparity range stays a multiple of 16, and is never raised by the governor.
+    int minMaxDisparity = min(stereoConfig.StereoMaxDisparity, STEREO_GOVERNOR_MIN_MAX_DISPARITY);
+    stereoConfig.StereoMaxDisparity = max(stereoConfig.StereoMaxDisparity - reductions.MaxDisparityReduction, minMaxDisparity);
+
+    if (reductions.bDisableWLS)
+    {
+        stereoConfig.StereoFilteringWLS_Enable = false;
     }
+
+    stereoConfig.StereoDownscaleFactor = min(stereoConfig.StereoDownscaleFactor + reductions.DownscaleIncrease, 16);
+    stereoConfig.StereoFrameSkip += reductions.FrameSkipIncrease;
 }
 
+
+// Steps the governor level based on the average CPU time of the input and matching stages per camera frame.
+// The time is spread over the skipped frames, so that the frame skipping levels lower the measured cost as well.
+// The level is lowered right away when over the target, but only raised when there is clear headroom.
+// If raising the quality immediately goes over the target again, the next attempt waits twice as long.
+void DepthReconstruction::UpdateGovernor(const StereoFrameParams& params)
+{
+    const Config_Main& mainConfig = m_configManager->GetConfig_Main();
+
+    if (!mainConfig.StereoGovernor_Enable)
+    {
+        if (m_bGovernorActive)
+        {
+            m_governorLevel = 0;
+            m_governorTimeSum = 0.0f;
+            m_governorFrameCount = 0;
+            m_governorWindowsAtLevel = 0;
+            m_governorBackoff = 1;
+            m_bGovernorJustRaised = false;
+            m_bGovernorActive = false;
+        }
+        return;
+    }
+
+    m_bGovernorActive = true;
+
+    // Frames still in flight from before a level change don't tell anything about the current level.
+    if (params.GovernorLevel != m_governorLevel) { return; }
+
+    float frameTimeMS = params.StageTimesMS[StereoBenchmarkStage_Convert] + params.StageTimesMS[StereoBenchmarkStage_Rectify] +
+        params.StageTimesMS[StereoBenchmarkStage_Match] + params.StageTimesMS[StereoBenchmarkStage_Filter];
+
+    m_governorTimeSum += frameTimeMS / (params.StereoConfig.StereoFrameSkip + 1);
+
+    if (++m_governorFrameCount < STEREO_GOVERNOR_WINDOW_FRAMES) { return; }
+
+    float averageMS = m_governorTimeSum / m_governorFrameCount;
+    m_governorAverageMS = averageMS;
+    m_governorTimeSum = 0.0f;
+    m_governorFrameCount = 0;
+
+    float targetMS = mainConfig.StereoGovernor_TargetMS;
+    int level = m_governorLevel;
+
+    if (averageMS > targetMS && level < STEREO_GOVERNOR_NUM_LEVELS - 1)
+    {
+        if (m_bGovernorJustRaised)
+        {
+            m_governorBackoff = min(m_governorBackoff * 2, (uint32_t)STEREO_GOVERNOR_MAX_BACKOFF);
+        }
+
+        m_governorLevel = level + 1;
+        m_governorWindowsAtLevel = 0;
+        m_bGovernorJustRaised = false;
+
+        g_logger->info("Stereo governor: {:.2f}ms average over {:.2f}ms target, lowering quality to level {}", averageMS, targetMS, level + 1);
+    }
+    else if (averageMS < targetMS * STEREO_GOVERNOR_RAISE_THRESHOLD && level > 0 && ++m_governorWindowsAtLevel >= m_governorBackoff)
+    {
+        m_governorLevel = level - 1;
+        m_governorWindowsAtLevel = 0;
+        m_bGovernorJustRaised = true;
+
+        g_logger->info("Stereo governor: {:.2f}ms average, raising quality to level {}", averageMS, level - 1);
+    }
+    else if (m_bGovernorJustRaised && averageMS <= targetMS)
+    {
+        // The raised level held, so the next attempt doesn't need to wait as long.
+        m_governorBackoff = max(m_governorBackoff / 2, 1u);
+        m_bGovernorJustRaised = false;
+    }
+}
+
+
+void DepthReconstruction::RecordBenchmarkFrame(const StereoFrameParams& params, const uint64_t outputStartTime, const float badPixelRate)
+{
+    uint64_t currentTime = GetCurrentTimeSytemTicks();
+
+    if (badPixelRate >= 0.0f)
+    {
+        m_benchmarkBadPixelSum += badPixelRate;
+        m_benchmarkGroundTruthFrames++;
+    }
+
+    for (int i = StereoBenchmarkStage_Convert; i < StereoBenchmarkStage_Output; i++)
+    {
+        m_benchmarkStageSamples[i].AddSample(params.StageTimesMS[i]);
+    }
+
+    m_benchmarkStageSamples[StereoBenchmarkStage_Output].AddTimeInterval(outputStartTime, currentTime);
+    m_benchmarkStageSamples[StereoBenchmarkStage_Latency].AddTimeInterval(params.InputStartTime, currentTime);
+
+    if (m_benchmarkFirstFrameTime == 0)
+    {
+        m_benchmarkFirstFrameTime = currentTime;
+    }
+    m_benchmarkLastFrameTime = currentTime;
+}
+
+
+void DepthReconstruction::LogBenchmarkResults()
+{
+    static const char* stageNames[StereoBenchmarkStage_Count] = { "Convert", "Rectify", "Match", "WLS", "Output", "Latency" };
+    static const char* presetNames[] = { "Custom", "Very Low", "Low", "Medium", "High", "Very High" };
+
+    size_t numFrames = m_benchmarkStageSamples[StereoBenchmarkStage_Latency].GetNumSamples();
+
+    if (numFrames == 0)
+    {
+        g_logger->warn("Stereo benchmark, preset {}: No frames completed", presetNames[m_benchmarkReportPreset]);
+    }
+    else
+    {
+        // Throughput is limited by the camera frame rate, use a fast synthetic camera to measure the pipeline limit.
+        double elapsedSeconds = GetPerfTimeDiffSeconds(m_benchmarkFirstFrameTime, m_benchmarkLastFrameTime);
+        float throughput = (numFrames > 1 && elapsedSeconds > 0.0) ? (float)((numFrames - 1) / elapsedSeconds) : 0.0f;
+
+        if (m_benchmarkGroundTruthFrames > 0)
+        {
+            float badPixelPercent = (float)(m_benchmarkBadPixelSum / m_benchmarkGroundTruthFrames * 100.0);
+            g_logger->info("Stereo benchmark, preset {}: {} frames, {:.1f} fps, {:.2f}% bad pixels", presetNames[m_benchmarkReportPreset], numFrames, throughput, badPixelPercent);
+        }
+        else
+        {
+            g_logger->info("Stereo benchmark, preset {}: {} frames, {:.1f} fps", presetNames[m_benchmarkReportPreset], numFrames, throughput);
+        }
+
+        for (int i = 0; i < StereoBenchmarkStage_Count; i++)
+        {
+            PerfSampleSet& samples = m_benchmarkStageSamples[i];
+            g_logger->info("    {:<8} p50 {:7.2f} ms, p95 {:7.2f} ms, p99 {:7.2f} ms", stageNames[i], samples.GetPercentileMS(50.0f), samples.GetPercentileMS(95.0f), samples.GetPercentileMS(99.0f));
+        }
+    }
+
+    if (m_benchmarkReportPreset == StereoPreset_VeryHigh)
+    {
+        g_logger->info("Stereo preset benchmark finished");
+        m_benchmarkSweepCount++;
+    }
+
+    for (PerfSampleSet& samples : m_benchmarkStageSamples)
+    {
+        samples.Clear();
+    }
+    m_benchmarkFirstFrameTime = 0;
+    m_benchmarkLastFrameTime = 0;
+    m_benchmarkBadPixelSum = 0.0;
+    m_benchmarkGroundTruthFrames = 0;
+}
+
+
+// Runs the left eye task on the calling thread and the right eye task on the eye worker, and waits for both to finish.
+// An exception from either task is rethrown here once both have finished, the same as when they run one after the other.
+void DepthReconstruction::RunEyeTasks(const std::function<void()>& leftTask, const std::function<void()>& rightTask, bool bConcurrent)
+{
+    if (!bConcurrent)
+    {
+        leftTask();
+        rightTask();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_eyeWorkerMutex);
+        m_eyeWorkerTask = rightTask;
+        m_bEyeWorkerBusy = true;
+    }
+    m_eyeWorkerCondition.notify_all();
+
+    // The right task may reference the caller's locals, so it has to finish before leaving even if the left one throws.
+    std::exception_ptr leftException;
+
+    try
+    {
+        leftTask();
+    }
+    catch (...)
+    {
+        leftException = std::current_exception();
+    }
+
+    std::exception_ptr rightException;
+
+    {
+        std::unique_lock<std::mutex> lock(m_eyeWorkerMutex);
+        m_eyeWorkerCondition.wait(lock, [this] { return !m_bEyeWorkerBusy; });
+
+        rightException = m_eyeWorkerException;
+        m_eyeWorkerException = nullptr;
+    }
+
+    if (leftException)
+    {
+        std::rethrow_exception(leftException);
+    }
+
+    if (rightException)
+    {
+        std::rethrow_exception(rightException);
+    }
+}
+
+
+void DepthReconstruction::RunEyeWorkerThread()
+{
+    while (m_bRunEyeWorker)
+    {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> lock(m_eyeWorkerMutex);
+
+            if (!m_eyeWorkerCondition.wait_for(lock, STEREO_PIPELINE_WAIT_TIMEOUT, [this] { return m_eyeWorkerTask != nullptr; }))
+            {
+                continue;
+            }
+
+            task = std::move(m_eyeWorkerTask);
+            m_eyeWorkerTask = nullptr;
+        }
+
+        std::exception_ptr exception;
+
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            exception = std::current_exception();
+        }
+
+        // Always release the caller, it is waiting on the task.
+        {
+            std::lock_guard<std::mutex> lock(m_eyeWorkerMutex);
+            m_eyeWorkerException = exception;
+            m_bEyeWorkerBusy = false;
+        }
+        m_eyeWorkerCondition.notify_all();
+    }
+}
@@ -6,16 +6,181 @@
 #include "camera_manager.h"
 #include "async_renderer.h"
 #include "perfutil.h"
+#include "pipeline_queue.h"
 
+#include <exception>
+#include <functional>
 #include <opencv2/imgproc/types_c.h>
 #include <opencv2/calib3d.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/ximgproc.hpp>
 
+
+// Parameters the stereo matchers and WLS filters are created from. The matcher objects are only recreated when these change.
+struct StereoMatcherParams
+{
+	uint32_t ImageWidth = 0;
+	uint32_t ImageHeight = 0;
+	int MinDisparity = 0;
+	int MaxDisparity = 0;
+	int BlockSize = 0;
+	EStereoSGBM_Mode Mode = StereoMode_SGBM3Way;
+	int P1 = 0;
+	int P2 = 0;
+	int DispMaxDiff = 0;
+	int PreFilterCap = 0;
+	int UniquenessRatio = 0;
+	int SpeckleWindowSize = 0;
+	int SpeckleRange = 0;
+	bool bDisparityBothEyes = false;
+	bool bWLSEnable = false;
+	float WLSLambda = 0.0f;
+	float WLSSigma = 0.0f;
+	float WLSConfidenceRadius = 0.0f;
+
+	bool operator==(const StereoMatcherParams&) const = default;
+};
+
+
+// Timed stages of the reconstruction, as reported by the preset benchmark.
+enum EStereoBenchmarkStage
+{
+	StereoBenchmarkStage_Convert = 0,
+	StereoBenchmarkStage_Rectify,
+	StereoBenchmarkStage_Match,
+	StereoBenchmarkStage_Filter,
+	StereoBenchmarkStage_Output,
+	StereoBenchmarkStage_Latency,
+	StereoBenchmarkStage_Count
+};
+
+#define STEREO_BENCHMARK_WARMUP_FRAMES 10
+#define STEREO_BENCHMARK_MEASURED_FRAMES 120
+
+// Disparity error in matcher resolution pixels above which a pixel is counted as bad against the ground truth.
+#define STEREO_GROUND_TRUTH_BAD_PIXEL_THRESHOLD 1.0f
+
+// Coarse-to-fine search: rows per band with its own disparity range, extra rows given to the matcher
+// above and below each band for context, and the fraction of valid coarse pixels needed to narrow the range.
+#define STEREO_COARSE_TO_FINE_BAND_HEIGHT 32
+#define STEREO_COARSE_TO_FINE_BAND_OVERLAP 8
+#define STEREO_COARSE_TO_FINE_MIN_VALID_FRACTION 0.25f
+
+// Motion prediction: pixel step when reprojecting the previous disparity, minimum WLS confidence of the
+// reprojected pixels, and number of predicted frames between full range frames.
+#define STEREO_MOTION_PREDICTION_SAMPLE_STEP 4
+#define STEREO_MOTION_PREDICTION_MIN_CONFIDENCE 128.0f
+#define STEREO_MOTION_PREDICTION_REFRESH_INTERVAL 10
+
+// Change detection: tile width for comparing frames, the fraction of changed bands above which everything is
+// recomputed, and the headset motion since the cached result above which everything is recomputed.
+#define STEREO_CHANGE_DETECTION_TILE_WIDTH 32
+#define STEREO_CHANGE_DETECTION_MAX_CHANGED_FRACTION 0.5f
+#define STEREO_CHANGE_DETECTION_MAX_TRANSLATION 0.002f
+#define STEREO_CHANGE_DETECTION_MAX_ROTATION_DEGREES 0.1f
+
+
+// Quality reductions the governor applies on top of the selected settings at a given level.
+// Each level costs less than the previous one. Per frame reductions come first, frame skipping is the last resort.
+struct StereoGovernorLevel
+{
+	int MaxDisparityReduction;
+	bool bDisableWLS;
+	int DownscaleIncrease;
+	int FrameSkipIncrease;
+};
+
+#define STEREO_GOVERNOR_NUM_LEVELS 8
+#define STEREO_GOVERNOR_MIN_MAX_DISPARITY 32
+
+// Governor decisions are made on the average of this many frames processed at the current level.
+#define STEREO_GOVERNOR_WINDOW_FRAMES 30
+
+// The quality is only raised if the average time is below this fraction of the target.
+#define STEREO_GOVERNOR_RAISE_THRESHOLD 0.7f
+
+// Maximum number of windows to wait before trying a level that didn't fit again.
+#define STEREO_GOVERNOR_MAX_BACKOFF 16
+
+
+// Disparity range for a band of rows in the left eye, as found by the coarse-to-fine search.
+// Bands marked for reuse are copied from the cached result of an earlier frame instead.
+struct StereoDisparityBand
+{
+	int StartRow;
+	int EndRow;
+	int MinDisparity;
+	int NumDisparities;
+	bool bReuse;
+};
+
+
+// Settings and geometry a camera frame was processed with. Carried along with the frame through
+// the pipeline stages, so that reinitializing the input stage does not affect frames in flight.
+struct StereoFrameParams
+{
+	Config_Stereo StereoConfig;
+	uint32_t ImageWidth = 0;
+	uint32_t ImageHeight = 0;
+	uint32_t CameraFrameWidth = 0;
+	uint32_t CameraFrameHeight = 0;
+	uint32_t DownscaleFactor = 1;
+	int MaxDisparity = 0;
+	bool bDisparityBothEyes = false;
+	uint64_t FrameTimestamp = 0;
+	XrMatrix4x4f ViewToWorldLeft{};
+	XrMatrix4x4f ViewToWorldRight{};
+	XrMatrix4x4f DisparityToDepth{};
+	XrMatrix4x4f RectifiedRotationLeft{};
+	XrMatrix4x4f RectifiedRotationRight{};
+	XrVector2f RectifiedFocalLength{};
+	XrVector2f RectifiedCenter{};
+	float DisparityDepthScale = 0.0f;
+
+	int GovernorLevel = 0;
+
+	// Preset the frame was benchmarked with, or -1. Warmup frames after a preset change are not measured.
+	int BenchmarkPreset = -1;
+	bool bBenchmarkMeasured = false;
+	// Set on the last frame of a preset, so that the results get reported without waiting for a later frame.
+	bool bBenchmarkPresetEnd = false;
+	uint64_t InputStartTime = 0;
+	float StageTimesMS[StereoBenchmarkStage_Count] = {};
+};
+
+// Rectified and scaled stereo pair, passed from the input stage to the matching stage.
+struct StereoInputFrame
+{
+	StereoFrameParams Params;
+	cv::Mat ExtFrameLeft;
+	cv::Mat ExtFrameRight;
+	std::vector<uint8_t> CameraFrameBuffer;
+	cv::Mat GroundTruthDisparity;
+	bool bHasGroundTruth = false;
+};
+
+// Matching results, passed from the matching stage to the output stage.
+struct StereoDisparityFrame
+{
+	StereoFrameParams Params;
+	cv::Mat DisparityLeft;
+	cv::Mat DisparityRight;
+	cv::Mat ConfidenceLeft;
+	cv::Mat ConfidenceRight;
+	bool bHasConfidence = false;
+	std::vector<uint8_t> CameraFrameBuffer;
+	cv::Mat GroundTruthDisparity;
+	bool bHasGroundTruth = false;
+};
+
+#define STEREO_PIPELINE_QUEUE_SIZE 2
+#define STEREO_PIPELINE_WAIT_TIMEOUT (std::chrono::milliseconds(10))
+
+
 class DepthReconstruction
 {
 public:
-	DepthReconstruction(std::shared_ptr<ConfigManager> configManager, std::shared_ptr<OpenVRManager> openVRManager, std::shared_ptr<ICameraManager> cameraManager, std::shared_ptr<AsyncRenderer> asyncRenderer);
+	DepthReconstruction(std::shared_ptr<ConfigManager> configManager, std::shared_ptr<OpenVRManager> openVRManager, std::shared_ptr<ICameraManager> cameraManager, std::shared_ptr<IAsyncRenderer> asyncRenderer);
 	~DepthReconstruction();
 
 	FramePtr<DepthFrame> GetDepthFrame();
@@ -25,24 +190,81 @@ public:
 	{
 		return m_distortionParams;
 	}
-	float GetReconstructionPerfTime() { return m_reconstructionTimer.GetAverageTimeMS(); }
-	float GetRenderPerfTime() { return m_renderTimer.GetAverageTimeMS(); }
+	float GetReconstructionPerfTime() { return m_inputStageTimer.GetAverageTimeMS() + m_matchingStageTimer.GetAverageTimeMS(); }
+	float GetRenderPerfTime() { return m_outputStageTimer.GetAverageTimeMS(); }
+	float GetInputStagePerfTime() { return m_inputStageTimer.GetAverageTimeMS(); }
+	float GetMatchingStagePerfTime() { return m_matchingStageTimer.GetAverageTimeMS(); }
+	float GetOutputStagePerfTime() { return m_outputStageTimer.GetAverageTimeMS(); }
+	uint32_t GetInputQueueDepth() { return m_inputQueue.GetNumQueued(); }
+	uint32_t GetDisparityQueueDepth() { return m_disparityQueue.GetNumQueued(); }
+	uint32_t GetInputQueueMaxDepth() { return m_inputQueue.GetMaxQueued(); }
+	uint32_t GetDisparityQueueMaxDepth() { return m_disparityQueue.GetMaxQueued(); }
+	float GetInputQueueLatency() { return m_inputQueue.GetAverageLatencyMS(); }
+	float GetDisparityQueueLatency() { return m_disparityQueue.GetAverageLatencyMS(); }
+	uint32_t GetMatcherRebuildCount() { return m_matcherRebuildCount; }
+	float GetInputWakeupRate() { return m_inputWakeupCounter.GetRatePerSecond(); }
+	FrameQueueStats GetDepthFrameQueueStats() const { return m_depthFrameQueue.GetStats(); }
+	bool HasGroundTruth() const { return m_bHasGroundTruth; }
+	float GetBadPixelRate() const { return m_badPixelRate; }
+	float GetInvalidPixelRate() const { return m_invalidPixelRate; }
+	float GetDisparitySearchFraction() const { return m_disparitySearchFraction; }
+	float GetRecomputedFraction() const { return m_recomputedFraction; }
+	bool IsGovernorActive() const { return m_bGovernorActive; }
+	int GetGovernorLevel() const { return m_governorLevel; }
+	float GetGovernorAverageTime() const { return m_governorAverageMS; }
+	// Number of preset benchmark sweeps that have finished and been logged.
+	uint32_t GetBenchmarkSweepCount() const { return m_benchmarkSweepCount; }
 	void CalculateCameraProjection(std::shared_ptr<CameraGPUFrame>& cameraFrame, FrameRenderParameters& renderParams);
 private:
 	void InitReconstruction();
-	void RunThread();
+	void RunInputThread();
+	void RunMatchingThread();
+	void RunOutputThread();
 	void CreateDistortionMap();
+	void CreateScaledRectifyMaps(const cv::Mat& intrinsics, const cv::Mat& distortion, const cv::Mat& R, const cv::Mat& P, cv::Mat& outMap1, cv::Mat& outMap2, cv::Mat& outPrefilterMap1, cv::Mat& outPrefilterMap2);
+	void UpdateStereoMatchers(const StereoFrameParams& frameParams);
+	void RunEyeTasks(const std::function<void()>& leftTask, const std::function<void()>& rightTask, bool bConcurrent);
+	void RunEyeWorkerThread();
+	void ComputeDisparityBands(const StereoInputFrame& frame);
+	bool ComputePredictedDisparityBands(const StereoFrameParams& params);
+	void AddDisparityBand(const StereoFrameParams& params, const int startRow, const int endRow, const bool bHasEstimate, const float estimateMin, const float estimateMax, const int margin);
+	void StorePredictionPrior(const StereoDisparityFrame& frame);
+	void UpdateDisparitySearchFraction(const StereoFrameParams& params);
+	void MatchDisparityBands(cv::StereoSGBM& matcher, const cv::Mat& frameLeft, const cv::Mat& frameRight, cv::Mat& outDisparity, cv::Mat& bandDisparity, const cv::Mat& cachedDisparity, const int eyeMinDisparity, const int maxDisparity, const bool bRightEye);
+	void ComputeFullRangeBands(const StereoFrameParams& params);
+	bool DetectChangedBands(const StereoInputFrame& frame);
+	void StoreChangeCache(const StereoInputFrame& inputFrame, const StereoDisparityFrame& outputFrame, const cv::Mat& disparityLeft, const cv::Mat& disparityRight, const bool bPartial);
+	void ReuseCachedOutput(StereoDisparityFrame& outputFrame);
+	void ComputeGroundTruthDisparity(cv::Mat& outDisparity);
+	void EvaluateGroundTruth(const cv::Mat& disparity, const cv::Mat& groundTruth, const Config_Stereo& stereoConfig, const int maxDisparity, float& outBadRate, float& outInvalidRate);
+	void ApplyGovernorLevel(Config_Stereo& stereoConfig, const int level);
+	void UpdateGovernor(const StereoFrameParams& params);
+	void RecordBenchmarkFrame(const StereoFrameParams& params, const uint64_t outputStartTime, const float badPixelRate);
+	void LogBenchmarkResults();
 
-	std::thread m_thread;
+	std::thread m_inputThread;
+	std::thread m_matchingThread;
+	std::thread m_outputThread;
+
+	// Runs the right eye half of the matching stage concurrently with the left eye.
+	std::thread m_eyeWorkerThread;
+	std::mutex m_eyeWorkerMutex;
+	std::condition_variable m_eyeWorkerCondition;
+	std::function<void()> m_eyeWorkerTask;
+	bool m_bEyeWorkerBusy = false;
+	std::exception_ptr m_eyeWorkerException;
 	std::atomic_bool m_bRunThread;
+	std::atomic_bool m_bRunEyeWorker;
 	std::mutex m_serveMutex;
 
 	std::shared_ptr<ConfigManager> m_configManager;
 	std::shared_ptr<OpenVRManager> m_openVRManager;
 	std::shared_ptr<ICameraManager> m_cameraManager;
-	std::shared_ptr<AsyncRenderer> m_asyncRenderer;
+	std::shared_ptr<IAsyncRenderer> m_asyncRenderer;
 
-	FrameQueue<DepthFrame> m_depthFrameQueue;
+	LockFreeFrameQueue<DepthFrame> m_depthFrameQueue;
+	PipelineQueue<StereoInputFrame> m_inputQueue;
+	PipelineQueue<StereoDisparityFrame> m_disparityQueue;
 	int m_depthFrameIndex = 0;
 	UVDistortionParameters m_distortionParams;
 
@@ -74,7 +296,19 @@ private:
 	cv::Mat m_rightMap1;
 	cv::Mat m_rightMap2;
 
+	cv::Mat m_scaledLeftMap1;
+	cv::Mat m_scaledLeftMap2;
+	cv::Mat m_scaledRightMap1;
+	cv::Mat m_scaledRightMap2;
+	cv::Mat m_prefilterLeftMap1;
+	cv::Mat m_prefilterLeftMap2;
+	cv::Mat m_prefilterRightMap1;
+	cv::Mat m_prefilterRightMap2;
+
 	XrMatrix4x4f m_disparityToDepth;
+	float m_disparityDepthScale = 0.0f;
+	XrVector2f m_rectifiedFocalLength{};
+	XrVector2f m_rectifiedCenter{};
 
 	XrMatrix4x4f m_rectifiedRotationLeft;
 	XrMatrix4x4f m_rectifiedRotationRight;
@@ -88,31 +322,66 @@ private:
 	cv::Ptr<cv::ximgproc::DisparityWLSFilter> m_wlsFilterLeft;
 	cv::Ptr<cv::ximgproc::DisparityWLSFilter> m_wlsFilterRight;
 
+	StereoMatcherParams m_matcherParams;
+	bool m_bMatchersValid = false;
+	std::atomic<uint32_t> m_matcherRebuildCount = 0;
+
+	// Coarse-to-fine search state, only used by the matching stage.
+	cv::Ptr<cv::StereoSGBM> m_coarseMatcher;
+	cv::Ptr<cv::StereoSGBM> m_bandMatcherLeft;
+	cv::Ptr<cv::StereoSGBM> m_bandMatcherRight;
+	cv::Mat m_coarseFrameLeft;
+	cv::Mat m_coarseFrameRight;
+	cv::Mat m_coarseDisparity;
+	cv::Mat m_bandDisparityLeft;
+	cv::Mat m_bandDisparityRight;
+	std::vector<StereoDisparityBand> m_disparityBands;
+	std::atomic<float> m_disparitySearchFraction = 1.0f;
+
+	// Motion prediction state, only used by the matching stage.
+	StereoFrameParams m_predictionPriorParams;
+	cv::Mat m_predictionPriorDisparity;
+	cv::Mat m_predictionPriorConfidence;
+	bool m_bHasPredictionPrior = false;
+	uint32_t m_predictedFrameCount = 0;
+	std::vector<float> m_predictedBandMin;
+	std::vector<float> m_predictedBandMax;
+	std::vector<int> m_predictedBandCount;
+
+	// Change detection state, only used by the matching stage. The reference frames are the rectified inputs the cached results were computed from.
+	StereoMatcherParams m_changeReferenceMatcherParams;
+	XrMatrix4x4f m_changeReferenceViewToWorld;
+	bool m_bHasChangeReference = false;
+	cv::Mat m_changeReferenceLeft;
+	cv::Mat m_changeReferenceRight;
+	cv::Mat m_changeDiffLeft;
+	cv::Mat m_changeDiffRight;
+	cv::Mat m_changeTiles;
+	cv::Mat m_cachedDisparityLeft;
+	cv::Mat m_cachedDisparityRight;
+	cv::Mat m_cachedOutputLeft;
+	cv::Mat m_cachedOutputRight;
+	cv::Mat m_cachedConfidenceLeft;
+	cv::Mat m_cachedConfidenceRight;
+	std::vector<uint8_t> m_bandChanged;
+	std::atomic<float> m_recomputedFraction = 1.0f;
+
 	cv::Mat m_rawInputFrame;
 	cv::Mat m_inputFrame;
-	cv::Mat m_inputFrameRawIntermediate;
 	cv::Mat m_inputFrameLeft;
 	cv::Mat m_inputFrameRight;
+	cv::Mat m_inputFrameGrayLeft;
+	cv::Mat m_inputFrameGrayRight;
 	cv::Mat m_inputAlphaLeft;
 	cv::Mat m_inputAlphaRight;
 
+	cv::Mat m_prefilteredFrameLeft;
+	cv::Mat m_prefilteredFrameRight;
 	cv::Mat m_rectifiedFrameLeft;
 	cv::Mat m_rectifiedFrameRight;
-	cv::Mat m_scaledFrameLeft;
-	cv::Mat m_scaledFrameRight;
-
-	cv::Mat m_scaledExtFrameLeft;
-	cv::Mat m_scaledExtFrameRight;
 
 	cv::Mat m_rawDisparityLeft;
 	cv::Mat m_rawDisparityRight;
-	cv::Mat m_filteredDisparityLeft;
-	cv::Mat m_filteredDisparityRight;
-
-	cv::Mat m_confidenceLeft;
-	cv::Mat m_confidenceRight;
-	cv::Mat m_bilateralDisparityLeft;
-	cv::Mat m_bilateralDisparityRight;
 
 	cv::Mat m_outputDisparity;
 	cv::Mat m_outputDisparityLeft;
@@ -128,10 +397,44 @@ private:
 
 	std::vector<uint8_t> m_outputDisparityBuffer;
 	std::vector<uint8_t> m_outputConfidenceBuffer;
-	std::vector<uint8_t> m_outputCameraFrameBuffer;
 
-	PerfTimer m_reconstructionTimer{ 20 };
-	PerfTimer m_renderTimer{ 20 };
+	PerfTimer m_inputStageTimer{ 20 };
+	PerfTimer m_matchingStageTimer{ 20 };
+	PerfTimer m_outputStageTimer{ 20 };
+	RateCounter m_inputWakeupCounter;
+
+	// Governor level, set by the output stage and applied by the input stage.
+	std::atomic<int> m_governorLevel = 0;
+	std::atomic_bool m_bGovernorActive = false;
+	std::atomic<float> m_governorAverageMS = 0.0f;
+
+	// Governor state, only used by the output stage.
+	float m_governorTimeSum = 0.0f;
+	uint32_t m_governorFrameCount = 0;
+	uint32_t m_governorWindowsAtLevel = 0;
+	uint32_t m_governorBackoff = 1;
+	bool m_bGovernorJustRaised = false;
+
+	// Benchmark state for the input stage.
+	int m_benchmarkPreset = -1;
+	uint32_t m_benchmarkFrameCount = 0;
+
+	// Benchmark results, collected in the output stage.
+	int m_benchmarkReportPreset = -1;
+	bool m_bBenchmarkReportEnded = false;
+	std::atomic<uint32_t> m_benchmarkSweepCount = 0;
+	PerfSampleSet m_benchmarkStageSamples[StereoBenchmarkStage_Count];
+	uint64_t m_benchmarkFirstFrameTime = 0;
+	uint64_t m_benchmarkLastFrameTime = 0;
+	double m_benchmarkBadPixelSum = 0.0;
+	uint32_t m_benchmarkGroundTruthFrames = 0;
+
+	// Ground truth from the synthetic camera, rectified to the matcher resolution.
+	cv::Mat m_groundTruthPoints;
+	float m_rectifiedDepthAxis[3] = { 0.0f, 0.0f, 1.0f };
+	std::atomic_bool m_bHasGroundTruth = false;
+	std::atomic<float> m_badPixelRate = 0.0f;
+	std::atomic<float> m_invalidPixelRate = 0.0f;
 
 	cv::Mat m_colorRectifyInput;
 	cv::Mat m_colorRectifyLeft;
@@ -0,0 +1,379 @@
+#include "pch.h"
+#include "frame_conversion.h"
+
+#include <immintrin.h>
+#include <opencv2/imgproc.hpp>
+
+
+// Limited to full range luma expansion: (y - 16) * 255 / 219, in 8.8 fixed point.
+#define LUMA_RANGE_OFFSET 16
+#define LUMA_RANGE_SCALE 298
+
+
+typedef void (*RowConversionFunc)(const uint8_t* src, uint8_t* dst, int width, bool bExpandRange);
+
+
+static inline uint8_t ExpandLumaRange(uint8_t y)
+{
+	int value = (((int)y - LUMA_RANGE_OFFSET) * LUMA_RANGE_SCALE + 128) >> 8;
+	return (uint8_t)(std::min)((std::max)(value, 0), 255);
+}
+
+static void YUYVToGrayRow_Scalar(const uint8_t* src, uint8_t* dst, int width, bool bExpandRange)
+{
+	for (int x = 0; x < width; x++)
+	{
+		dst[x] = bExpandRange ? ExpandLumaRange(src[x * 2]) : src[x * 2];
+	}
+}
+
+static void LumaToGrayRow_Scalar(const uint8_t* src, uint8_t* dst, int width, bool bExpandRange)
+{
+	if (!bExpandRange)
+	{
+		memcpy(dst, src, width);
+		return;
+	}
+
+	for (int x = 0; x < width; x++)
+	{
+		dst[x] = ExpandLumaRange(src[x]);
+	}
+}
+
+
+// Expands 16-bit luma lanes. The shift and rounding multiply-high give (y - 16) * 298 / 256, saturated at 0.
+static inline __m128i ExpandLumaRange_SSE(__m128i luma)
+{
+	luma = _mm_subs_epu16(luma, _mm_set1_epi16(LUMA_RANGE_OFFSET));
+	luma = _mm_slli_epi16(luma, 7);
+	return _mm_mulhrs_epi16(luma, _mm_set1_epi16(LUMA_RANGE_SCALE));
+}
+
+static void YUYVToGrayRow_SSE(const uint8_t* src, uint8_t* dst, int width, bool bExpandRange)
+{
+	const __m128i lumaMask = _mm_set1_epi16(0x00FF);
+	int x = 0;
+
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i lo = _mm_and_si128(_mm_loadu_si128((const __m128i*)(src + x * 2)), lumaMask);
+		__m128i hi = _mm_and_si128(_mm_loadu_si128((const __m128i*)(src + x * 2 + 16)), lumaMask);
+
+		if (bExpandRange)
+		{
+			lo = ExpandLumaRange_SSE(lo);
+			hi = ExpandLumaRange_SSE(hi);
+		}
+
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(lo, hi));
+	}
+
+	YUYVToGrayRow_Scalar(src + x * 2, dst + x, width - x, bExpandRange);
+}
+
+static void LumaToGrayRow_SSE(const uint8_t* src, uint8_t* dst, int width, bool bExpandRange)
+{
+	if (!bExpandRange)
+	{
+		memcpy(dst, src, width);
+		return;
+	}
+
+	const __m128i zero = _mm_setzero_si128();
+	int x = 0;
+
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i luma = _mm_loadu_si128((const __m128i*)(src + x));
+		__m128i lo = ExpandLumaRange_SSE(_mm_unpacklo_epi8(luma, zero));
+		__m128i hi = ExpandLumaRange_SSE(_mm_unpackhi_epi8(luma, zero));
+
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(lo, hi));
+	}
+
+	LumaToGrayRow_Scalar(src + x, dst + x, width - x, bExpandRange);
+}
+
+
+static inline __m256i ExpandLumaRange_AVX2(__m256i luma)
+{
+	luma = _mm256_subs_epu16(luma, _mm256_set1_epi16(LUMA_RANGE_OFFSET));
+	luma = _mm256_slli_epi16(luma, 7);
+	return _mm256_mulhrs_epi16(luma, _mm256_set1_epi16(LUMA_RANGE_SCALE));
+}
+
+static void YUYVToGrayRow_AVX2(const uint8_t* src, uint8_t* dst, int width, bool bExpandRange)
+{
+	const __m256i lumaMask = _mm256_set1_epi16(0x00FF);
+	int x = 0;
+
+	for (; x + 32 <= width; x += 32)
+	{
+		__m256i lo = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(src + x * 2)), lumaMask);
+		__m256i hi = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(src + x * 2 + 32)), lumaMask);
+
+		if (bExpandRange)
+		{
+			lo = ExpandLumaRange_AVX2(lo);
+			hi = ExpandLumaRange_AVX2(hi);
+		}
+
+		// The pack works per 128-bit lane, so the 64-bit quarters need to be reordered.
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+
+		_mm256_storeu_si256((__m256i*)(dst + x), packed);
+	}
+
+	YUYVToGrayRow_SSE(src + x * 2, dst + x, width - x, bExpandRange);
+}
+
+static void LumaToGrayRow_AVX2(const uint8_t* src, uint8_t* dst, int width, bool bExpandRange)
+{
+	if (!bExpandRange)
+	{
+		memcpy(dst, src, width);
+		return;
+	}
+
+	int x = 0;
+
+	for (; x + 32 <= width; x += 32)
+	{
+		__m256i lo = ExpandLumaRange_AVX2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + x))));
+		__m256i hi = ExpandLumaRange_AVX2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + x + 16))));
+
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+
+		_mm256_storeu_si256((__m256i*)(dst + x), packed);
+	}
+
+	LumaToGrayRow_SSE(src + x, dst + x, width - x, bExpandRange);
+}
+
+
+// Selects the high bytes of 12 pixels from 15 bytes of packed RAW10 data.
+#define RAW10_SHUFFLE_MASK 0, 1, 2, 3, 5, 6, 7, 8, 10, 11, 12, 13, -1, -1, -1, -1
+
+static void RAW10ToGrayRow_Scalar(const uint8_t* src, uint8_t* dst, int width)
+{
+	for (int x = 0; x < width; x += 4)
+	{
+		const uint8_t* group = src + x / 4 * 5;
+
+		for (int i = 0; i < (std::min)(4, width - x); i++)
+		{
+			dst[x + i] = group[i];
+		}
+	}
+}
+
+static void RAW10ToGrayRow_SSE(const uint8_t* src, uint8_t* dst, int width)
+{
+	const __m128i shuffleMask = _mm_setr_epi8(RAW10_SHUFFLE_MASK);
+	int x = 0;
+
+	// Each iteration reads and writes 16 bytes, but only advances by 15 source and 12 destination bytes.
+	for (; x + 16 <= width; x += 12)
+	{
+		__m128i packed = _mm_loadu_si128((const __m128i*)(src + x / 4 * 5));
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_shuffle_epi8(packed, shuffleMask));
+	}
+
+	RAW10ToGrayRow_Scalar(src + x / 4 * 5, dst + x, width - x);
+}
+
+static void RAW10ToGrayRow_AVX2(const uint8_t* src, uint8_t* dst, int width)
+{
+	const __m256i shuffleMask = _mm256_setr_epi8(RAW10_SHUFFLE_MASK, RAW10_SHUFFLE_MASK);
+	const __m256i compactMask = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+	int x = 0;
+
+	// Each lane unpacks 12 pixels, which are then compacted to 24 consecutive bytes.
+	for (; x + 32 <= width; x += 24)
+	{
+		const uint8_t* group = src + x / 4 * 5;
+		__m256i packed = _mm256_loadu2_m128i((const __m128i*)(group + 15), (const __m128i*)group);
+		__m256i unpacked = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(packed, shuffleMask), compactMask);
+
+		_mm256_storeu_si256((__m256i*)(dst + x), unpacked);
+	}
+
+	RAW10ToGrayRow_SSE(src + x / 4 * 5, dst + x, width - x);
+}
+
+
+// BT.601 luma weights in 8-bit fixed point, with the green weight split between the two green samples.
+// The extra 2 bits of shift scale the 10-bit samples to 8 bits.
+#define BAYER_WEIGHT_R 77
+#define BAYER_WEIGHT_G 75
+#define BAYER_WEIGHT_B 29
+#define BAYER_SHIFT 10
+
+static void BayerBinRow_Scalar(const uint16_t* srcRow0, const uint16_t* srcRow1, uint8_t* dst, int width)
+{
+	for (int x = 0; x < width; x++)
+	{
+		int luma = srcRow0[x * 2] * BAYER_WEIGHT_R + (srcRow0[x * 2 + 1] + srcRow1[x * 2]) * BAYER_WEIGHT_G + srcRow1[x * 2 + 1] * BAYER_WEIGHT_B;
+		dst[x] = (uint8_t)(std::min)(luma >> BAYER_SHIFT, 255);
+	}
+}
+
+static void BayerBinRow_SSE(const uint16_t* srcRow0, const uint16_t* srcRow1, uint8_t* dst, int width)
+{
+	const __m128i weightsRG = _mm_set1_epi32(BAYER_WEIGHT_R | (BAYER_WEIGHT_G << 16));
+	const __m128i weightsGB = _mm_set1_epi32(BAYER_WEIGHT_G | (BAYER_WEIGHT_B << 16));
+	int x = 0;
+
+	for (; x + 8 <= width; x += 8)
+	{
+		// Multiply-add each horizontal sample pair, then sum the two rows of the quad.
+		__m128i lo = _mm_add_epi32(
+			_mm_madd_epi16(_mm_loadu_si128((const __m128i*)(srcRow0 + x * 2)), weightsRG),
+			_mm_madd_epi16(_mm_loadu_si128((const __m128i*)(srcRow1 + x * 2)), weightsGB));
+		__m128i hi = _mm_add_epi32(
+			_mm_madd_epi16(_mm_loadu_si128((const __m128i*)(srcRow0 + x * 2 + 8)), weightsRG),
+			_mm_madd_epi16(_mm_loadu_si128((const __m128i*)(srcRow1 + x * 2 + 8)), weightsGB));
+
+		__m128i luma = _mm_packs_epi32(_mm_srli_epi32(lo, BAYER_SHIFT), _mm_srli_epi32(hi, BAYER_SHIFT));
+		_mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(luma, luma));
+	}
+
+	BayerBinRow_Scalar(srcRow0 + x * 2, srcRow1 + x * 2, dst + x, width - x);
+}
+
+static void BayerBinRow_AVX2(const uint16_t* srcRow0, const uint16_t* srcRow1, uint8_t* dst, int width)
+{
+	const __m256i weightsRG = _mm256_set1_epi32(BAYER_WEIGHT_R | (BAYER_WEIGHT_G << 16));
+	const __m256i weightsGB = _mm256_set1_epi32(BAYER_WEIGHT_G | (BAYER_WEIGHT_B << 16));
+	int x = 0;
+
+	for (; x + 16 <= width; x += 16)
+	{
+		__m256i lo = _mm256_add_epi32(
+			_mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(srcRow0 + x * 2)), weightsRG),
+			_mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(srcRow1 + x * 2)), weightsGB));
+		__m256i hi = _mm256_add_epi32(
+			_mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(srcRow0 + x * 2 + 16)), weightsRG),
+			_mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(srcRow1 + x * 2 + 16)), weightsGB));
+
+		// Both packs work per 128-bit lane, so the 64-bit quarters are reordered after each.
+		__m256i luma = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_srli_epi32(lo, BAYER_SHIFT), _mm256_srli_epi32(hi, BAYER_SHIFT)), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(luma, luma), _MM_SHUFFLE(3, 1, 2, 0));
+
+		_mm_storeu_si128((__m128i*)(dst + x), _mm256_castsi256_si128(packed));
+	}
+
+	BayerBinRow_SSE(srcRow0 + x * 2, srcRow1 + x * 2, dst + x, width - x);
+}
+
+
+static bool HasAVX2()
+{
+	static const bool bHasAVX2 = cv::checkHardwareSupport(CV_CPU_AVX2);
+	return bHasAVX2;
+}
+
+static void ConvertRows(const cv::Mat& src, cv::Mat& dst, bool bExpandRange, RowConversionFunc rowFunc)
+{
+	dst.create(src.rows, src.cols, CV_8UC1);
+
+	for (int y = 0; y < src.rows; y++)
+	{
+		rowFunc(src.ptr<uint8_t>(y), dst.ptr<uint8_t>(y), src.cols, bExpandRange);
+	}
+}
+
+void ConvertYUYVToGray(const cv::Mat& src, cv::Mat& dst, bool bExpandRange)
+{
+	CV_Assert(src.type() == CV_8UC2);
+	ConvertRows(src, dst, bExpandRange, HasAVX2() ? YUYVToGrayRow_AVX2 : YUYVToGrayRow_SSE);
+}
+
+void ConvertLumaToGray(const cv::Mat& src, cv::Mat& dst, bool bExpandRange)
+{
+	CV_Assert(src.type() == CV_8UC1);
+	ConvertRows(src, dst, bExpandRange, HasAVX2() ? LumaToGrayRow_AVX2 : LumaToGrayRow_SSE);
+}
+
+void ConvertRAW10ToGray(const cv::Mat& src, cv::Mat& dst)
+{
+	CV_Assert(src.type() == CV_8UC1 && src.cols % 5 == 0);
+
+	int width = src.cols / 5 * 4;
+	dst.create(src.rows, width, CV_8UC1);
+
+	auto rowFunc = HasAVX2() ? RAW10ToGrayRow_AVX2 : RAW10ToGrayRow_SSE;
+
+	for (int y = 0; y < src.rows; y++)
+	{
+		rowFunc(src.ptr<uint8_t>(y), dst.ptr<uint8_t>(y), width);
+	}
+}
+
+void ConvertBayer16BGToBinnedGray(const cv::Mat& src, cv::Mat& dst)
+{
+	CV_Assert(src.type() == CV_16UC1 && src.cols % 2 == 0 && src.rows % 2 == 0);
+
+	dst.create(src.rows / 2, src.cols / 2, CV_8UC1);
+
+	auto rowFunc = HasAVX2() ? BayerBinRow_AVX2 : BayerBinRow_SSE;
+
+	for (int y = 0; y < dst.rows; y++)
+	{
+		rowFunc(src.ptr<uint16_t>(y * 2), src.ptr<uint16_t>(y * 2 + 1), dst.ptr<uint8_t>(y), dst.cols);
+	}
+}
+
+void ConvertSplitNV12ToGray(const uint8_t* frameData, int frameWidth, int frameHeight, const cv::Rect& roi, cv::Mat& dst, bool bExpandRange)
+{
+	dst.create(roi.height, roi.width, CV_8UC1);
+
+	RowConversionFunc rowFunc = HasAVX2() ? LumaToGrayRow_AVX2 : LumaToGrayRow_SSE;
+
+	int halfHeight = frameHeight / 2;
+	size_t halfImageBytes = (size_t)frameWidth * halfHeight * 3 / 2;
+
+	for (int y = 0; y < roi.height; y++)
+	{
+		int frameY = roi.y + y;
+		const uint8_t* lumaRow = (frameY < halfHeight) ?
+			frameData + (size_t)frameY * frameWidth :
+			frameData + halfImageBytes + (size_t)(frameY - halfHeight) * frameWidth;
+
+		rowFunc(lumaRow + roi.x, dst.ptr<uint8_t>(y), roi.width, bExpandRange);
+	}
+}
+
+void ConvertSplitNV12ToRGB(const uint8_t* frameData, int frameWidth, int frameHeight, const cv::Rect& roi, cv::Mat& dst)
+{
+	dst.create(roi.height, roi.width, CV_8UC3);
+
+	int halfHeight = frameHeight / 2;
+	size_t halfImageBytes = (size_t)frameWidth * halfHeight * 3 / 2;
+
+	// Convert the parts of the region that fall in each half image separately.
+	for (int half = 0; half < 2; half++)
+	{
+		int startY = (std::max)(roi.y, half * halfHeight);
+		int endY = (std::min)(roi.y + roi.height, (half + 1) * halfHeight);
+
+		if (startY >= endY)
+		{
+			continue;
+		}
+
+		uint8_t* halfData = (uint8_t*)frameData + half * halfImageBytes;
+		cv::Mat lumaPlane(halfHeight, frameWidth, CV_8UC1, halfData);
+		cv::Mat chromaPlane(halfHeight / 2, frameWidth / 2, CV_8UC2, halfData + (size_t)frameWidth * halfHeight);
+
+		int halfY = startY - half * halfHeight;
+		int rows = endY - startY;
+
+		cv::Mat dstRows = dst(cv::Rect(0, startY - roi.y, roi.width, rows));
+
+		cv::cvtColorTwoPlane(lumaPlane(cv::Rect(roi.x, halfY, roi.width, rows)),
+			chromaPlane(cv::Rect(roi.x / 2, halfY / 2, roi.width / 2, rows / 2)),
+			dstRows, cv::COLOR_YUV2RGB_NV12);
+	}
+}
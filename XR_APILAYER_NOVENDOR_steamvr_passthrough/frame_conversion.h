@@ -0,0 +1,31 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+
+// CPU conversion kernels for raw camera frames, used for the stereo reconstruction input.
+// The source Mats may be ROIs into the raw frame buffer, so each eye can be converted without an intermediate full frame.
+// Uses AVX2 when supported by the CPU, otherwise SSE4.1.
+
+// Extracts the luma from a packed YUYV (YUY2) image into an 8-bit grayscale image.
+// Source is CV_8UC2. If bExpandRange is set, the limited range luma (16-235) is expanded to full range.
+void ConvertYUYVToGray(const cv::Mat& src, cv::Mat& dst, bool bExpandRange);
+
+// Copies a luma plane, such as the Y plane of NV12, into an 8-bit grayscale image.
+// Source is CV_8UC1. If bExpandRange is set, the limited range luma (16-235) is expanded to full range.
+void ConvertLumaToGray(const cv::Mat& src, cv::Mat& dst, bool bExpandRange);
+
+// Unpacks MIPI style packed 10-bit pixels (4 pixels in 5 bytes, low bits in the fifth byte) to 8-bit grayscale, keeping the high bits.
+// Source is CV_8UC1 with the packed bytes, and must be a whole number of 5 byte groups wide.
+void ConvertRAW10ToGray(const cv::Mat& src, cv::Mat& dst);
+
+// Bins each 2x2 quad of a 16-bit Bayer image with 10-bit samples into one 8-bit luminance pixel, producing a half resolution image.
+// The quad layout is R G / G B, as interpreted by cv::COLOR_BayerBG2GRAY. Source is CV_16UC1 with even dimensions.
+void ConvertBayer16BGToBinnedGray(const cv::Mat& src, cv::Mat& dst);
+
+// The NV12_2 format stores the top and bottom halves of the image as two complete NV12 images after each other.
+// Converts the luma of a region in full image coordinates to 8-bit grayscale.
+void ConvertSplitNV12ToGray(const uint8_t* frameData, int frameWidth, int frameHeight, const cv::Rect& roi, cv::Mat& dst, bool bExpandRange);
+
+// Converts a region of an NV12_2 image in full image coordinates to RGB.
+void ConvertSplitNV12ToRGB(const uint8_t* frameData, int frameWidth, int frameHeight, const cv::Rect& roi, cv::Mat& dst);
@@ -1,7 +1,13 @@
 
 #pragma once
 
-template<typename T> class FrameQueue;
+#include <condition_variable>
+#include <functional>
+#include "shared_structs.h"
+#include "perfutil.h"
+
+// Smoothing factor for the average frame age when read.
+#define FRAME_QUEUE_AGE_SMOOTHING 0.05f
 
 namespace
 {
@@ -9,10 +15,92 @@ namespace
 	{
 		std::shared_ptr<T> Frame;
 		std::atomic<int> NumReaders = 0;
+		std::atomic<uint64_t> CommitTime = 0;
+		std::atomic<bool> bWasRead = false;
+
+		// Only used by FrameQueue.
+		bool bRetirePending = false;
+
+		// Only used by LockFreeFrameQueue.
+		int SlotIndex = 0;
+		std::atomic<uint64_t> PublishSequence = 0;
+		std::atomic<uint64_t> PublishTimestamp = 0;
 	};
 }
 
 
+// Counters for finding where the pipeline stalls, and for sizing the queues. Can be updated from any thread.
+class FrameQueueTelemetry
+{
+public:
+	FrameQueueTelemetry()
+	{
+		GetSytemTickFrequency();
+	}
+
+	// No free frame was available for writing.
+	void AddUnderrun()
+	{
+		m_numUnderruns++;
+	}
+
+	// A committed frame was recycled without ever being read.
+	void AddDroppedFrame()
+	{
+		m_numDroppedFrames++;
+	}
+
+	void UpdateOccupancy(const uint32_t numFramesInUse)
+	{
+		uint32_t maxOccupancy = m_maxOccupancy.load();
+		while (numFramesInUse > maxOccupancy && !m_maxOccupancy.compare_exchange_weak(maxOccupancy, numFramesInUse)) {}
+	}
+
+	void AddReadAge(const uint64_t commitTime)
+	{
+		if (commitTime == 0)
+		{
+			return;
+		}
+
+		float ageMS = (float)(GetPerfTimeDiffSeconds(commitTime, GetCurrentTimeSytemTicks()) * 1000.0);
+		float average = m_averageReadAgeMS.load();
+
+		while (!m_averageReadAgeMS.compare_exchange_weak(average, average == 0.0f ? ageMS : average + (ageMS - average) * FRAME_QUEUE_AGE_SMOOTHING)) {}
+	}
+
+	FrameQueueStats GetStats() const
+	{
+		FrameQueueStats stats;
+		stats.NumUnderruns = m_numUnderruns;
+		stats.NumDroppedFrames = m_numDroppedFrames;
+		stats.MaxOccupancy = m_maxOccupancy;
+		stats.AverageReadAgeMS = m_averageReadAgeMS;
+		return stats;
+	}
+
+private:
+	std::atomic<uint32_t> m_numUnderruns = 0;
+	std::atomic<uint32_t> m_numDroppedFrames = 0;
+	std::atomic<uint32_t> m_maxOccupancy = 0;
+	std::atomic<float> m_averageReadAgeMS = 0.0f;
+};
+
+
+// Interface FramePtr uses to hand its entry back to the queue it came from.
+template<typename T> class IFrameQueue
+{
+public:
+	virtual ~IFrameQueue() {};
+
+	virtual void ReleaseRead(std::shared_ptr<T> frame) = 0;
+	virtual void ReleaseReadEntry(std::shared_ptr<QueueEntry<T>> frameEntry) = 0;
+	virtual void CommitWrite(std::shared_ptr<QueueEntry<T>> frameEntry) = 0;
+	virtual bool CommitWriteAndAcquireRead(std::shared_ptr<QueueEntry<T>> frameEntry) = 0;
+	virtual void RescindWrite(std::shared_ptr<QueueEntry<T>> frameEntry) = 0;
+};
+
+
 template<typename T> class FramePtr
 {
 public:
@@ -22,7 +110,7 @@ public:
 	{
 
 	}
-	FramePtr(FrameQueue<T>* queue, std::shared_ptr<QueueEntry<T>> entry, bool bIsWrite)
+	FramePtr(IFrameQueue<T>* queue, std::shared_ptr<QueueEntry<T>> entry, bool bIsWrite)
 		: m_queue(queue)
 		, m_entry(entry)
 		, m_bIsWrite(bIsWrite)
@@ -33,8 +121,12 @@ public:
 	FramePtr(FramePtr&& other) noexcept
 	{
 		m_queue = other.m_queue;
-		m_entry = other.m_entry;
-		m_bIsWrite = false;
+		m_entry = std::move(other.m_entry);
+		m_bIsWrite = other.m_bIsWrite;
+
+		// The moved from pointer must not release the entry again.
+		other.m_queue = nullptr;
+		other.m_bIsWrite = false;
 	}
 
 	FramePtr(const FramePtr& other) = delete;
@@ -43,7 +135,7 @@ public:
 	{
 		if (m_queue && m_entry.get())
 		{
-			m_bIsWrite ? m_queue->RescindWrite(m_entry) : m_queue->ReleaseRead(m_entry->Frame);
+			m_bIsWrite ? m_queue->RescindWrite(m_entry) : m_queue->ReleaseReadEntry(m_entry);
 		}
 	}
 
@@ -110,7 +202,7 @@ public:
 	}
 
 private:
-	FrameQueue<T>* m_queue;
+	IFrameQueue<T>* m_queue;
 	std::shared_ptr<QueueEntry<T>> m_entry;
 	bool m_bIsWrite;
 };
@@ -118,10 +210,13 @@ private:
 
 
 
-template<typename T> class FrameQueue
+template<typename T> class FrameQueue : public IFrameQueue<T>
 {
 public:
-	FrameQueue(int numFrames)
+	// The newest historyDepth committed frames are kept readable, so that older frames can be picked by exposure time.
+	FrameQueue(int numFrames, int historyDepth = 1)
+		: m_numFrames(numFrames)
+		, m_historyDepth((std::max)(historyDepth, 1))
 	{
 		m_idleEntries.reserve(numFrames);
 		m_readEntries.reserve(numFrames);
@@ -143,8 +238,56 @@ public:
 			return FramePtr<T>();
 		}
 
-		m_readEntries.back()->NumReaders++;
-		return FramePtr<T>(this, m_readEntries.back(), false);
+		return AcquireEntry(m_readEntries.back());
+	}
+
+	// Returns the readable frame with the exposure time nearest to targetTime.
+	// If bAllowNewer is not set, returns the newest frame exposed no later than targetTime instead, or nothing if there is none.
+	FramePtr<T> AcquireReadForTime(const uint64_t targetTime, const bool bAllowNewer = true)
+	{
+		std::lock_guard<std::mutex> accessLock(m_accessMutex);
+
+		int bestIndex = -1;
+		uint64_t bestDiff = UINT64_MAX;
+
+		// Entries are in commit order, so iterating forward prefers the newer one on ties.
+		for (int i = 0; i < (int)m_readEntries.size(); i++)
+		{
+			uint64_t timestamp = m_readEntries[i]->Frame->FrameExposureTimestamp;
+			if (timestamp > targetTime && !bAllowNewer)
+			{
+				continue;
+			}
+
+			uint64_t diff = timestamp > targetTime ? timestamp - targetTime : targetTime - timestamp;
+			if (diff <= bestDiff)
+			{
+				bestIndex = i;
+				bestDiff = diff;
+			}
+		}
+
+		if (bestIndex < 0)
+		{
+			return FramePtr<T>();
+		}
+
+		return AcquireEntry(m_readEntries[bestIndex]);
+	}
+
+	// Blocks until a frame newer than lastSequence has been committed, or until the timeout expires.
+	// Returns the latest frame and updates lastSequence, or an empty FramePtr on timeout.
+	FramePtr<T> WaitForRead(uint64_t& lastSequence, const std::chrono::microseconds timeout)
+	{
+		std::unique_lock<std::mutex> accessLock(m_accessMutex);
+
+		if (!m_writeCondition.wait_for(accessLock, timeout, [&] { return m_writeSequence != lastSequence && !m_readEntries.empty(); }))
+		{
+			return FramePtr<T>();
+		}
+
+		lastSequence = m_writeSequence;
+		return AcquireEntry(m_readEntries.back());
 	}
 
 	void ReleaseRead(std::shared_ptr<T> frame)
@@ -157,18 +300,33 @@ public:
 			{
 				m_readEntries[i]->NumReaders--;
 
-				// Return to idle queue if no one else is reading
-				if (m_readEntries.size() > 1 && m_readEntries[i]->NumReaders <= 0)
+				if (m_readEntries[i]->NumReaders > 0)
 				{
+					return;
+				}
+
+				// Return to idle queue if no one else is reading and it is not one of the kept newest frames
+				if (i < (int)m_readEntries.size() - m_historyDepth)
+				{
+					RetireEntry(m_readEntries[i]);
 					m_idleEntries.push_back(m_readEntries[i]);
 					m_readEntries.erase(m_readEntries.begin() + i);
 				}
+				else if (m_readEntries[i]->bRetirePending)
+				{
+					RetireEntry(m_readEntries[i]);
+				}
 
 				return;
 			}
 		}	
 	}
 
+	void ReleaseReadEntry(std::shared_ptr<QueueEntry<T>> frameEntry)
+	{
+		ReleaseRead(frameEntry->Frame);
+	}
+
 	FramePtr<T> AcquireWrite()
 	{
 		std::lock_guard<std::mutex> accessLock(m_accessMutex);
@@ -178,44 +336,69 @@ public:
 			auto entry = m_idleEntries.back();
 			m_idleEntries.pop_back();
 
+			m_telemetry.UpdateOccupancy(m_numFrames - (uint32_t)m_idleEntries.size());
 			return FramePtr<T>(this, entry, true);
 		}
+
+		m_telemetry.AddUnderrun();
 		return FramePtr<T>();
 	}
 
 	void CommitWrite(std::shared_ptr<QueueEntry<T>> frameEntry)
 	{
-		std::lock_guard<std::mutex> accessLock(m_accessMutex);
-
-		// Remove any stale frames not being read
-		for (int i = (int)m_readEntries.size() - 1; i >= 0; i--)
 		{
-			if (m_readEntries[i]->NumReaders <= 0)
+			std::lock_guard<std::mutex> accessLock(m_accessMutex);
+
+			// Remove any stale frames not being read, apart from the kept history
+			for (int i = (int)m_readEntries.size() - m_historyDepth; i >= 0; i--)
 			{
-				m_idleEntries.push_back(m_readEntries[i]);
-				m_readEntries.erase(m_readEntries.begin() + i);
+				if (m_readEntries[i]->NumReaders <= 0)
+				{
+					if (!m_readEntries[i]->bWasRead)
+					{
+						m_telemetry.AddDroppedFrame();
+					}
+					RetireEntry(m_readEntries[i]);
+					m_idleEntries.push_back(m_readEntries[i]);
+					m_readEntries.erase(m_readEntries.begin() + i);
+				}
 			}
+
+			frameEntry->CommitTime = GetCurrentTimeSytemTicks();
+			frameEntry->bWasRead = false;
+			m_readEntries.push_back(frameEntry);
+			m_writeSequence++;
 		}
-		
-		m_readEntries.push_back(frameEntry);
+		m_writeCondition.notify_all();
 	}
 
 	bool CommitWriteAndAcquireRead(std::shared_ptr<QueueEntry<T>> frameEntry)
 	{
-		std::lock_guard<std::mutex> accessLock(m_accessMutex);
-
-		// Remove any stale frames not being read
-		for (int i = (int)m_readEntries.size() - 1; i >= 0; i--)
 		{
-			if (m_readEntries[i]->NumReaders <= 0)
+			std::lock_guard<std::mutex> accessLock(m_accessMutex);
+
+			// Remove any stale frames not being read, apart from the kept history
+			for (int i = (int)m_readEntries.size() - m_historyDepth; i >= 0; i--)
 			{
-				m_idleEntries.push_back(m_readEntries[i]);
-				m_readEntries.erase(m_readEntries.begin() + i);
+				if (m_readEntries[i]->NumReaders <= 0)
+				{
+					if (!m_readEntries[i]->bWasRead)
+					{
+						m_telemetry.AddDroppedFrame();
+					}
+					RetireEntry(m_readEntries[i]);
+					m_idleEntries.push_back(m_readEntries[i]);
+					m_readEntries.erase(m_readEntries.begin() + i);
+				}
 			}
-		}
 
-		m_readEntries.push_back(frameEntry);
-		frameEntry->NumReaders++;
+			frameEntry->CommitTime = GetCurrentTimeSytemTicks();
+			frameEntry->bWasRead = true;
+			m_readEntries.push_back(frameEntry);
+			frameEntry->NumReaders++;
+			m_writeSequence++;
+		}
+		m_writeCondition.notify_all();
 
 		return true;
 	}
@@ -227,9 +410,336 @@ public:
 		m_idleEntries.push_back(frameEntry);
 	}
 
+	// Called with the access mutex held whenever a frame stops being readable, so that resources
+	// it holds can be released before the slot is written again.
+	void SetRetireCallback(std::function<void(T&)> callback)
+	{
+		std::lock_guard<std::mutex> accessLock(m_accessMutex);
+
+		m_retireCallback = callback;
+	}
+
+	// Runs the retire callback on all readable frames, deferred to the last reader for frames being read.
+	// The frames stay readable afterwards, so the callback needs to invalidate them if required.
+	void RetireFrames()
+	{
+		std::lock_guard<std::mutex> accessLock(m_accessMutex);
+
+		for (std::shared_ptr<QueueEntry<T>>& entry : m_readEntries)
+		{
+			if (entry->NumReaders <= 0)
+			{
+				RetireEntry(entry);
+			}
+			else
+			{
+				entry->bRetirePending = true;
+			}
+		}
+	}
+
+	FrameQueueStats GetStats() const
+	{
+		return m_telemetry.GetStats();
+	}
+
 private:
+	// Must be called with the access mutex held.
+	void RetireEntry(std::shared_ptr<QueueEntry<T>>& entry)
+	{
+		entry->bRetirePending = false;
+
+		if (m_retireCallback)
+		{
+			m_retireCallback(*entry->Frame);
+		}
+	}
+
+	// Must be called with the access mutex held.
+	FramePtr<T> AcquireEntry(std::shared_ptr<QueueEntry<T>>& entry)
+	{
+		entry->NumReaders++;
+		entry->bWasRead = true;
+		m_telemetry.AddReadAge(entry->CommitTime);
+		return FramePtr<T>(this, entry, false);
+	}
+
 	std::vector<std::shared_ptr<QueueEntry<T>>> m_idleEntries;
 	std::vector<std::shared_ptr<QueueEntry<T>>> m_readEntries;
 	std::mutex m_accessMutex;
+	std::condition_variable m_writeCondition;
+	std::function<void(T&)> m_retireCallback;
+	uint64_t m_writeSequence = 0;
+	uint32_t m_numFrames;
+	int m_historyDepth;
+	FrameQueueTelemetry m_telemetry;
+};
+
+
+
+// Lock-free variant of FrameQueue for when frames are only written from a single thread.
+// Readers never block, which makes it suitable for queues read by the render thread.
+// Each committed slot gets an increasing publish sequence number, and the latest historyDepth slots are kept readable.
+// Readers register on a slot and then check that its sequence is unchanged, while the writer clears the sequence
+// of a slot before checking it has no readers, so a frame is never written while being read.
+template<typename T> class LockFreeFrameQueue : public IFrameQueue<T>
+{
+public:
+	LockFreeFrameQueue(int numFrames, int historyDepth = 1)
+		: m_bSlotWriting(numFrames, false)
+		, m_historyDepth((std::max)(historyDepth, 1))
+	{
+		m_entries.reserve(numFrames);
+
+		for (int i = 0; i < numFrames; i++)
+		{
+			auto entry = std::make_shared<QueueEntry<T>>();
+			entry->Frame = std::make_shared<T>();
+			entry->SlotIndex = i;
+			m_entries.push_back(entry);
+		}
+	}
+
+	FramePtr<T> AcquireRead()
+	{
+		while (true)
+		{
+			int latestIndex = m_latestIndex.load();
+
+			if (latestIndex < 0)
+			{
+				return FramePtr<T>();
+			}
+
+			FramePtr<T> frame = TryAcquireSlot(latestIndex, m_entries[latestIndex]->PublishSequence.load());
+			if (frame.HasFrame())
+			{
+				return frame;
+			}
+		}
+	}
+
+	// Returns the kept frame with the exposure time nearest to targetTime.
+	// If bAllowNewer is not set, returns the newest frame exposed no later than targetTime instead, or nothing if there is none.
+	FramePtr<T> AcquireReadForTime(const uint64_t targetTime, const bool bAllowNewer = true)
+	{
+		while (true)
+		{
+			uint64_t writeSequence = m_writeSequence.load();
+			uint64_t oldestKeptSequence = writeSequence < m_historyDepth ? 1 : writeSequence + 1 - m_historyDepth;
+			int bestIndex = -1;
+			uint64_t bestSequence = 0;
+			uint64_t bestDiff = UINT64_MAX;
+
+			for (int i = 0; i < (int)m_entries.size(); i++)
+			{
+				uint64_t sequence = m_entries[i]->PublishSequence.load();
+				if (sequence == 0 || sequence < oldestKeptSequence)
+				{
+					continue;
+				}
+
+				uint64_t timestamp = m_entries[i]->PublishTimestamp.load();
+				if (timestamp > targetTime && !bAllowNewer)
+				{
+					continue;
+				}
+
+				uint64_t diff = timestamp > targetTime ? timestamp - targetTime : targetTime - timestamp;
+				if (diff < bestDiff || (diff == bestDiff && sequence > bestSequence))
+				{
+					bestIndex = i;
+					bestSequence = sequence;
+					bestDiff = diff;
+				}
+			}
+
+			if (bestIndex < 0)
+			{
+				return FramePtr<T>();
+			}
+
+			FramePtr<T> frame = TryAcquireSlot(bestIndex, bestSequence);
+			if (frame.HasFrame())
+			{
+				return frame;
+			}
+		}
+	}
+
+	// Blocks until a frame newer than lastSequence has been committed, or until the timeout expires.
+	// Returns the latest frame and updates lastSequence, or an empty FramePtr on timeout.
+	FramePtr<T> WaitForRead(uint64_t& lastSequence, const std::chrono::microseconds timeout)
+	{
+		if (m_writeSequence.load() == lastSequence)
+		{
+			std::unique_lock<std::mutex> waitLock(m_waitMutex);
+
+			m_numWaiters++;
+			bool bGotFrame = m_writeCondition.wait_for(waitLock, timeout, [&] { return m_writeSequence.load() != lastSequence; });
+			m_numWaiters--;
+
+			if (!bGotFrame)
+			{
+				return FramePtr<T>();
+			}
+		}
+
+		lastSequence = m_writeSequence.load();
+		return AcquireRead();
+	}
+
+	void ReleaseRead(std::shared_ptr<T> frame)
+	{
+		for (std::shared_ptr<QueueEntry<T>>& entry : m_entries)
+		{
+			if (entry->Frame.get() == frame.get())
+			{
+				entry->NumReaders--;
+				return;
+			}
+		}
+	}
+
+	void ReleaseReadEntry(std::shared_ptr<QueueEntry<T>> frameEntry)
+	{
+		frameEntry->NumReaders--;
+	}
+
+	// Only to be called from the writer thread.
+	FramePtr<T> AcquireWrite()
+	{
+		uint64_t writeSequence = m_writeSequence.load();
+
+		for (int i = 0; i < (int)m_entries.size(); i++)
+		{
+			std::shared_ptr<QueueEntry<T>>& entry = m_entries[i];
+
+			if (IsSlotInUse(i, writeSequence))
+			{
+				continue;
+			}
+
+			// Readers check the sequence after registering, so clearing it first means any reader not seen below will back off.
+			uint64_t sequence = entry->PublishSequence.exchange(0);
+
+			if (entry->NumReaders.load() > 0)
+			{
+				entry->PublishSequence.store(sequence);
+				continue;
+			}
+
+			if (sequence != 0 && !entry->bWasRead)
+			{
+				m_telemetry.AddDroppedFrame();
+			}
+
+			m_bSlotWriting[i] = true;
+
+			uint32_t numFramesInUse = 0;
+			for (int j = 0; j < (int)m_entries.size(); j++)
+			{
+				numFramesInUse += IsSlotInUse(j, writeSequence) ? 1 : 0;
+			}
+			m_telemetry.UpdateOccupancy(numFramesInUse);
+
+			return FramePtr<T>(this, entry, true);
+		}
+
+		m_telemetry.AddUnderrun();
+		return FramePtr<T>();
+	}
+
+	void CommitWrite(std::shared_ptr<QueueEntry<T>> frameEntry)
+	{
+		frameEntry->bWasRead = false;
+		m_bSlotWriting[frameEntry->SlotIndex] = false;
+		Publish(frameEntry);
+	}
+
+	bool CommitWriteAndAcquireRead(std::shared_ptr<QueueEntry<T>> frameEntry)
+	{
+		frameEntry->NumReaders++;
+		frameEntry->bWasRead = true;
+		m_bSlotWriting[frameEntry->SlotIndex] = false;
+		Publish(frameEntry);
+
+		return true;
+	}
+
+	void RescindWrite(std::shared_ptr<QueueEntry<T>> frameEntry)
+	{
+		m_bSlotWriting[frameEntry->SlotIndex] = false;
+	}
+
+	FrameQueueStats GetStats() const
+	{
+		return m_telemetry.GetStats();
+	}
+
+private:
+	// Only to be called from the writer thread.
+	bool IsSlotInUse(const int slotIndex, const uint64_t writeSequence)
+	{
+		uint64_t sequence = m_entries[slotIndex]->PublishSequence.load();
+
+		return m_bSlotWriting[slotIndex] ||
+			(sequence != 0 && sequence + m_historyDepth > writeSequence) ||
+			m_entries[slotIndex]->NumReaders.load() > 0;
+	}
+
+	FramePtr<T> TryAcquireSlot(const int slotIndex, const uint64_t sequence)
+	{
+		if (sequence == 0)
+		{
+			return FramePtr<T>();
+		}
+
+		std::shared_ptr<QueueEntry<T>>& entry = m_entries[slotIndex];
+		entry->NumReaders++;
+
+		if (entry->PublishSequence.load() == sequence)
+		{
+			entry->bWasRead = true;
+			m_telemetry.AddReadAge(entry->CommitTime);
+			return FramePtr<T>(this, entry, false);
+		}
+
+		// The slot got reused in between.
+		entry->NumReaders--;
+		return FramePtr<T>();
+	}
+
+	void Publish(std::shared_ptr<QueueEntry<T>> frameEntry)
+	{
+		uint64_t sequence = m_writeSequence.load() + 1;
+
+		frameEntry->CommitTime.store(GetCurrentTimeSytemTicks());
+		frameEntry->PublishTimestamp.store(frameEntry->Frame->FrameExposureTimestamp);
+		frameEntry->PublishSequence.store(sequence);
+		m_latestIndex.store(frameEntry->SlotIndex);
+		m_writeSequence.store(sequence);
+
+		// The writer only needs to touch the mutex if someone is blocked in WaitForRead.
+		if (m_numWaiters.load() > 0)
+		{
+			{
+				std::lock_guard<std::mutex> waitLock(m_waitMutex);
+			}
+			m_writeCondition.notify_all();
+		}
+	}
+
+	std::vector<std::shared_ptr<QueueEntry<T>>> m_entries;
+	std::vector<bool> m_bSlotWriting;
+	uint64_t m_historyDepth;
+	std::atomic<int> m_latestIndex = -1;
+	std::atomic<uint64_t> m_writeSequence = 0;
+
+	std::atomic<int> m_numWaiters = 0;
+	std::mutex m_waitMutex;
+	std::condition_variable m_writeCondition;
+
+	FrameQueueTelemetry m_telemetry;
 };
 
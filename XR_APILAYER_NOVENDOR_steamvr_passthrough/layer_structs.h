@@ -6,6 +6,13 @@
 
 #define NEAR_PROJECTION_DISTANCE 0.05f
 
+// Number of the newest camera GPU frames kept available for selecting by exposure time.
+#define CAMERA_FRAME_HISTORY_DEPTH 4
+
+// Number of camera GPU frames in flight. Each one needs its own shared camera texture,
+// so that a kept history frame is never overwritten by a newer upload.
+#define CAMERA_GPU_FRAME_QUEUE_SIZE (3 + CAMERA_FRAME_HISTORY_DEPTH)
+
 struct ExtensionData
 {
 	bool bAndroidPassthroughStateExtensionEnabled = false;
@@ -74,6 +81,19 @@ struct CameraGPUFrame
 	bool bisRectifiedFrame;
 };
 
+class CameraUploadBufferPool;
+
+// Persistently mapped, host visible Vulkan buffer that raw camera frames are captured directly into.
+// The frame decoder copies from it to the GPU without an intermediate CPU side copy.
+struct CameraUploadBuffer
+{
+	VkBuffer Buffer = VK_NULL_HANDLE;
+	VkDeviceMemory Memory = VK_NULL_HANDLE;
+	uint8_t* MappedMemory = nullptr;
+	VkDeviceSize Size = 0;
+	CameraUploadBufferPool* Pool = nullptr;
+};
+
 struct CameraCPUFrame
 {
 	CameraCPUFrame()
@@ -85,14 +105,35 @@ struct CameraCPUFrame
 		, FrameSize{ 0, 0 }
 		, FrameSequence(0)
 		, FrameExposureTimestamp(0)
+		, FrameReadyTime(0)
 		, FrameLayout(FrameLayout_Mono)
 		, bIsValid(false)
 		, bIsRaw(false)
 	{
 	}
 
+	// The frame data is in the upload buffer or borrowed memory if the frame was captured into either, otherwise in the frame buffer.
+	uint8_t* GetFrameData() const
+	{
+		if (UploadBuffer.get()) { return UploadBuffer->MappedMemory; }
+		if (BorrowedFrameData.get()) { return BorrowedFrameData.get(); }
+		return FrameBuffer.get() ? FrameBuffer->data() : nullptr;
+	}
+
+	size_t GetFrameDataSize() const
+	{
+		if (UploadBuffer.get()) { return (size_t)RawFrameDataBytes; }
+		if (BorrowedFrameData.get()) { return (size_t)RawFrameDataBytes; }
+		return FrameBuffer.get() ? FrameBuffer->size() : 0;
+	}
+
 
 	std::shared_ptr<std::vector<uint8_t>> FrameBuffer;
+	std::shared_ptr<CameraUploadBuffer> UploadBuffer;
+	// Memory owned by the camera provider, such as an OpenVR block queue block. Returned to the provider when the last reference is dropped.
+	std::shared_ptr<uint8_t> BorrowedFrameData;
+	// Ground truth 3D positions for the left eye frame as XYZ floats in the OpenCV camera axes, only set by the synthetic camera.
+	std::shared_ptr<std::vector<float>> GroundTruthPoints;
 	XrMatrix4x4f CameraViewToWorldLeft;
 	XrMatrix4x4f CameraViewToWorldRight;
 	
@@ -103,6 +144,7 @@ struct CameraCPUFrame
 	VkExtent2D FrameSize;
 	uint32_t FrameSequence;
 	uint64_t FrameExposureTimestamp;
+	uint64_t FrameReadyTime; // System ticks when the capture stage finished writing the frame.
 	EStereoFrameLayout FrameLayout;
 	bool bIsValid;
 	bool bIsRaw;
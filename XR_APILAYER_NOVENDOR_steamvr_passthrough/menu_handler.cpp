@@ -130,6 +130,11 @@ void MenuHandler::MenuIPCMessageReceived(MenuIPCMessage& message, int clientInde
 		m_configManager->SetFrameTextureDumpPending();
 		break;
 
+	case MessageType_SendCommand_RunStereoBenchmark:
+
+		m_configManager->SetStereoBenchmarkPending();
+		break;
+
 	case MessageType_InformReloadConfigFile:
 
 		m_configManager->ReadConfigFile();
@@ -197,6 +202,7 @@ void MenuHandler::MenuIPCMessageReceived(MenuIPCMessage& message, int clientInde
 			// Read config file to update settings on invalid size
 			m_configManager->ReadConfigFile();
 		}
+		m_configManager->CameraConfigChanged();
 
 		break;
 	}
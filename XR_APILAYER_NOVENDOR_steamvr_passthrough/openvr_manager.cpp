@@ -9,10 +9,14 @@ OpenVRManager::OpenVRManager()
     , m_hmdDeviceId(-1)
 {
     InitRuntime();
+    m_poseHistory = std::make_unique<PoseHistory>(this);
 }
 
 OpenVRManager::~OpenVRManager()
 {
+    // Stop the sampler thread before the interfaces go away.
+    m_poseHistory.reset();
+
     std::lock_guard<std::mutex> lock(m_runtimeMutex);
     if (m_bRuntimeInitialized)
     {
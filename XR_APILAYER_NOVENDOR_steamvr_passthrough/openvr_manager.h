@@ -5,6 +5,7 @@
 #include <shared_mutex>
 #include "layer_structs.h"
 #include "vr_blockqueue.h"
+#include "pose_history.h"
 
 namespace vr {
 	class IVRClientCore;
@@ -63,6 +64,12 @@ public:
 	{
 		return m_hmdDeviceId;
 	}
+
+	// Shared tracking history, for looking up device poses at camera frame and display times.
+	PoseHistory* GetPoseHistory()
+	{
+		return m_poseHistory.get();
+	}
 	
 
 private:
@@ -91,5 +98,7 @@ private:
 	vr::IVRRenderModels* m_vrRenderModels = nullptr;
 	vr::IVRPaths* m_vrPaths = nullptr;
 	vr::IVRBlockQueue* m_vrBlockQueue = nullptr;
+
+	std::unique_ptr<PoseHistory> m_poseHistory;
 };
 
@@ -311,6 +311,19 @@ bool PassthroughSystem::SetupProcessingPipeline()
 		m_cameraManager->GetCameraDisplayStats(data.Values.CameraFrameWidth, data.Values.CameraFrameHeight, data.Values.CameraFrameRate, data.Values.CameraProvider, data.Values.bCameraActive);
 		m_menuHandler->DispatchClientDataValues();
 	}
+	else if (m_cameraProvider == CameraProvider_Synthetic)
+	{
+		m_cameraManager = std::make_shared<CameraManagerSynthetic>(m_asyncRenderer, m_configManager);
+
+		if (!m_cameraManager->InitCamera())
+		{
+			g_logger->error("Failed to initialize synthetic camera!");
+			return false;
+		}
+		ClientData& data = m_menuHandler->GetClientData();
+		m_cameraManager->GetCameraDisplayStats(data.Values.CameraFrameWidth, data.Values.CameraFrameHeight, data.Values.CameraFrameRate, data.Values.CameraProvider, data.Values.bCameraActive);
+		m_menuHandler->DispatchClientDataValues();
+	}
 	else
 	{
 		g_logger->error("No camera provider set!");
@@ -745,9 +758,34 @@ bool PassthroughSystem::RenderPassthrough2D(const XrFrameEndInfo* frameEndInfo,
 	clientData.Values.DepthToPhotonsLatencyMS = 0.0f;
 	clientData.Values.StereoReconstructionTimeMS = 0.0f;
 	clientData.Values.StereoRenderTimeMS = 0.0f;
+	clientData.Values.StereoMatcherRebuildCount = 0;
+	clientData.Values.StereoInputStageTimeMS = 0.0f;
+	clientData.Values.StereoMatchingStageTimeMS = 0.0f;
+	clientData.Values.StereoOutputStageTimeMS = 0.0f;
+	clientData.Values.StereoInputQueueDepth = 0;
+	clientData.Values.StereoDisparityQueueDepth = 0;
+	clientData.Values.StereoInputQueueMaxDepth = 0;
+	clientData.Values.StereoDisparityQueueMaxDepth = 0;
+	clientData.Values.StereoInputQueueLatencyMS = 0.0f;
+	clientData.Values.StereoDisparityQueueLatencyMS = 0.0f;
+	clientData.Values.StereoInputWakeupsPerSec = 0.0f;
+	clientData.Values.bStereoGroundTruthAvailable = false;
+	clientData.Values.StereoBadPixelRate = 0.0f;
+	clientData.Values.StereoInvalidPixelRate = 0.0f;
+	clientData.Values.StereoDisparitySearchFraction = 1.0f;
+	clientData.Values.StereoRecomputedFraction = 1.0f;
+	clientData.Values.bStereoGovernorActive = false;
+	clientData.Values.StereoGovernorLevel = 0;
+	clientData.Values.StereoGovernorTimeMS = 0.0f;
 	
 	clientData.Values.GPUFrameRetrievalTimeMS = m_cameraManager->GetGPUFrameRetrievalPerfTime();
 	clientData.Values.CPUFrameRetrievalTimeMS = m_cameraManager->GetCPUFrameRetrievalPerfTime();
+	clientData.Values.CameraCaptureStageLatencyMS = m_cameraManager->GetCaptureStageLatency();
+	clientData.Values.CameraUploadQueueLatencyMS = m_cameraManager->GetUploadQueueLatency();
+	clientData.Values.CameraServeWakeupsPerSec = m_cameraManager->GetServeThreadWakeupRate();
+	clientData.Values.CameraGPUQueueStats = m_cameraManager->GetGPUFrameQueueStats();
+	clientData.Values.CameraCPUQueueStats = m_cameraManager->GetCPUFrameQueueStats();
+	clientData.Values.DepthQueueStats = FrameQueueStats();
 
 	return true;
 }
@@ -760,14 +798,18 @@ bool PassthroughSystem::RenderPassthroughWithDepth(const XrFrameEndInfo* frameEn
 		m_cameraProvider == CameraProvider_Augmented ?
 		m_augmentedCameraManager : m_cameraManager;
 
-	FramePtr<CameraGPUFrame> gpuFrame = cameraFrameManager->AcquireCameraGPUFrame();
-	if (!gpuFrame.HasFrame())
+	FramePtr<DepthFrame> depthFrame = m_depthReconstruction->GetDepthFrame();
+	if (!depthFrame.HasFrame())
 	{
 		return false;
 	}
 
-	FramePtr<DepthFrame> depthFrame = m_depthReconstruction->GetDepthFrame();
-	if (!depthFrame.HasFrame())
+	// Optionally use the camera frame exposed closest to the depth frame instead of the newest one.
+	// This avoids the depth being misaligned with the camera image during fast motion, at the cost of camera latency.
+	FramePtr<CameraGPUFrame> gpuFrame = mainConf.StereoMatchCameraFrameToDepth ?
+		cameraFrameManager->AcquireCameraGPUFrameForTime(depthFrame->FrameExposureTimestamp) :
+		cameraFrameManager->AcquireCameraGPUFrame();
+	if (!gpuFrame.HasFrame())
 	{
 		return false;
 	}
@@ -837,9 +879,34 @@ bool PassthroughSystem::RenderPassthroughWithDepth(const XrFrameEndInfo* frameEn
 
 	clientData.Values.StereoReconstructionTimeMS = m_depthReconstruction->GetReconstructionPerfTime();
 	clientData.Values.StereoRenderTimeMS = m_depthReconstruction->GetRenderPerfTime();
+	clientData.Values.StereoMatcherRebuildCount = m_depthReconstruction->GetMatcherRebuildCount();
+	clientData.Values.StereoInputStageTimeMS = m_depthReconstruction->GetInputStagePerfTime();
+	clientData.Values.StereoMatchingStageTimeMS = m_depthReconstruction->GetMatchingStagePerfTime();
+	clientData.Values.StereoOutputStageTimeMS = m_depthReconstruction->GetOutputStagePerfTime();
+	clientData.Values.StereoInputQueueDepth = m_depthReconstruction->GetInputQueueDepth();
+	clientData.Values.StereoDisparityQueueDepth = m_depthReconstruction->GetDisparityQueueDepth();
+	clientData.Values.StereoInputQueueMaxDepth = m_depthReconstruction->GetInputQueueMaxDepth();
+	clientData.Values.StereoDisparityQueueMaxDepth = m_depthReconstruction->GetDisparityQueueMaxDepth();
+	clientData.Values.StereoInputQueueLatencyMS = m_depthReconstruction->GetInputQueueLatency();
+	clientData.Values.StereoDisparityQueueLatencyMS = m_depthReconstruction->GetDisparityQueueLatency();
+	clientData.Values.StereoInputWakeupsPerSec = m_depthReconstruction->GetInputWakeupRate();
+	clientData.Values.bStereoGroundTruthAvailable = m_depthReconstruction->HasGroundTruth();
+	clientData.Values.StereoBadPixelRate = m_depthReconstruction->GetBadPixelRate();
+	clientData.Values.StereoInvalidPixelRate = m_depthReconstruction->GetInvalidPixelRate();
+	clientData.Values.StereoDisparitySearchFraction = m_depthReconstruction->GetDisparitySearchFraction();
+	clientData.Values.StereoRecomputedFraction = m_depthReconstruction->GetRecomputedFraction();
+	clientData.Values.bStereoGovernorActive = m_depthReconstruction->IsGovernorActive();
+	clientData.Values.StereoGovernorLevel = m_depthReconstruction->GetGovernorLevel();
+	clientData.Values.StereoGovernorTimeMS = m_depthReconstruction->GetGovernorAverageTime();
 
 	clientData.Values.GPUFrameRetrievalTimeMS = m_cameraManager->GetGPUFrameRetrievalPerfTime();
 	clientData.Values.CPUFrameRetrievalTimeMS = m_cameraManager->GetCPUFrameRetrievalPerfTime();
+	clientData.Values.CameraCaptureStageLatencyMS = m_cameraManager->GetCaptureStageLatency();
+	clientData.Values.CameraUploadQueueLatencyMS = m_cameraManager->GetUploadQueueLatency();
+	clientData.Values.CameraServeWakeupsPerSec = m_cameraManager->GetServeThreadWakeupRate();
+	clientData.Values.CameraGPUQueueStats = m_cameraManager->GetGPUFrameQueueStats();
+	clientData.Values.CameraCPUQueueStats = m_cameraManager->GetCPUFrameQueueStats();
+	clientData.Values.DepthQueueStats = m_depthReconstruction->GetDepthFrameQueueStats();
 
 	return true;
 }
@@ -1121,14 +1188,16 @@ void PassthroughSystem::UpdateRenderModels(const uint64_t cameraFrameTimestamp)
 	}
 
 	
-	double exposureRelativeTime = -GetPerfTimeDiffSeconds(cameraFrameTimestamp, GetCurrentTimeSytemTicks());
-
-	std::vector<vr::TrackedDevicePose_t> poses(numDevices + 1);
+	vr::HmdMatrix34_t poses[vr::k_unMaxTrackedDeviceCount];
+	bool bPoseValid[vr::k_unMaxTrackedDeviceCount];
 
-	m_openVRManager->GetVRSystem()->GetDeviceToAbsoluteTrackingPose(vr::TrackingUniverseStanding, (float)exposureRelativeTime, poses.data(), numDevices + 1);
+	m_openVRManager->GetPoseHistory()->GetAllDevicePosesForTime(cameraFrameTimestamp, poses, bPoseValid, numDevices + 1);
 
 	for (RenderModel& model : *m_renderModels.get())
 	{
-		model.meshToWorldTransform = ToXRMatrix4x4(poses[model.deviceId].mDeviceToAbsoluteTracking);
+		if ((int)model.deviceId <= numDevices && bPoseValid[model.deviceId])
+		{
+			model.meshToWorldTransform = ToXRMatrix4x4(poses[model.deviceId]);
+		}
 	}
 }
@@ -37,15 +37,24 @@
 #include <mutex>
 #include <shared_mutex>
 #include <limits>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <cmath>
+#include <cstring>
 
 using namespace std::chrono_literals;
 
 
 #define XR_NO_PROTOTYPES
-#define XR_USE_PLATFORM_WIN32
-
 
+// Only the layer itself needs Windows. The CPU side parts are also built elsewhere, by the stereo benchmark.
+#ifdef _WIN32
+#define XR_USE_PLATFORM_WIN32
 #define XR_USE_GRAPHICS_API_OPENGL
+#endif
+
 #define XR_USE_GRAPHICS_API_VULKAN
 
 #ifdef XR_USE_PLATFORM_WIN32
@@ -66,9 +75,17 @@ using namespace std::chrono_literals;
 
 	using Microsoft::WRL::ComPtr;
 
+#else
+
+	// Shared texture handles are only used with the Windows renderers, but are part of the common structs.
+	typedef void* HANDLE;
+	#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+
 #endif
 
+#ifdef XR_USE_GRAPHICS_API_OPENGL
 #include <GL/gl.h>
+#endif
 #include "volk.h"
 
 #include <openxr/openxr.h>
@@ -94,8 +111,10 @@ using namespace std::chrono_literals;
 #include <XrToString.h>
 #endif
 
+#ifdef _WIN32
 #define SPDLOG_WCHAR_FILENAMES
 #define SPDLOG_WCHAR_TO_UTF8_SUPPORT
+#endif
 #include "spdlog/spdlog.h"
 #include "spdlog/sinks/dup_filter_sink.h"
 
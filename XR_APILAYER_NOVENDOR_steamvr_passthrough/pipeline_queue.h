@@ -0,0 +1,106 @@
+#pragma once
+
+#include <condition_variable>
+#include "perfutil.h"
+
+
+// Bounded single producer, single consumer FIFO for passing frames between pipeline stages.
+// The entries are allocated up front and reused, so any buffers inside them keep their allocations.
+// An entry returned by BeginWrite or BeginRead stays owned by the caller until the matching End call.
+template<typename T> class PipelineQueue
+{
+public:
+	PipelineQueue(int numEntries)
+		: m_entries(numEntries)
+		, m_enqueueTimes(numEntries, 0)
+	{
+	}
+
+	// Waits for a free entry. Returns nullptr on timeout. Calling again without EndWrite returns the same entry.
+	T* BeginWrite(const std::chrono::microseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		if (!m_condition.wait_for(lock, timeout, [this] { return m_numQueued < m_entries.size(); }))
+		{
+			return nullptr;
+		}
+
+		return &m_entries[m_writeIndex];
+	}
+
+	void EndWrite()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			m_enqueueTimes[m_writeIndex] = GetCurrentTimeSytemTicks();
+			m_writeIndex = (m_writeIndex + 1) % m_entries.size();
+			m_numQueued++;
+			m_maxQueued = (std::max)(m_maxQueued, m_numQueued);
+		}
+		m_condition.notify_all();
+	}
+
+	// Waits for a queued entry. Returns nullptr on timeout. Calling again without EndRead returns the same entry.
+	T* BeginRead(const std::chrono::microseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		if (!m_condition.wait_for(lock, timeout, [this] { return m_numQueued > 0; }))
+		{
+			return nullptr;
+		}
+
+		if (m_enqueueTimes[m_readIndex] != 0)
+		{
+			m_latencyTimer.AveragesAddTimeToNow(m_enqueueTimes[m_readIndex]);
+			m_enqueueTimes[m_readIndex] = 0;
+		}
+
+		return &m_entries[m_readIndex];
+	}
+
+	void EndRead()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			m_readIndex = (m_readIndex + 1) % m_entries.size();
+			m_numQueued--;
+		}
+		m_condition.notify_all();
+	}
+
+	uint32_t GetNumQueued()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return (uint32_t)m_numQueued;
+	}
+
+	// Highest number of entries queued at once, for checking if the queue size is sufficient.
+	uint32_t GetMaxQueued()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return (uint32_t)m_maxQueued;
+	}
+
+	// Average time entries have waited in the queue before being read.
+	float GetAverageLatencyMS()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_latencyTimer.GetAverageTimeMS();
+	}
+
+private:
+	std::vector<T> m_entries;
+	std::vector<uint64_t> m_enqueueTimes;
+	size_t m_writeIndex = 0;
+	size_t m_readIndex = 0;
+	size_t m_numQueued = 0;
+	size_t m_maxQueued = 0;
+
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	PerfTimer m_latencyTimer{ 20 };
+};
@@ -0,0 +1,242 @@
+
+#include "pch.h"
+#include "pose_history.h"
+#include "openvr_manager.h"
+#include "mathutil.h"
+#include "perfutil.h"
+
+
+PoseHistory::PoseHistory(OpenVRManager* openVRManager)
+    : m_openVRManager(openVRManager)
+{
+}
+
+PoseHistory::~PoseHistory()
+{
+    m_bRunThread = false;
+
+    if (m_samplerThread.joinable())
+    {
+        m_samplerThread.join();
+    }
+}
+
+void PoseHistory::EnsureSamplerRunning()
+{
+    if (m_bThreadStarted.load(std::memory_order_acquire)) { return; }
+
+    std::lock_guard<std::mutex> lock(m_startMutex);
+
+    if (m_bThreadStarted.load(std::memory_order_relaxed)) { return; }
+
+    m_bRunThread = true;
+    m_samplerThread = std::thread(&PoseHistory::RunSamplerThread, this);
+    m_bThreadStarted.store(true, std::memory_order_release);
+}
+
+void PoseHistory::RunSamplerThread()
+{
+    vr::TrackedDevicePose_t poses[vr::k_unMaxTrackedDeviceCount];
+    auto nextSampleTime = std::chrono::steady_clock::now();
+
+    while (m_bRunThread)
+    {
+        nextSampleTime += POSE_HISTORY_SAMPLE_INTERVAL;
+
+        vr::IVRSystem* vrSystem = m_openVRManager->GetVRSystem();
+
+        if (vrSystem)
+        {
+            uint64_t sampleTime = GetCurrentTimeSytemTicks();
+            vrSystem->GetDeviceToAbsoluteTrackingPose(vr::TrackingUniverseStanding, 0.0f, poses, vr::k_unMaxTrackedDeviceCount);
+
+            uint64_t numWritten = m_numWritten.load(std::memory_order_relaxed);
+            PoseSample& sample = m_samples[numWritten % POSE_HISTORY_NUM_SAMPLES];
+
+            uint32_t sequence = sample.Sequence.load(std::memory_order_relaxed);
+            sample.Sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            sample.SampleTime = sampleTime;
+            for (uint32_t i = 0; i < vr::k_unMaxTrackedDeviceCount; i++)
+            {
+                sample.Poses[i] = poses[i].mDeviceToAbsoluteTracking;
+                sample.bPoseValid[i] = poses[i].bPoseIsValid;
+            }
+
+            sample.Sequence.store(sequence + 2, std::memory_order_release);
+            m_numWritten.store(numWritten + 1, std::memory_order_release);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (nextSampleTime < now)
+        {
+            // Don't try to catch up on missed samples.
+            nextSampleTime = now;
+        }
+        else
+        {
+            std::this_thread::sleep_until(nextSampleTime);
+        }
+    }
+}
+
+bool PoseHistory::ReadSampleTime(const uint64_t index, uint64_t& outTime)
+{
+    const PoseSample& sample = m_samples[index % POSE_HISTORY_NUM_SAMPLES];
+
+    uint32_t sequence = sample.Sequence.load(std::memory_order_acquire);
+    if (sequence & 1) { return false; }
+
+    outTime = sample.SampleTime;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return sample.Sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+bool PoseHistory::ReadSamplePose(const uint64_t index, const uint32_t deviceIndex, vr::HmdMatrix34_t& outPose, bool& outValid)
+{
+    const PoseSample& sample = m_samples[index % POSE_HISTORY_NUM_SAMPLES];
+
+    uint32_t sequence = sample.Sequence.load(std::memory_order_acquire);
+    if (sequence & 1) { return false; }
+
+    outPose = sample.Poses[deviceIndex];
+    outValid = sample.bPoseValid[deviceIndex];
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return sample.Sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+bool PoseHistory::FindSamplesForTime(const uint64_t time, uint64_t& outOlderIndex, uint64_t& outNewerIndex, float& outFactor)
+{
+    uint64_t numWritten = m_numWritten.load(std::memory_order_acquire);
+    if (numWritten < 2) { return false; }
+
+    // The oldest slot may be getting overwritten, so leave it out.
+    uint64_t oldestIndex = numWritten > POSE_HISTORY_NUM_SAMPLES - 1 ? numWritten - (POSE_HISTORY_NUM_SAMPLES - 1) : 0;
+
+    uint64_t newerIndex = numWritten - 1;
+    uint64_t newerTime;
+    if (!ReadSampleTime(newerIndex, newerTime)) { return false; }
+
+    // Predicting into the future is left to the runtime.
+    if (time > newerTime) { return false; }
+
+    // Most queries are for the last few tens of milliseconds, so a linear search from the newest sample is enough.
+    while (newerIndex > oldestIndex)
+    {
+        uint64_t olderIndex = newerIndex - 1;
+        uint64_t olderTime;
+        if (!ReadSampleTime(olderIndex, olderTime)) { return false; }
+
+        if (olderTime <= time)
+        {
+            outOlderIndex = olderIndex;
+            outNewerIndex = newerIndex;
+            outFactor = newerTime > olderTime ? (float)((double)(time - olderTime) / (double)(newerTime - olderTime)) : 0.0f;
+            return true;
+        }
+
+        newerIndex = olderIndex;
+        newerTime = olderTime;
+    }
+
+    return false;
+}
+
+bool PoseHistory::InterpolateDevicePose(const uint32_t deviceIndex, const uint64_t olderIndex, const uint64_t newerIndex, const float factor, vr::HmdMatrix34_t& outPose)
+{
+    vr::HmdMatrix34_t olderPose, newerPose;
+    bool bOlderValid, bNewerValid;
+
+    if (!ReadSamplePose(olderIndex, deviceIndex, olderPose, bOlderValid) ||
+        !ReadSamplePose(newerIndex, deviceIndex, newerPose, bNewerValid) ||
+        !bOlderValid || !bNewerValid)
+    {
+        return false;
+    }
+
+    outPose = InterpolateHMDMatrix(olderPose, newerPose, factor);
+    return true;
+}
+
+bool PoseHistory::GetDevicePoseForTime(const uint32_t deviceIndex, const uint64_t time, vr::HmdMatrix34_t& outPose)
+{
+    if (deviceIndex >= vr::k_unMaxTrackedDeviceCount) { return false; }
+
+    EnsureSamplerRunning();
+
+    uint64_t olderIndex, newerIndex;
+    float factor;
+
+    if (FindSamplesForTime(time, olderIndex, newerIndex, factor) &&
+        InterpolateDevicePose(deviceIndex, olderIndex, newerIndex, factor, outPose))
+    {
+        return true;
+    }
+
+    vr::IVRSystem* vrSystem = m_openVRManager->GetVRSystem();
+    if (!vrSystem) { return false; }
+
+    vr::TrackedDevicePose_t poses[vr::k_unMaxTrackedDeviceCount];
+    vrSystem->GetDeviceToAbsoluteTrackingPose(vr::TrackingUniverseStanding, (float)GetPerfTimeDiffSeconds(GetCurrentTimeSytemTicks(), time), poses, deviceIndex + 1);
+
+    outPose = poses[deviceIndex].mDeviceToAbsoluteTracking;
+    return poses[deviceIndex].bPoseIsValid;
+}
+
+void PoseHistory::GetAllDevicePosesForTime(const uint64_t time, vr::HmdMatrix34_t* outPoses, bool* outValid, const uint32_t numDevices)
+{
+    uint32_t deviceCount = min(numDevices, vr::k_unMaxTrackedDeviceCount);
+
+    for (uint32_t i = 0; i < deviceCount; i++)
+    {
+        outValid[i] = false;
+    }
+
+    EnsureSamplerRunning();
+
+    uint64_t olderIndex, newerIndex;
+    float factor;
+    bool bNeedRuntimeQuery = true;
+
+    if (FindSamplesForTime(time, olderIndex, newerIndex, factor))
+    {
+        bNeedRuntimeQuery = false;
+
+        for (uint32_t i = 0; i < deviceCount; i++)
+        {
+            vr::HmdMatrix34_t olderPose, newerPose;
+            bool bOlderValid, bNewerValid;
+
+            if (!ReadSamplePose(olderIndex, i, olderPose, bOlderValid) ||
+                !ReadSamplePose(newerIndex, i, newerPose, bNewerValid))
+            {
+                // The samples got overwritten while reading.
+                bNeedRuntimeQuery = true;
+                break;
+            }
+
+            if (bOlderValid && bNewerValid)
+            {
+                outPoses[i] = InterpolateHMDMatrix(olderPose, newerPose, factor);
+                outValid[i] = true;
+            }
+        }
+    }
+
+    if (!bNeedRuntimeQuery) { return; }
+
+    vr::IVRSystem* vrSystem = m_openVRManager->GetVRSystem();
+    if (!vrSystem) { return; }
+
+    vr::TrackedDevicePose_t poses[vr::k_unMaxTrackedDeviceCount];
+    vrSystem->GetDeviceToAbsoluteTrackingPose(vr::TrackingUniverseStanding, (float)GetPerfTimeDiffSeconds(GetCurrentTimeSytemTicks(), time), poses, deviceCount);
+
+    for (uint32_t i = 0; i < deviceCount; i++)
+    {
+        outPoses[i] = poses[i].mDeviceToAbsoluteTracking;
+        outValid[i] = poses[i].bPoseIsValid;
+    }
+}
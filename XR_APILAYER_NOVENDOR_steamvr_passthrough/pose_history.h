@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include "layer_structs.h"
+
+class OpenVRManager;
+
+
+#define POSE_HISTORY_NUM_SAMPLES 256
+#define POSE_HISTORY_SAMPLE_INTERVAL (std::chrono::milliseconds(2))
+
+
+// Samples the poses of all tracked devices at a fixed rate into a ring buffer, so that
+// consumers can get a pose for any recent timestamp without querying the runtime themselves.
+// The sampler thread is the only writer. Each slot is guarded by a sequence counter that is odd
+// while the slot is being written, and readers retry if it changed during their copy.
+class PoseHistory
+{
+public:
+	PoseHistory(OpenVRManager* openVRManager);
+	~PoseHistory();
+
+	// Gets the device pose in standing space at the given system tick time, interpolated between the two nearest samples.
+	// Times outside of the sampled range fall back to querying the runtime with a relative prediction time.
+	bool GetDevicePoseForTime(const uint32_t deviceIndex, const uint64_t time, vr::HmdMatrix34_t& outPose);
+
+	// Gets the poses of all devices at the given time. Only the indices where outValid is set are filled in.
+	void GetAllDevicePosesForTime(const uint64_t time, vr::HmdMatrix34_t* outPoses, bool* outValid, const uint32_t numDevices);
+
+private:
+	struct PoseSample
+	{
+		std::atomic<uint32_t> Sequence = 0;
+		uint64_t SampleTime = 0;
+		vr::HmdMatrix34_t Poses[vr::k_unMaxTrackedDeviceCount];
+		bool bPoseValid[vr::k_unMaxTrackedDeviceCount];
+	};
+
+	void EnsureSamplerRunning();
+	void RunSamplerThread();
+	bool ReadSampleTime(const uint64_t index, uint64_t& outTime);
+	bool ReadSamplePose(const uint64_t index, const uint32_t deviceIndex, vr::HmdMatrix34_t& outPose, bool& outValid);
+	bool FindSamplesForTime(const uint64_t time, uint64_t& outOlderIndex, uint64_t& outNewerIndex, float& outFactor);
+	bool InterpolateDevicePose(const uint32_t deviceIndex, const uint64_t olderIndex, const uint64_t newerIndex, const float factor, vr::HmdMatrix34_t& outPose);
+
+	OpenVRManager* m_openVRManager;
+
+	std::thread m_samplerThread;
+	std::mutex m_startMutex;
+	std::atomic_bool m_bRunThread = false;
+	std::atomic_bool m_bThreadStarted = false;
+
+	PoseSample m_samples[POSE_HISTORY_NUM_SAMPLES];
+
+	// Total number of samples written. The newest sample is in slot (m_numWritten - 1) % POSE_HISTORY_NUM_SAMPLES.
+	std::atomic<uint64_t> m_numWritten = 0;
+};
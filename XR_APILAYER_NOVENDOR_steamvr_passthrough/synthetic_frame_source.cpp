@@ -0,0 +1,419 @@
+#include "pch.h"
+
+#include "synthetic_frame_source.h"
+#include "mathutil.h"
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+
+#define SYNTHETIC_SCENE_SEED 1234
+#define SYNTHETIC_HEAD_HEIGHT 1.6f
+#define SYNTHETIC_POSE_SCRIPT_FREQUENCY 0.2
+
+
+bool SyntheticFrameSource::Init(const Config_Camera& cameraConf)
+{
+    m_source = cameraConf.Synthetic_Source;
+    m_frameFormat = cameraConf.Synthetic_FrameFormat;
+    m_frameLayout = cameraConf.Synthetic_FrameLayout;
+
+    if (m_frameFormat == FrameFormat_Unknown || m_frameFormat > FrameFormat_RGBX32)
+    {
+        g_logger->warn("Invalid synthetic camera frame format {}, using RGBX", (int32_t)m_frameFormat);
+        m_frameFormat = FrameFormat_RGBX32;
+    }
+
+    if (m_source == SyntheticCameraSource_ReplayFile)
+    {
+        if (!m_replayCapture.open(cameraConf.Synthetic_ReplayFile))
+        {
+            g_logger->error("Failed to open synthetic camera replay file: {}", cameraConf.Synthetic_ReplayFile);
+            return false;
+        }
+
+        m_cameraTextureWidth = (uint32_t)m_replayCapture.get(cv::CAP_PROP_FRAME_WIDTH);
+        m_cameraTextureHeight = (uint32_t)m_replayCapture.get(cv::CAP_PROP_FRAME_HEIGHT);
+    }
+    else
+    {
+        m_scene = std::make_unique<SyntheticScene>(SYNTHETIC_SCENE_SEED);
+        m_scene->AddRoom(4.0f, 6.0f, 2.5f);
+
+        // Free standing panels at a few distances, to give the depth some variation.
+        m_scene->AddPlane({ -0.6f, 1.2f, -1.5f }, { 1.0f, 0.0f, 0.2f }, { 0.0f, 1.0f, 0.0f }, 0.4f, 0.5f, 0.5f);
+        m_scene->AddPlane({ 0.8f, 1.0f, -2.2f }, { 1.0f, 0.0f, -0.3f }, { 0.0f, 1.0f, 0.0f }, 0.5f, 0.7f, 0.7f);
+
+        // Boxes for depth discontinuities and occlusions close to the camera.
+        m_scene->AddBox({ 0.25f, 0.36f, -1.1f }, { 0.3f, 0.35f, 0.25f }, 0.3f);
+        m_scene->AddBox({ -0.9f, 0.26f, -0.9f }, { 0.2f, 0.25f, 0.2f }, -0.5f);
+        m_scene->AddBox({ 0.0f, 1.9f, -2.6f }, { 0.6f, 0.15f, 0.15f }, 0.0f);
+
+        uint32_t eyeWidth = (uint32_t)max(cameraConf.Synthetic_FrameDimensions[0], 8);
+        uint32_t eyeHeight = (uint32_t)max(cameraConf.Synthetic_FrameDimensions[1], 8);
+
+        m_cameraTextureWidth = m_frameLayout == FrameLayout_StereoHorizontal ? eyeWidth * 2 : eyeWidth;
+        m_cameraTextureHeight = m_frameLayout == FrameLayout_StereoVertical ? eyeHeight * 2 : eyeHeight;
+    }
+
+    // Keep the dimensions divisible for the packed and subsampled formats, for both eyes of the frame.
+    m_cameraTextureWidth &= ~7u;
+    m_cameraTextureHeight &= ~7u;
+
+    if (m_cameraTextureWidth == 0 || m_cameraTextureHeight == 0)
+    {
+        g_logger->error("Invalid synthetic camera frame size: Width = {}, Height = {}", m_cameraTextureWidth, m_cameraTextureHeight);
+        Deinit();
+        return false;
+    }
+
+    m_renderedFrame = cv::Mat(m_cameraTextureHeight, m_cameraTextureWidth, CV_8UC4, cv::Scalar(0, 0, 0, 255));
+
+    UpdateParameters(cameraConf);
+
+    return true;
+}
+
+void SyntheticFrameSource::Deinit()
+{
+    m_replayCapture.release();
+    m_scene.reset();
+}
+
+void SyntheticFrameSource::UpdateParameters(const Config_Camera& cameraConf)
+{
+    m_frameRate = std::clamp(cameraConf.Synthetic_FrameRate, 1.0f, 1000.0f);
+    m_baseline = cameraConf.Synthetic_Baseline;
+    memcpy(m_distortion, cameraConf.Synthetic_Distortion, sizeof(m_distortion));
+    m_poseScript = cameraConf.Synthetic_PoseScript;
+    m_poseScriptSpeed = cameraConf.Synthetic_PoseScriptSpeed;
+
+    if (m_frameLayout == EStereoFrameLayout::FrameLayout_StereoVertical)
+    {
+        m_cameraFrameWidth = m_cameraTextureWidth;
+        m_cameraFrameHeight = m_cameraTextureHeight / 2;
+    }
+    else if (m_frameLayout == EStereoFrameLayout::FrameLayout_StereoHorizontal)
+    {
+        m_cameraFrameWidth = m_cameraTextureWidth / 2;
+        m_cameraFrameHeight = m_cameraTextureHeight;
+    }
+    else // Mono
+    {
+        m_cameraFrameWidth = m_cameraTextureWidth;
+        m_cameraFrameHeight = m_cameraTextureHeight;
+    }
+
+    float fov = std::clamp(cameraConf.Synthetic_FieldOfView, 10.0f, 170.0f);
+    float focal = (m_cameraFrameWidth * 0.5f) / tanf(DegToRad(fov) * 0.5f);
+
+    m_focalLength = { focal, focal };
+    m_center = { m_cameraFrameWidth * 0.5f, m_cameraFrameHeight * 0.5f };
+
+    if (m_source == SyntheticCameraSource_TestScene)
+    {
+        SyntheticScene::CreateViewRays(m_cameraFrameWidth, m_cameraFrameHeight, m_focalLength, m_center, m_distortion, m_viewRays);
+    }
+}
+
+XrMatrix4x4f SyntheticFrameSource::GetScriptedHMDPose(const double timeSeconds) const
+{
+    double phase = 2.0 * M_PI * SYNTHETIC_POSE_SCRIPT_FREQUENCY * m_poseScriptSpeed * timeSeconds;
+
+    XrVector3f position = { 0.0f, SYNTHETIC_HEAD_HEIGHT, 0.0f };
+    float yaw = 0.0f;
+
+    switch (m_poseScript)
+    {
+    case SyntheticPoseScript_YawSweep:
+        yaw = (float)(sin(phase) * DegToRad(30.0));
+        break;
+
+    case SyntheticPoseScript_Strafe:
+        position.x = (float)(sin(phase) * 0.3);
+        position.z = (float)(cos(phase * 0.5) * 0.2);
+        break;
+
+    case SyntheticPoseScript_Static:
+    default:
+        break;
+    }
+
+    XrVector3f up = { 0.0f, 1.0f, 0.0f };
+    XrVector3f scale = { 1.0f, 1.0f, 1.0f };
+    XrQuaternionf rotation;
+    XrQuaternionf_CreateFromAxisAngle(&rotation, &up, yaw);
+
+    XrMatrix4x4f pose;
+    XrMatrix4x4f_CreateTranslationRotationScale(&pose, &position, &rotation, &scale);
+    return pose;
+}
+
+bool SyntheticFrameSource::RenderFrame(const double timeSeconds, CameraCPUFrame& outFrame)
+{
+    XrMatrix4x4f hmdPose = GetScriptedHMDPose(timeSeconds);
+
+    // Ground truth is only known for the test scene.
+    cv::Mat groundTruthPoints;
+    if (m_source == SyntheticCameraSource_TestScene)
+    {
+        size_t numValues = (size_t)m_cameraFrameWidth * m_cameraFrameHeight * 3;
+
+        if (outFrame.GroundTruthPoints.get() == nullptr || outFrame.GroundTruthPoints->size() != numValues)
+        {
+            outFrame.GroundTruthPoints = std::make_shared<std::vector<float>>(numValues);
+        }
+
+        groundTruthPoints = cv::Mat(m_cameraFrameHeight, m_cameraFrameWidth, CV_32FC3, outFrame.GroundTruthPoints->data());
+    }
+    else
+    {
+        outFrame.GroundTruthPoints.reset();
+    }
+
+    if (!RenderScene(hmdPose, groundTruthPoints.empty() ? nullptr : &groundTruthPoints))
+    {
+        return false;
+    }
+
+    if (m_frameFormat == FrameFormat_MJPEG)
+    {
+        cv::cvtColor(m_renderedFrame, m_encodeBuffer, cv::COLOR_RGBA2BGR);
+        cv::imencode(".jpg", m_encodeBuffer, m_encodedJPEG);
+    }
+
+    XrMatrix4x4f leftToHead, rightToHead;
+    XrMatrix4x4f_CreateTranslation(&leftToHead, m_frameLayout == FrameLayout_Mono ? 0.0f : -m_baseline * 0.5f, 0.0f, 0.0f);
+    XrMatrix4x4f_CreateTranslation(&rightToHead, m_frameLayout == FrameLayout_Mono ? 0.0f : m_baseline * 0.5f, 0.0f, 0.0f);
+    XrMatrix4x4f_Multiply(&outFrame.CameraViewToWorldLeft, &hmdPose, &leftToHead);
+    XrMatrix4x4f_Multiply(&outFrame.CameraViewToWorldRight, &hmdPose, &rightToHead);
+
+    outFrame.bIsValid = true;
+    outFrame.bIsRaw = true;
+    outFrame.RawFrameFormat = m_frameFormat;
+    outFrame.RawFrameDataBytes = GetEncodedFrameSize();
+    outFrame.RawFrameSize = { m_cameraTextureWidth, m_cameraTextureHeight };
+    outFrame.FrameLayout = m_frameLayout;
+    outFrame.FrameSize = { m_cameraTextureWidth, m_cameraTextureHeight };
+
+    return true;
+}
+
+bool SyntheticFrameSource::RenderScene(const XrMatrix4x4f& hmdPose, cv::Mat* outLeftPoints)
+{
+    if (m_source == SyntheticCameraSource_ReplayFile)
+    {
+        if (!m_replayCapture.read(m_replayFrame) || m_replayFrame.empty())
+        {
+            // Loop the file.
+            m_replayCapture.set(cv::CAP_PROP_POS_FRAMES, 0);
+
+            if (!m_replayCapture.read(m_replayFrame) || m_replayFrame.empty())
+            {
+                g_logger->error("Failed to read synthetic camera replay frame!");
+                return false;
+            }
+        }
+
+        if (m_replayFrame.cols != (int)m_cameraTextureWidth || m_replayFrame.rows != (int)m_cameraTextureHeight)
+        {
+            cv::resize(m_replayFrame, m_replayFrame, cv::Size(m_cameraTextureWidth, m_cameraTextureHeight), 0.0, 0.0, cv::INTER_AREA);
+        }
+
+        cv::cvtColor(m_replayFrame, m_renderedFrame, m_replayFrame.channels() == 1 ? cv::COLOR_GRAY2RGBA : cv::COLOR_BGR2RGBA);
+        return true;
+    }
+
+    XrMatrix4x4f leftToHead, rightToHead, leftToWorld, rightToWorld;
+    XrMatrix4x4f_CreateTranslation(&leftToHead, -m_baseline * 0.5f, 0.0f, 0.0f);
+    XrMatrix4x4f_CreateTranslation(&rightToHead, m_baseline * 0.5f, 0.0f, 0.0f);
+    XrMatrix4x4f_Multiply(&leftToWorld, &hmdPose, &leftToHead);
+    XrMatrix4x4f_Multiply(&rightToWorld, &hmdPose, &rightToHead);
+
+    if (m_frameLayout == FrameLayout_Mono)
+    {
+        m_scene->Render(hmdPose, m_viewRays, m_renderedFrame, outLeftPoints);
+    }
+    else
+    {
+        // Same eye placement as the depth reconstruction expects.
+        cv::Rect leftROI, rightROI;
+
+        if (m_frameLayout == FrameLayout_StereoHorizontal)
+        {
+            leftROI = cv::Rect(0, 0, m_cameraFrameWidth, m_cameraFrameHeight);
+            rightROI = cv::Rect(m_cameraFrameWidth, 0, m_cameraFrameWidth, m_cameraFrameHeight);
+        }
+        else
+        {
+            leftROI = cv::Rect(0, m_cameraFrameHeight, m_cameraFrameWidth, m_cameraFrameHeight);
+            rightROI = cv::Rect(0, 0, m_cameraFrameWidth, m_cameraFrameHeight);
+        }
+
+        cv::Mat leftFrame = m_renderedFrame(leftROI);
+        cv::Mat rightFrame = m_renderedFrame(rightROI);
+
+        m_scene->Render(leftToWorld, m_viewRays, leftFrame, outLeftPoints);
+        m_scene->Render(rightToWorld, m_viewRays, rightFrame);
+    }
+
+    return true;
+}
+
+uint32_t SyntheticFrameSource::GetEncodedFrameSize() const
+{
+    uint32_t numPixels = m_cameraTextureWidth * m_cameraTextureHeight;
+
+    switch (m_frameFormat)
+    {
+    case FrameFormat_RGB24:
+        return numPixels * 3;
+
+    case FrameFormat_YUYV16:
+    case FrameFormat_BAYER16BG:
+        return numPixels * 2;
+
+    case FrameFormat_NV12:
+    case FrameFormat_NV12_2:
+        return numPixels * 3 / 2;
+
+    case FrameFormat_RAW10:
+        return numPixels * 5 / 4;
+
+    case FrameFormat_MJPEG:
+        return (uint32_t)m_encodedJPEG.size();
+
+    case FrameFormat_RGBX32:
+    default:
+        return numPixels * 4;
+    }
+}
+
+// Converts a region of a RGBX image to a NV12 luma plane and interleaved chroma plane.
+static void EncodeNV12(const cv::Mat& rgbx, cv::Mat& yuvBuffer, uint8_t* outData)
+{
+    cv::cvtColor(rgbx, yuvBuffer, cv::COLOR_RGBA2YUV_I420);
+
+    int lumaSize = rgbx.cols * rgbx.rows;
+    int chromaSize = lumaSize / 4;
+
+    const uint8_t* planeU = yuvBuffer.data + lumaSize;
+    const uint8_t* planeV = planeU + chromaSize;
+
+    memcpy(outData, yuvBuffer.data, lumaSize);
+
+    uint8_t* chroma = outData + lumaSize;
+    for (int i = 0; i < chromaSize; i++)
+    {
+        chroma[i * 2] = planeU[i];
+        chroma[i * 2 + 1] = planeV[i];
+    }
+}
+
+void SyntheticFrameSource::EncodeFrame(uint8_t* outData)
+{
+    switch (m_frameFormat)
+    {
+    case FrameFormat_RGB24:
+    {
+        cv::Mat output(m_cameraTextureHeight, m_cameraTextureWidth, CV_8UC3, outData);
+        cv::cvtColor(m_renderedFrame, output, cv::COLOR_RGBA2RGB);
+        break;
+    }
+
+    case FrameFormat_YUYV16:
+    {
+        // Limited range BT.601, with the chroma averaged over each pixel pair.
+        cv::parallel_for_(cv::Range(0, m_cameraTextureHeight), [&](const cv::Range& range)
+        {
+            for (int y = range.start; y < range.end; y++)
+            {
+                const uint8_t* inRow = m_renderedFrame.ptr<uint8_t>(y);
+                uint8_t* outRow = outData + y * m_cameraTextureWidth * 2;
+
+                for (uint32_t x = 0; x < m_cameraTextureWidth; x += 2)
+                {
+                    const uint8_t* p0 = inRow + x * 4;
+                    const uint8_t* p1 = p0 + 4;
+
+                    float r = (p0[0] + p1[0]) * 0.5f;
+                    float g = (p0[1] + p1[1]) * 0.5f;
+                    float b = (p0[2] + p1[2]) * 0.5f;
+
+                    outRow[x * 2] = (uint8_t)(16.5f + 0.257f * p0[0] + 0.504f * p0[1] + 0.098f * p0[2]);
+                    outRow[x * 2 + 1] = (uint8_t)(128.5f - 0.148f * r - 0.291f * g + 0.439f * b);
+                    outRow[x * 2 + 2] = (uint8_t)(16.5f + 0.257f * p1[0] + 0.504f * p1[1] + 0.098f * p1[2]);
+                    outRow[x * 2 + 3] = (uint8_t)(128.5f + 0.439f * r - 0.368f * g - 0.071f * b);
+                }
+            }
+        });
+        break;
+    }
+
+    case FrameFormat_NV12:
+    {
+        EncodeNV12(m_renderedFrame, m_encodeBuffer, outData);
+        break;
+    }
+
+    case FrameFormat_NV12_2:
+    {
+        // The top and bottom halves are stored as separate NV12 images.
+        uint32_t halfHeight = m_cameraTextureHeight / 2;
+        EncodeNV12(m_renderedFrame(cv::Rect(0, 0, m_cameraTextureWidth, halfHeight)), m_encodeBuffer, outData);
+        EncodeNV12(m_renderedFrame(cv::Rect(0, halfHeight, m_cameraTextureWidth, halfHeight)), m_encodeBuffer, outData + m_cameraTextureWidth * halfHeight * 3 / 2);
+        break;
+    }
+
+    case FrameFormat_BAYER16BG:
+    {
+        // R G / G B quads with 10-bit samples.
+        for (uint32_t y = 0; y < m_cameraTextureHeight; y++)
+        {
+            const uint8_t* inRow = m_renderedFrame.ptr<uint8_t>(y);
+            uint16_t* outRow = reinterpret_cast<uint16_t*>(outData) + y * m_cameraTextureWidth;
+
+            for (uint32_t x = 0; x < m_cameraTextureWidth; x++)
+            {
+                int channel = (y & 1) == 0 ? ((x & 1) == 0 ? 0 : 1) : ((x & 1) == 0 ? 1 : 2);
+                outRow[x] = (uint16_t)inRow[x * 4 + channel] << 2;
+            }
+        }
+        break;
+    }
+
+    case FrameFormat_RAW10:
+    {
+        cv::cvtColor(m_renderedFrame, m_encodeBuffer, cv::COLOR_RGBA2GRAY);
+
+        for (uint32_t y = 0; y < m_cameraTextureHeight; y++)
+        {
+            const uint8_t* inRow = m_encodeBuffer.ptr<uint8_t>(y);
+            uint8_t* outRow = outData + y * m_cameraTextureWidth * 5 / 4;
+
+            for (uint32_t x = 0; x < m_cameraTextureWidth; x += 4)
+            {
+                uint8_t* group = outRow + x * 5 / 4;
+                group[0] = inRow[x];
+                group[1] = inRow[x + 1];
+                group[2] = inRow[x + 2];
+                group[3] = inRow[x + 3];
+                group[4] = 0;
+            }
+        }
+        break;
+    }
+
+    case FrameFormat_MJPEG:
+    {
+        memcpy(outData, m_encodedJPEG.data(), m_encodedJPEG.size());
+        break;
+    }
+
+    case FrameFormat_RGBX32:
+    default:
+    {
+        memcpy(outData, m_renderedFrame.data, (size_t)m_cameraTextureWidth * m_cameraTextureHeight * 4);
+        break;
+    }
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include <xr_linear.h>
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+#include "layer_structs.h"
+#include "config_manager.h"
+#include "synthetic_scene.h"
+
+
+// Renders frames from the procedural test scene or a video file with scripted HMD poses, and encodes them to the camera frame formats.
+// Does not depend on the runtime or the renderers, so that a standalone host can feed the frames to the stereo reconstruction.
+class SyntheticFrameSource
+{
+public:
+	bool Init(const Config_Camera& cameraConf);
+	void Deinit();
+
+	// Updates the parameters that can be changed without reinitializing.
+	void UpdateParameters(const Config_Camera& cameraConf);
+
+	// Renders the frame at the given time since the start, and fills in everything in the frame apart from the data, sequence and timestamps.
+	// The frame RawFrameDataBytes is set to the size needed by EncodeFrame.
+	bool RenderFrame(const double timeSeconds, CameraCPUFrame& outFrame);
+
+	// Encodes the last rendered frame to the frame format.
+	void EncodeFrame(uint8_t* outData);
+
+	// The last rendered frame in RGBX.
+	const cv::Mat& GetRenderedFrame() const { return m_renderedFrame; }
+
+	ECameraFrameFormat GetFrameFormat() const { return m_frameFormat; }
+	EStereoFrameLayout GetFrameLayout() const { return m_frameLayout; }
+	uint32_t GetTextureWidth() const { return m_cameraTextureWidth; }
+	uint32_t GetTextureHeight() const { return m_cameraTextureHeight; }
+	uint32_t GetFrameWidth() const { return m_cameraFrameWidth; }
+	uint32_t GetFrameHeight() const { return m_cameraFrameHeight; }
+	float GetFrameRate() const { return m_frameRate; }
+	float GetBaseline() const { return m_baseline; }
+	XrVector2f GetFocalLength() const { return m_focalLength; }
+	XrVector2f GetCenter() const { return m_center; }
+	const float* GetDistortion() const { return m_distortion; }
+
+private:
+	XrMatrix4x4f GetScriptedHMDPose(const double timeSeconds) const;
+	bool RenderScene(const XrMatrix4x4f& hmdPose, cv::Mat* outLeftPoints);
+	uint32_t GetEncodedFrameSize() const;
+
+	ESyntheticCameraSource m_source = SyntheticCameraSource_TestScene;
+	ECameraFrameFormat m_frameFormat = FrameFormat_RGBX32;
+	EStereoFrameLayout m_frameLayout = FrameLayout_StereoHorizontal;
+	ESyntheticPoseScript m_poseScript = SyntheticPoseScript_Static;
+	float m_poseScriptSpeed = 1.0f;
+	float m_frameRate = 60.0f;
+	float m_baseline = 0.064f;
+	float m_distortion[4] = { 0.0f };
+	XrVector2f m_focalLength = { 1.0f, 1.0f };
+	XrVector2f m_center = { 0.0f, 0.0f };
+
+	uint32_t m_cameraTextureWidth = 0;
+	uint32_t m_cameraTextureHeight = 0;
+	uint32_t m_cameraFrameWidth = 0;
+	uint32_t m_cameraFrameHeight = 0;
+
+	std::unique_ptr<SyntheticScene> m_scene;
+	cv::Mat m_viewRays;
+	cv::VideoCapture m_replayCapture;
+	cv::Mat m_replayFrame;
+
+	// Full RGBX frame before encoding to the output format.
+	cv::Mat m_renderedFrame;
+	cv::Mat m_encodeBuffer;
+	std::vector<uint8_t> m_encodedJPEG;
+};
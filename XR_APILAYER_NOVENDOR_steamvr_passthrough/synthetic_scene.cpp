@@ -0,0 +1,219 @@
+
+#include "pch.h"
+#include "synthetic_scene.h"
+#include <cfloat>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+
+
+#define SYNTHETIC_SCENE_NUM_TEXTURES 4
+#define SYNTHETIC_SCENE_TEXTURE_SIZE 256
+
+
+SyntheticScene::SyntheticScene(const uint32_t seed)
+{
+    CreateTextures(seed);
+}
+
+void SyntheticScene::CreateTextures(const uint32_t seed)
+{
+    cv::RNG rng(seed);
+
+    for (int i = 0; i < SYNTHETIC_SCENE_NUM_TEXTURES; i++)
+    {
+        // Sum of noise at a few scales, so that there is matchable detail both near and far.
+        cv::Mat texture = cv::Mat::zeros(SYNTHETIC_SCENE_TEXTURE_SIZE, SYNTHETIC_SCENE_TEXTURE_SIZE, CV_32FC3);
+
+        for (int octave = 8; octave <= SYNTHETIC_SCENE_TEXTURE_SIZE / 2; octave *= 4)
+        {
+            cv::Mat noise(octave, octave, CV_32FC3);
+            rng.fill(noise, cv::RNG::UNIFORM, cv::Scalar::all(-1.0), cv::Scalar::all(1.0));
+
+            cv::Mat scaledNoise;
+            cv::resize(noise, scaledNoise, texture.size(), 0.0, 0.0, cv::INTER_CUBIC);
+            texture += scaledNoise;
+        }
+
+        cv::Scalar tint(rng.uniform(80.0, 180.0), rng.uniform(80.0, 180.0), rng.uniform(80.0, 180.0));
+
+        texture = texture * 40.0 + tint;
+
+        cv::Mat texture8;
+        texture.convertTo(texture8, CV_8UC3);
+
+        m_textures.push_back(texture8);
+    }
+}
+
+void SyntheticScene::AddPlane(const XrVector3f& center, const XrVector3f& axisU, const XrVector3f& axisV, const float halfExtentU, const float halfExtentV, const float textureScale)
+{
+    SyntheticScenePlane plane;
+    plane.Center = center;
+    XrVector3f_Normalize(&plane.AxisU, &axisU);
+    XrVector3f_Normalize(&plane.AxisV, &axisV);
+    XrVector3f_Cross(&plane.Normal, &plane.AxisU, &plane.AxisV);
+    plane.HalfExtentU = halfExtentU;
+    plane.HalfExtentV = halfExtentV;
+    plane.TextureScale = textureScale;
+    plane.TextureIndex = m_nextTextureIndex;
+
+    m_nextTextureIndex = (m_nextTextureIndex + 1) % SYNTHETIC_SCENE_NUM_TEXTURES;
+
+    m_planes.push_back(plane);
+}
+
+void SyntheticScene::AddRoom(const float width, const float length, const float height)
+{
+    float halfWidth = width * 0.5f;
+    float halfLength = length * 0.5f;
+    float halfHeight = height * 0.5f;
+
+    // Floor and ceiling
+    AddPlane({ 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, -1.0f }, halfWidth, halfLength, 1.0f);
+    AddPlane({ 0.0f, height, 0.0f }, { 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, halfWidth, halfLength, 1.5f);
+
+    // Walls
+    AddPlane({ 0.0f, halfHeight, -halfLength }, { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, halfWidth, halfHeight, 1.0f);
+    AddPlane({ 0.0f, halfHeight, halfLength }, { -1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, halfWidth, halfHeight, 1.0f);
+    AddPlane({ -halfWidth, halfHeight, 0.0f }, { 0.0f, 0.0f, -1.0f }, { 0.0f, 1.0f, 0.0f }, halfLength, halfHeight, 1.0f);
+    AddPlane({ halfWidth, halfHeight, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f }, halfLength, halfHeight, 1.0f);
+}
+
+void SyntheticScene::AddBox(const XrVector3f& center, const XrVector3f& halfExtents, const float yaw)
+{
+    XrVector3f axisX = { cosf(yaw), 0.0f, -sinf(yaw) };
+    XrVector3f axisY = { 0.0f, 1.0f, 0.0f };
+    XrVector3f axisZ = { sinf(yaw), 0.0f, cosf(yaw) };
+
+    auto offset = [&](const XrVector3f& axis, const float distance)
+    {
+        return XrVector3f{ center.x + axis.x * distance, center.y + axis.y * distance, center.z + axis.z * distance };
+    };
+
+    // Front and back
+    AddPlane(offset(axisZ, halfExtents.z), axisX, axisY, halfExtents.x, halfExtents.y, 0.5f);
+    AddPlane(offset(axisZ, -halfExtents.z), axisX, axisY, halfExtents.x, halfExtents.y, 0.5f);
+
+    // Sides
+    AddPlane(offset(axisX, halfExtents.x), axisZ, axisY, halfExtents.z, halfExtents.y, 0.5f);
+    AddPlane(offset(axisX, -halfExtents.x), axisZ, axisY, halfExtents.z, halfExtents.y, 0.5f);
+
+    // Top and bottom
+    AddPlane(offset(axisY, halfExtents.y), axisX, axisZ, halfExtents.x, halfExtents.z, 0.5f);
+    AddPlane(offset(axisY, -halfExtents.y), axisX, axisZ, halfExtents.x, halfExtents.z, 0.5f);
+}
+
+void SyntheticScene::CreateViewRays(const uint32_t width, const uint32_t height, const XrVector2f& focalLength, const XrVector2f& center, const float distortion[4], cv::Mat& outRays)
+{
+    cv::Mat pixels(height * width, 1, CV_32FC2);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            pixels.at<cv::Vec2f>(y * width + x) = cv::Vec2f((float)x, (float)y);
+        }
+    }
+
+    cv::Matx33d intrinsics(focalLength.x, 0.0, center.x, 0.0, focalLength.y, center.y, 0.0, 0.0, 1.0);
+    cv::Vec4d distCoeffs(distortion[0], distortion[1], distortion[2], distortion[3]);
+
+    cv::undistortPoints(pixels, outRays, intrinsics, distCoeffs);
+    outRays = outRays.reshape(2, height);
+}
+
+void SyntheticScene::Render(const XrMatrix4x4f& cameraToWorld, const cv::Mat& viewRays, cv::Mat& outRGBX, cv::Mat* outPoints) const
+{
+    const XrVector3f origin = { cameraToWorld.m[12], cameraToWorld.m[13], cameraToWorld.m[14] };
+
+    cv::parallel_for_(cv::Range(0, outRGBX.rows), [&](const cv::Range& range)
+    {
+        for (int y = range.start; y < range.end; y++)
+        {
+            uint8_t* outRow = outRGBX.ptr<uint8_t>(y);
+            const cv::Vec2f* rayRow = viewRays.ptr<cv::Vec2f>(y);
+            cv::Vec3f* pointRow = outPoints ? outPoints->ptr<cv::Vec3f>(y) : nullptr;
+
+            for (int x = 0; x < outRGBX.cols; x++)
+            {
+                // The ray map is in OpenCV axes, with +Y down and +Z forward.
+                XrVector3f viewDir = { rayRow[x][0], -rayRow[x][1], -1.0f };
+
+                XrVector3f dir =
+                {
+                    cameraToWorld.m[0] * viewDir.x + cameraToWorld.m[4] * viewDir.y + cameraToWorld.m[8] * viewDir.z,
+                    cameraToWorld.m[1] * viewDir.x + cameraToWorld.m[5] * viewDir.y + cameraToWorld.m[9] * viewDir.z,
+                    cameraToWorld.m[2] * viewDir.x + cameraToWorld.m[6] * viewDir.y + cameraToWorld.m[10] * viewDir.z
+                };
+
+                float nearestDist = FLT_MAX;
+                const SyntheticScenePlane* nearestPlane = nullptr;
+                float nearestU = 0.0f, nearestV = 0.0f;
+
+                for (const SyntheticScenePlane& plane : m_planes)
+                {
+                    float denom = XrVector3f_Dot(&dir, &plane.Normal);
+                    if (fabsf(denom) < 1e-6f) { continue; }
+
+                    XrVector3f toPlane;
+                    XrVector3f_Sub(&toPlane, &plane.Center, &origin);
+                    float dist = XrVector3f_Dot(&toPlane, &plane.Normal) / denom;
+                    if (dist <= 0.0f || dist >= nearestDist) { continue; }
+
+                    XrVector3f hit = { origin.x + dir.x * dist - plane.Center.x, origin.y + dir.y * dist - plane.Center.y, origin.z + dir.z * dist - plane.Center.z };
+                    float u = XrVector3f_Dot(&hit, &plane.AxisU);
+                    float v = XrVector3f_Dot(&hit, &plane.AxisV);
+                    if (fabsf(u) > plane.HalfExtentU || fabsf(v) > plane.HalfExtentV) { continue; }
+
+                    nearestDist = dist;
+                    nearestPlane = &plane;
+                    nearestU = u;
+                    nearestV = v;
+                }
+
+                uint8_t* outPixel = outRow + x * 4;
+
+                if (!nearestPlane)
+                {
+                    outPixel[0] = outPixel[1] = outPixel[2] = 0;
+                    outPixel[3] = 255;
+
+                    if (pointRow) { pointRow[x] = cv::Vec3f(0.0f, 0.0f, 0.0f); }
+                    continue;
+                }
+
+                // The view space ray has unit length along the view axis, so the distance is the depth.
+                if (pointRow)
+                {
+                    pointRow[x] = cv::Vec3f(rayRow[x][0] * nearestDist, rayRow[x][1] * nearestDist, nearestDist);
+                }
+
+                // Bilinear sample with wrapping.
+                const cv::Mat& texture = m_textures[nearestPlane->TextureIndex];
+                float texU = nearestU / nearestPlane->TextureScale * SYNTHETIC_SCENE_TEXTURE_SIZE;
+                float texV = nearestV / nearestPlane->TextureScale * SYNTHETIC_SCENE_TEXTURE_SIZE;
+                float floorU = floorf(texU);
+                float floorV = floorf(texV);
+                float fracU = texU - floorU;
+                float fracV = texV - floorV;
+                int u0 = ((int)floorU % SYNTHETIC_SCENE_TEXTURE_SIZE + SYNTHETIC_SCENE_TEXTURE_SIZE) % SYNTHETIC_SCENE_TEXTURE_SIZE;
+                int v0 = ((int)floorV % SYNTHETIC_SCENE_TEXTURE_SIZE + SYNTHETIC_SCENE_TEXTURE_SIZE) % SYNTHETIC_SCENE_TEXTURE_SIZE;
+                int u1 = (u0 + 1) % SYNTHETIC_SCENE_TEXTURE_SIZE;
+                int v1 = (v0 + 1) % SYNTHETIC_SCENE_TEXTURE_SIZE;
+
+                const cv::Vec3b& c00 = texture.at<cv::Vec3b>(v0, u0);
+                const cv::Vec3b& c10 = texture.at<cv::Vec3b>(v0, u1);
+                const cv::Vec3b& c01 = texture.at<cv::Vec3b>(v1, u0);
+                const cv::Vec3b& c11 = texture.at<cv::Vec3b>(v1, u1);
+
+                for (int c = 0; c < 3; c++)
+                {
+                    float top = c00[c] + (c10[c] - c00[c]) * fracU;
+                    float bottom = c01[c] + (c11[c] - c01[c]) * fracU;
+                    outPixel[c] = (uint8_t)(top + (bottom - top) * fracV + 0.5f);
+                }
+                outPixel[3] = 255;
+            }
+        }
+    });
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <xr_linear.h>
+#include <opencv2/core.hpp>
+
+
+// Textured rectangle in world space. The axes are unit vectors along the plane, and the texture repeats every TextureScale meters.
+struct SyntheticScenePlane
+{
+	XrVector3f Center;
+	XrVector3f AxisU;
+	XrVector3f AxisV;
+	XrVector3f Normal;
+	float HalfExtentU;
+	float HalfExtentV;
+	float TextureScale;
+	uint32_t TextureIndex;
+};
+
+
+// Procedural test scene for the synthetic camera provider, so that the stereo pipeline can be run with repeatable input.
+// The scene is made of textured planes, and is rendered by casting a ray for each pixel of a precomputed ray map.
+class SyntheticScene
+{
+public:
+	SyntheticScene(const uint32_t seed);
+
+	void AddPlane(const XrVector3f& center, const XrVector3f& axisU, const XrVector3f& axisV, const float halfExtentU, const float halfExtentV, const float textureScale);
+
+	// Adds a room with the floor at the origin, centered on the XZ plane.
+	void AddRoom(const float width, const float length, const float height);
+
+	// Adds a box made of six planes, rotated around the Y axis by yaw radians.
+	void AddBox(const XrVector3f& center, const XrVector3f& halfExtents, const float yaw);
+
+	// Creates the per pixel ray map for a camera with the OpenCV pinhole model and k1, k2, p1, p2 distortion.
+	// The rays are stored as CV_32FC2 normalized image coordinates, in the OpenCV camera axes.
+	static void CreateViewRays(const uint32_t width, const uint32_t height, const XrVector2f& focalLength, const XrVector2f& center, const float distortion[4], cv::Mat& outRays);
+
+	// Renders the scene from a camera looking down -Z with +Y up, as in the XR view space.
+	// The output is a CV_8UC4 RGBX image, which may be a ROI of a larger frame.
+	// If outPoints is set, it receives the hit positions as CV_32FC3 in the OpenCV camera axes, with Z = 0 where nothing was hit.
+	void Render(const XrMatrix4x4f& cameraToWorld, const cv::Mat& viewRays, cv::Mat& outRGBX, cv::Mat* outPoints = nullptr) const;
+
+private:
+	void CreateTextures(const uint32_t seed);
+
+	std::vector<SyntheticScenePlane> m_planes;
+	std::vector<cv::Mat> m_textures;
+	uint32_t m_nextTextureIndex = 0;
+};
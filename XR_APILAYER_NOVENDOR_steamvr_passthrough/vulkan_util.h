@@ -133,7 +133,7 @@ inline void TransitionImage(VkCommandBuffer commandBuffer, VkImage image, VkImag
 	vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, depFlags, 0, nullptr, 0, nullptr, 1, &barrier);
 }
 
-inline void CopyTextureToGPU(VkCommandBuffer commandBuffer, VulkanTexture& texture, VkImageLayout newLayout)
+inline void CopyBufferToTextureGPU(VkCommandBuffer commandBuffer, VkBuffer sourceBuffer, VulkanTexture& texture, VkImageLayout newLayout)
 {
 
 	TransitionImage(commandBuffer, texture.Image, texture.Layout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
@@ -147,16 +147,21 @@ inline void CopyTextureToGPU(VkCommandBuffer commandBuffer, VulkanTexture& textu
 	region.imageOffset = { 0, 0, 0 };
 	region.imageExtent = { texture.Extent.width, texture.Extent.height, 1 };
 
-	vkCmdCopyBufferToImage(commandBuffer, texture.StagingBuffer, texture.Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	vkCmdCopyBufferToImage(commandBuffer, sourceBuffer, texture.Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
 	TransitionImage(commandBuffer, texture.Image, texture.Layout, newLayout);
 	texture.Layout = newLayout;
 }
 
-inline void CopyHostImageToGPU(VkDevice device, VulkanTexture& texture, std::vector<uint8_t>& buffer)
+inline void CopyTextureToGPU(VkCommandBuffer commandBuffer, VulkanTexture& texture, VkImageLayout newLayout)
+{
+	CopyBufferToTextureGPU(commandBuffer, texture.StagingBuffer, texture, newLayout);
+}
+
+inline void CopyHostImageToGPU(VkDevice device, VulkanTexture& texture, const uint8_t* data)
 {
 	VkMemoryToImageCopy region{ VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY };
-	region.pHostPointer = buffer.data();
+	region.pHostPointer = data;
 	region.memoryRowLength = 0;
 	region.memoryImageHeight = 0;
 	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -180,4 +185,9 @@ inline void CopyHostImageToGPU(VkDevice device, VulkanTexture& texture, std::vec
 	}
 }
 
+inline void CopyHostImageToGPU(VkDevice device, VulkanTexture& texture, std::vector<uint8_t>& buffer)
+{
+	CopyHostImageToGPU(device, texture, buffer.data());
+}
+
 
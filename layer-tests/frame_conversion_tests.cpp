@@ -0,0 +1,198 @@
+#include "pch.h"
+#include "test_framework.h"
+#include "frame_conversion.h"
+
+#include <opencv2/imgproc.hpp>
+
+
+// Compares the conversion kernels to straightforward per pixel versions on random data.
+// The row widths are swept so that the AVX2 and SSE loops, and the scalar tail after them, all get used.
+
+#define TEST_ROWS 5
+#define TEST_MAX_WIDTH 136
+
+static bool CheckEqualImages(const cv::Mat& result, const cv::Mat& expected, std::string& message)
+{
+	if (result.size() != expected.size() || result.type() != expected.type())
+	{
+		message = "size or type mismatch";
+		return false;
+	}
+
+	for (int y = 0; y < result.rows; y++)
+	{
+		for (int x = 0; x < result.cols * result.channels(); x++)
+		{
+			if (result.ptr<uint8_t>(y)[x] != expected.ptr<uint8_t>(y)[x])
+			{
+				message = "mismatch at row " + std::to_string(y) + " byte " + std::to_string(x) +
+					", got " + std::to_string(result.ptr<uint8_t>(y)[x]) + ", expected " + std::to_string(expected.ptr<uint8_t>(y)[x]);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+// Limited to full range expansion in the same 8.8 fixed point as the kernels, rounded to nearest.
+static uint8_t ExpandLumaRangeReference(uint8_t luma)
+{
+	int value = (((int)luma - 16) * 298 + 128) >> 8;
+	return (uint8_t)std::clamp(value, 0, 255);
+}
+
+// Builds an NV12_2 frame, the top and bottom halves stored as separate NV12 images after each other.
+static std::vector<uint8_t> CreateSplitNV12Frame(cv::RNG& rng, int frameWidth, int frameHeight)
+{
+	std::vector<uint8_t> frameData((size_t)frameWidth * frameHeight * 3 / 2);
+	cv::Mat bytes(1, (int)frameData.size(), CV_8UC1, frameData.data());
+	rng.fill(bytes, cv::RNG::UNIFORM, 0, 256);
+	return frameData;
+}
+
+static uint8_t SplitNV12Luma(const std::vector<uint8_t>& frameData, int frameWidth, int frameHeight, int x, int y)
+{
+	int halfHeight = frameHeight / 2;
+	size_t halfOffset = y < halfHeight ? 0 : (size_t)frameWidth * halfHeight * 3 / 2;
+	return frameData[halfOffset + (size_t)(y % halfHeight) * frameWidth + x];
+}
+
+
+TEST_CASE(RAW10ToGray)
+{
+	cv::RNG rng(1);
+
+	for (int width = 4; width <= TEST_MAX_WIDTH; width += 4)
+	{
+		// Convert a view with a group of padding on each side, like an eye of a side by side frame.
+		int packedWidth = width * 5 / 4;
+		cv::Mat packed(TEST_ROWS, packedWidth + 10, CV_8UC1);
+		rng.fill(packed, cv::RNG::UNIFORM, 0, 256);
+		cv::Mat packedROI = packed(cv::Rect(5, 0, packedWidth, TEST_ROWS));
+
+		cv::Mat expected(TEST_ROWS, width, CV_8UC1);
+		for (int y = 0; y < TEST_ROWS; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				// The first four bytes of each group are the high bits, the fifth has the low bits of all four.
+				expected.at<uint8_t>(y, x) = packedROI.at<uint8_t>(y, x / 4 * 5 + x % 4);
+			}
+		}
+
+		cv::Mat result;
+		ConvertRAW10ToGray(packedROI, result);
+
+		std::string message;
+		CHECK_MESSAGE(CheckEqualImages(result, expected, message), "width " + std::to_string(width) + ", " + message);
+	}
+}
+
+
+TEST_CASE(Bayer16BGToBinnedGray)
+{
+	cv::RNG rng(2);
+
+	for (int width = 1; width <= TEST_MAX_WIDTH / 2; width++)
+	{
+		cv::Mat bayer(TEST_ROWS * 2, width * 2, CV_16UC1);
+		rng.fill(bayer, cv::RNG::UNIFORM, 0, 1024);
+
+		cv::Mat expected(TEST_ROWS, width, CV_8UC1);
+		for (int y = 0; y < TEST_ROWS; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				int r = bayer.at<uint16_t>(y * 2, x * 2);
+				int g = bayer.at<uint16_t>(y * 2, x * 2 + 1) + bayer.at<uint16_t>(y * 2 + 1, x * 2);
+				int b = bayer.at<uint16_t>(y * 2 + 1, x * 2 + 1);
+
+				expected.at<uint8_t>(y, x) = (uint8_t)min((r * 77 + g * 75 + b * 29) >> 10, 255);
+			}
+		}
+
+		cv::Mat result;
+		ConvertBayer16BGToBinnedGray(bayer, result);
+
+		std::string message;
+		CHECK_MESSAGE(CheckEqualImages(result, expected, message), "width " + std::to_string(width) + ", " + message);
+	}
+}
+
+
+TEST_CASE(SplitNV12ToGray)
+{
+	cv::RNG rng(3);
+	const int frameWidth = TEST_MAX_WIDTH + 8;
+	const int frameHeight = 24;
+
+	std::vector<uint8_t> frameData = CreateSplitNV12Frame(rng, frameWidth, frameHeight);
+
+	for (int bExpandRange = 0; bExpandRange < 2; bExpandRange++)
+	{
+		for (int width = 1; width <= TEST_MAX_WIDTH; width++)
+		{
+			// Odd offsets and a region crossing the boundary between the two halves.
+			cv::Rect roi(width % 7, 3, width, frameHeight - 7);
+
+			cv::Mat expected(roi.height, roi.width, CV_8UC1);
+			for (int y = 0; y < roi.height; y++)
+			{
+				for (int x = 0; x < roi.width; x++)
+				{
+					uint8_t luma = SplitNV12Luma(frameData, frameWidth, frameHeight, roi.x + x, roi.y + y);
+					expected.at<uint8_t>(y, x) = bExpandRange ? ExpandLumaRangeReference(luma) : luma;
+				}
+			}
+
+			cv::Mat result;
+			ConvertSplitNV12ToGray(frameData.data(), frameWidth, frameHeight, roi, result, bExpandRange);
+
+			std::string message;
+			CHECK_MESSAGE(CheckEqualImages(result, expected, message), "width " + std::to_string(width) + (bExpandRange ? " expanded, " : ", ") + message);
+		}
+	}
+}
+
+
+TEST_CASE(SplitNV12ToRGB)
+{
+	cv::RNG rng(4);
+	const int frameWidth = 64;
+	const int frameHeight = 32;
+	const int halfHeight = frameHeight / 2;
+
+	std::vector<uint8_t> frameData = CreateSplitNV12Frame(rng, frameWidth, frameHeight);
+	size_t halfImageBytes = (size_t)frameWidth * halfHeight * 3 / 2;
+
+	// Convert each half as a regular NV12 image and stack them.
+	cv::Mat expectedFrame(frameHeight, frameWidth, CV_8UC3);
+	for (int half = 0; half < 2; half++)
+	{
+		uint8_t* halfData = frameData.data() + half * halfImageBytes;
+		cv::Mat lumaPlane(halfHeight, frameWidth, CV_8UC1, halfData);
+		cv::Mat chromaPlane(halfHeight / 2, frameWidth / 2, CV_8UC2, halfData + (size_t)frameWidth * halfHeight);
+
+		cv::Mat halfRows = expectedFrame.rowRange(half * halfHeight, (half + 1) * halfHeight);
+		cv::cvtColorTwoPlane(lumaPlane, chromaPlane, halfRows, cv::COLOR_YUV2RGB_NV12);
+	}
+
+	const cv::Rect regions[] =
+	{
+		cv::Rect(0, 0, frameWidth, frameHeight),
+		cv::Rect(0, 0, frameWidth / 2, halfHeight),
+		cv::Rect(frameWidth / 2, halfHeight, frameWidth / 2, halfHeight),
+		cv::Rect(6, 4, 34, halfHeight),
+		cv::Rect(2, halfHeight - 2, 10, 4),
+	};
+
+	for (const cv::Rect& roi : regions)
+	{
+		cv::Mat result;
+		ConvertSplitNV12ToRGB(frameData.data(), frameWidth, frameHeight, roi, result);
+
+		std::string message;
+		CHECK_MESSAGE(CheckEqualImages(result, expectedFrame(roi), message), "region y " + std::to_string(roi.y) + " height " + std::to_string(roi.height) + ", " + message);
+	}
+}
@@ -0,0 +1,264 @@
+#include "pch.h"
+#include "test_framework.h"
+#include "frame_queue.h"
+
+
+// Runs one writer and several readers against the frame queues at full speed, like the camera and depth queues
+// shared between the render and worker threads. Every frame is filled with its sequence number,
+// so a frame that changes while it is held by a reader shows up as torn.
+// The throughput is printed so that the two queue types can be compared.
+
+#define STRESS_NUM_READERS 4
+#define STRESS_NUM_FRAMES 200000
+#define STRESS_QUEUE_SIZE 5
+#define STRESS_HISTORY_DEPTH 3
+#define STRESS_FRAME_VALUES 64
+
+struct StressFrame
+{
+	uint64_t FrameExposureTimestamp = 0;
+	uint64_t Values[STRESS_FRAME_VALUES] = {};
+
+	// Tracked outside of the queue, to catch a slot being handed to the writer while a reader holds it.
+	std::atomic<int> NumHoldingReaders = 0;
+	std::atomic<bool> bIsBeingWritten = false;
+};
+
+struct StressResults
+{
+	std::atomic<uint64_t> NumReads = 0;
+	std::atomic<uint64_t> NumEmptyReads = 0;
+	std::atomic<uint64_t> NumTornFrames = 0;
+	std::atomic<uint64_t> NumReadsDuringWrite = 0;
+	std::atomic<uint64_t> NumWritesDuringRead = 0;
+	uint64_t NumWrites = 0;
+	uint64_t NumWriteUnderruns = 0;
+};
+
+static bool IsFrameIntact(const StressFrame& frame)
+{
+	for (int i = 0; i < STRESS_FRAME_VALUES; i++)
+	{
+		if (frame.Values[i] != frame.FrameExposureTimestamp)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static void CheckReadFrame(FramePtr<StressFrame>& frame, StressResults& results)
+{
+	if (!frame.HasFrame())
+	{
+		results.NumEmptyReads++;
+		return;
+	}
+
+	frame->NumHoldingReaders++;
+
+	if (frame->bIsBeingWritten.load())
+	{
+		results.NumReadsDuringWrite++;
+	}
+
+	// Check twice with a pause in between, so that a concurrent write has a chance to show up.
+	bool bIntact = IsFrameIntact(*frame);
+	std::this_thread::yield();
+	bIntact = bIntact && IsFrameIntact(*frame);
+
+	if (!bIntact)
+	{
+		results.NumTornFrames++;
+	}
+
+	frame->NumHoldingReaders--;
+	results.NumReads++;
+}
+
+template<typename QueueType> static void RunReader(QueueType& queue, StressResults& results, std::atomic<bool>& bRunning, int readerIndex)
+{
+	uint64_t lastSequence = 0;
+	uint64_t iteration = readerIndex;
+
+	while (bRunning.load())
+	{
+		// Cycle through the read functions used by the layer.
+		switch (iteration++ % 3)
+		{
+		case 0:
+		{
+			FramePtr<StressFrame> frame = queue.AcquireRead();
+			CheckReadFrame(frame, results);
+			break;
+		}
+		case 1:
+		{
+			// Aim a bit into the history, so that older kept frames get read as well.
+			uint64_t targetTime = iteration % STRESS_NUM_FRAMES;
+			FramePtr<StressFrame> frame = queue.AcquireReadForTime(targetTime, (iteration & 1) != 0);
+			CheckReadFrame(frame, results);
+			break;
+		}
+		case 2:
+		{
+			FramePtr<StressFrame> frame = queue.WaitForRead(lastSequence, std::chrono::microseconds(100));
+			CheckReadFrame(frame, results);
+			break;
+		}
+		}
+	}
+}
+
+template<typename QueueType> static FramePtr<StressFrame> AcquireWriteFrame(QueueType& queue, StressResults& results)
+{
+	while (true)
+	{
+		FramePtr<StressFrame> frame = queue.AcquireWrite();
+		if (frame.HasFrame())
+		{
+			return frame;
+		}
+
+		// All slots are held by readers or kept as history.
+		results.NumWriteUnderruns++;
+		std::this_thread::yield();
+	}
+}
+
+template<typename QueueType> static void RunQueueStress(QueueType& queue, StressResults& results, const char* queueName)
+{
+	std::atomic<bool> bRunning = true;
+	std::vector<std::thread> readers;
+
+	for (int i = 0; i < STRESS_NUM_READERS; i++)
+	{
+		readers.emplace_back(RunReader<QueueType>, std::ref(queue), std::ref(results), std::ref(bRunning), i);
+	}
+
+	uint64_t startTime = GetCurrentTimeSytemTicks();
+
+	for (uint64_t sequence = 1; sequence <= STRESS_NUM_FRAMES; sequence++)
+	{
+		FramePtr<StressFrame> frame = AcquireWriteFrame(queue, results);
+
+		if (frame->NumHoldingReaders.load() > 0)
+		{
+			results.NumWritesDuringRead++;
+		}
+
+		frame->bIsBeingWritten = true;
+
+		for (int i = 0; i < STRESS_FRAME_VALUES; i++)
+		{
+			frame->Values[i] = sequence;
+		}
+		frame->FrameExposureTimestamp = sequence;
+
+		frame->bIsBeingWritten = false;
+
+		// The depth queue reads back the frame it just wrote.
+		if (sequence % 4 == 0)
+		{
+			frame.CommitWriteAndAcquireRead();
+			CheckReadFrame(frame, results);
+		}
+		else
+		{
+			frame.CommitWrite();
+		}
+		results.NumWrites++;
+	}
+
+	double writeSeconds = GetPerfTimeDiffSeconds(startTime, GetCurrentTimeSytemTicks());
+
+	bRunning = false;
+	for (std::thread& reader : readers)
+	{
+		reader.join();
+	}
+
+	std::cout << "    " << queueName << ": " << (uint64_t)(results.NumWrites / writeSeconds) << " writes/s, " <<
+		(uint64_t)(results.NumReads.load() / writeSeconds) << " reads/s, " <<
+		results.NumEmptyReads.load() << " empty reads, " << results.NumWriteUnderruns << " write underruns" << std::endl;
+}
+
+static void CheckStressResults(const StressResults& results)
+{
+	CHECK(results.NumWrites == STRESS_NUM_FRAMES);
+	CHECK(results.NumReads.load() > 0);
+	CHECK(results.NumTornFrames.load() == 0);
+	CHECK(results.NumReadsDuringWrite.load() == 0);
+	CHECK(results.NumWritesDuringRead.load() == 0);
+}
+
+
+TEST_CASE(FrameQueueStress)
+{
+	FrameQueue<StressFrame> queue(STRESS_QUEUE_SIZE, STRESS_HISTORY_DEPTH);
+	StressResults results;
+
+	RunQueueStress(queue, results, "FrameQueue");
+	CheckStressResults(results);
+}
+
+
+TEST_CASE(LockFreeFrameQueueStress)
+{
+	LockFreeFrameQueue<StressFrame> queue(STRESS_QUEUE_SIZE, STRESS_HISTORY_DEPTH);
+	StressResults results;
+
+	RunQueueStress(queue, results, "LockFreeFrameQueue");
+	CheckStressResults(results);
+}
+
+
+// The retire callback has to run once a frame can no longer be read, but never on a frame that is still held.
+TEST_CASE(FrameQueueRetireCallback)
+{
+	FrameQueue<StressFrame> queue(3, 1);
+	std::vector<uint64_t> retiredFrames;
+
+	queue.SetRetireCallback([&retiredFrames](StressFrame& frame)
+	{
+		CHECK(frame.NumHoldingReaders.load() == 0);
+		retiredFrames.push_back(frame.FrameExposureTimestamp);
+	});
+
+	auto writeFrame = [&queue](uint64_t sequence)
+	{
+		FramePtr<StressFrame> frame = queue.AcquireWrite();
+		frame->FrameExposureTimestamp = sequence;
+		frame.CommitWrite();
+	};
+
+	writeFrame(1);
+
+	{
+		FramePtr<StressFrame> heldFrame = queue.AcquireRead();
+		heldFrame->NumHoldingReaders++;
+
+		// The held frame is no longer the newest, but is only retired once released.
+		writeFrame(2);
+		CHECK(retiredFrames.empty());
+
+		heldFrame->NumHoldingReaders--;
+	}
+	CHECK(retiredFrames.size() == 1 && retiredFrames[0] == 1);
+
+	// Unread frames are retired when replaced.
+	writeFrame(3);
+	CHECK(retiredFrames.size() == 2 && retiredFrames[1] == 2);
+
+	// Retiring everything defers the frame being read to its last reader.
+	{
+		FramePtr<StressFrame> heldFrame = queue.AcquireRead();
+		heldFrame->NumHoldingReaders++;
+
+		queue.RetireFrames();
+		CHECK(retiredFrames.size() == 2);
+
+		heldFrame->NumHoldingReaders--;
+	}
+	CHECK(retiredFrames.size() == 3 && retiredFrames[2] == 3);
+}
@@ -0,0 +1,54 @@
+#include "pch.h"
+#include "test_framework.h"
+
+
+// Runs the registered layer tests, or only the ones whose name contains the first argument.
+// Returns the number of failed test cases, so that it can be used as a build step.
+
+std::shared_ptr<spdlog::logger> g_logger;
+std::shared_ptr<spdlog::sinks::dup_filter_sink_mt> g_logSinkAggregator;
+
+static bool g_bCurrentTestFailed = false;
+
+
+std::vector<TestCase>& GetTestCases()
+{
+	static std::vector<TestCase> testCases;
+	return testCases;
+}
+
+void ReportTestFailure(const char* file, int line, const std::string& message)
+{
+	std::cout << "    " << file << "(" << line << "): check failed: " << message << std::endl;
+	g_bCurrentTestFailed = true;
+}
+
+
+int main(int argc, char* argv[])
+{
+	g_logger = spdlog::default_logger();
+
+	std::string filter = argc > 1 ? argv[1] : "";
+	int numRun = 0;
+	int numFailed = 0;
+
+	for (TestCase& testCase : GetTestCases())
+	{
+		if (!filter.empty() && std::string(testCase.Name).find(filter) == std::string::npos)
+		{
+			continue;
+		}
+
+		std::cout << testCase.Name << std::endl;
+
+		g_bCurrentTestFailed = false;
+		testCase.Function();
+
+		numRun++;
+		numFailed += g_bCurrentTestFailed ? 1 : 0;
+	}
+
+	std::cout << std::endl << numRun - numFailed << " of " << numRun << " test cases passed." << std::endl;
+
+	return numFailed;
+}
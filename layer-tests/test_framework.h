@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+
+
+// Minimal test registration for the layer tests. Each TEST_CASE registers itself at startup,
+// and the first failed CHECK reports the location and ends the test case.
+
+struct TestCase
+{
+	const char* Name;
+	std::function<void()> Function;
+};
+
+std::vector<TestCase>& GetTestCases();
+void ReportTestFailure(const char* file, int line, const std::string& message);
+
+struct TestRegistrar
+{
+	TestRegistrar(const char* name, std::function<void()> function)
+	{
+		GetTestCases().push_back({ name, function });
+	}
+};
+
+#define TEST_CASE(name) \
+	static void name(); \
+	static TestRegistrar name##_Registrar(#name, name); \
+	static void name()
+
+#define CHECK(condition) \
+	do { if (!(condition)) { ReportTestFailure(__FILE__, __LINE__, #condition); return; } } while (false)
+
+#define CHECK_MESSAGE(condition, message) \
+	do { if (!(condition)) { ReportTestFailure(__FILE__, __LINE__, std::string(#condition) + ": " + (message)); return; } } while (false)
@@ -643,6 +643,7 @@ void SettingsMenu::DrawMenu()
 	bool rendererResetPending = false;
 	bool cameraParamChangesPending = false;
 	bool frameDumpPending = false;
+	bool stereoBenchmarkPending = false;
 	bool bImmediateUpdate = false;
 
 	Config_Main& mainConfig = m_configManager->GetConfig_Main();
@@ -1594,6 +1595,17 @@ if (bIsActiveTab) { ImGui::PopStyleColor(1); bIsActiveTab = false; }
 					ImGui::Text("Current Camera API: OpenCV - Inactive");
 				}
 			}
+			else if (displayValues.CameraProvider == CameraProvider_Synthetic)
+			{
+				if (displayValues.bCameraActive)
+				{
+					ImGui::Text("Current Camera API: Synthetic - %u x %u @ %.0f fps", displayValues.CameraFrameWidth, displayValues.CameraFrameHeight, displayValues.CameraFrameRate);
+				}
+				else
+				{
+					ImGui::Text("Current Camera API: Synthetic - Inactive");
+				}
+			}
 			else
 			{
 				ImGui::Text("Current Camera API: None");
@@ -1660,6 +1672,17 @@ if (bIsActiveTab) { ImGui::PopStyleColor(1); bIsActiveTab = false; }
 			}
 			TextDescription("Use SteamVR for calculating depth, and a webcam for color data. Requires a HMD with a stereo camera and manual configuration.");
 
+			if (ImGui::RadioButton("Synthetic (Testing)", mainConfig.CameraProvider == CameraProvider_Synthetic))
+			{
+				if (mainConfig.CameraProvider != CameraProvider_Synthetic)
+				{
+					mainConfig.CameraProvider = CameraProvider_Synthetic;
+					mainConfig.ProjectionMode = Projection_StereoReconstruction;
+					rendererResetPending = true;
+				}
+			}
+			TextDescription("Use a generated test scene or a recorded video file instead of a camera. For testing the stereo reconstruction with repeatable input.");
+
 			IMGUI_BIG_SPACING;
 
 			ImGui::Checkbox("Clamp Camera Frame", &cameraConfig.ClampCameraFrame);
@@ -1814,6 +1837,23 @@ if (bIsActiveTab) { ImGui::PopStyleColor(1); bIsActiveTab = false; }
 
 			EndSoftDisabled(!cameraConfig.RequestCustomFrameSize);
 
+			ImGui::Text("Capture Format");
+			TextDescription("Native formats pass the camera stream on without converting it, which reduces CPU usage. MJPEG frames are decoded once on the CPU when captured, which mainly saves USB bandwidth. The camera must support the selected format.");
+			if (ImGui::RadioButton("Converted RGB", cameraConfig.CameraCaptureFormat == CameraCaptureFormat_Converted))
+			{
+				cameraConfig.CameraCaptureFormat = CameraCaptureFormat_Converted;
+			}
+			ImGui::SameLine();
+			if (ImGui::RadioButton("Native YUYV", cameraConfig.CameraCaptureFormat == CameraCaptureFormat_NativeYUYV))
+			{
+				cameraConfig.CameraCaptureFormat = CameraCaptureFormat_NativeYUYV;
+			}
+			ImGui::SameLine();
+			if (ImGui::RadioButton("Native MJPEG", cameraConfig.CameraCaptureFormat == CameraCaptureFormat_NativeMJPEG))
+			{
+				cameraConfig.CameraCaptureFormat = CameraCaptureFormat_NativeMJPEG;
+			}
+
 			ImGui::Text("Camera Frame Layout");
 			if (ImGui::RadioButton("Monocular", cameraConfig.CameraFrameLayout == FrameLayout_Mono))
 			{
@@ -1883,6 +1923,121 @@ if (bIsActiveTab) { ImGui::PopStyleColor(1); bIsActiveTab = false; }
 			IMGUI_BIG_SPACING;
 		}
 
+		if (CollapsingHeaderPersistent("Synthetic Camera Configuration"))
+		{
+			TextDescription("These settings are for the synthetic testing provider only. Changes apply when the camera is restarted.");
+
+			ImGui::Text("Image Source");
+			if (ImGui::RadioButton("Test Scene", cameraConfig.Synthetic_Source == SyntheticCameraSource_TestScene))
+			{
+				cameraConfig.Synthetic_Source = SyntheticCameraSource_TestScene;
+			}
+			ImGui::SameLine();
+			if (ImGui::RadioButton("Replay File", cameraConfig.Synthetic_Source == SyntheticCameraSource_ReplayFile))
+			{
+				cameraConfig.Synthetic_Source = SyntheticCameraSource_ReplayFile;
+			}
+			TextDescription("The test scene is a textured room rendered from the scripted head pose. The replay file is a video with the frames in the selected layout, and is looped.");
+
+			BeginSoftDisabled(cameraConfig.Synthetic_Source != SyntheticCameraSource_ReplayFile);
+			ImGui::InputText("Replay File Path", cameraConfig.Synthetic_ReplayFile, MAX_SYNTHETIC_REPLAY_PATH_SIZE + 1);
+			EndSoftDisabled(cameraConfig.Synthetic_Source != SyntheticCameraSource_ReplayFile);
+
+			IMGUI_BIG_SPACING;
+
+			ImGui::Text("Frame Format");
+			TextDescription("Format the frames are delivered in, to exercise the frame decoding paths.");
+			if (ImGui::RadioButton("RGBX###SynthRGBX", cameraConfig.Synthetic_FrameFormat == FrameFormat_RGBX32))
+			{
+				cameraConfig.Synthetic_FrameFormat = FrameFormat_RGBX32;
+			}
+			ImGui::SameLine();
+			if (ImGui::RadioButton("RGB24###SynthRGB24", cameraConfig.Synthetic_FrameFormat == FrameFormat_RGB24))
+			{
+				cameraConfig.Synthetic_FrameFormat = FrameFormat_RGB24;
+			}
+			ImGui::SameLine();
+			if (ImGui::RadioButton("YUYV###SynthYUYV", cameraConfig.Synthetic_FrameFormat == FrameFormat_YUYV16))
+			{
+				cameraConfig.Synthetic_FrameFormat = FrameFormat_YUYV16;
+			}
+			ImGui::SameLine();
+			if (ImGui::RadioButton("NV12###SynthNV12", cameraConfig.Synthetic_FrameFormat == FrameFormat_NV12))
+			{
+				cameraConfig.Synthetic_FrameFormat = FrameFormat_NV12;
+			}
+
+			if (ImGui::RadioButton("NV12 Split###SynthNV12_2", cameraConfig.Synthetic_FrameFormat == FrameFormat_NV12_2))
+			{
+				cameraConfig.Synthetic_FrameFormat = FrameFormat_NV12_2;
+			}
+			ImGui::SameLine();
+			if (ImGui::RadioButton("Bayer BG###SynthBayer", cameraConfig.Synthetic_FrameFormat == FrameFormat_BAYER16BG))
+			{
+				cameraConfig.Synthetic_FrameFormat = FrameFormat_BAYER16BG;
+			}
+			ImGui::SameLine();
+			if (ImGui::RadioButton("RAW10###SynthRAW10", cameraConfig.Synthetic_FrameFormat == FrameFormat_RAW10))
+			{
+				cameraConfig.Synthetic_FrameFormat = FrameFormat_RAW10;
+			}
+			ImGui::SameLine();
+			if (ImGui::RadioButton("MJPEG###SynthMJPEG", cameraConfig.Synthetic_FrameFormat == FrameFormat_MJPEG))
+			{
+				cameraConfig.Synthetic_FrameFormat = FrameFormat_MJPEG;
+			}
+
+			ImGui::Text("Frame Layout");
+			if (ImGui::RadioButton("Monocular###SynthMono", cameraConfig.Synthetic_FrameLayout == FrameLayout_Mono))
+			{
+				cameraConfig.Synthetic_FrameLayout = FrameLayout_Mono;
+			}
+			ImGui::SameLine();
+			if (ImGui::RadioButton("Stereo Vertical###SynthVertical", cameraConfig.Synthetic_FrameLayout == FrameLayout_StereoVertical))
+			{
+				cameraConfig.Synthetic_FrameLayout = FrameLayout_StereoVertical;
+			}
+			ImGui::SameLine();
+			if (ImGui::RadioButton("Stereo Horizontal###SynthHorizontal", cameraConfig.Synthetic_FrameLayout == FrameLayout_StereoHorizontal))
+			{
+				cameraConfig.Synthetic_FrameLayout = FrameLayout_StereoHorizontal;
+			}
+
+			IMGUI_BIG_SPACING;
+
+			ImGui::DragInt2("Eye Width x Height###SynthFrameWH", cameraConfig.Synthetic_FrameDimensions, 1.0f, 8, 4096);
+			TextDescription("Size of a single eye image in the test scene. Replay files use the size of the video.");
+			ImGui::DragFloat("FPS###SynthFPS", &cameraConfig.Synthetic_FrameRate, 1.0f, 1.0f, 240.0f, "%.0f");
+			ImGui::DragFloat("Field of View (degrees)###SynthFOV", &cameraConfig.Synthetic_FieldOfView, 0.5f, 10.0f, 170.0f, "%.1f");
+			TextDescription("Horizontal field of view of each eye. Replay files should use the same value as the recording.");
+			ImGui::DragFloat("Camera Baseline (m)###SynthBaseline", &cameraConfig.Synthetic_Baseline, 0.001f, 0.0f, 0.5f, "%.3f");
+			TextDescription("Distance between the left and right cameras.");
+			ImGui::DragFloat4("Lens Distortion (k1, k2, p1, p2)###SynthDistortion", cameraConfig.Synthetic_Distortion, 0.001f, -1.0f, 1.0f, "%.3f");
+			TextDescription("Radial and tangential distortion of the test scene lenses, passed to the pipeline as the camera calibration.");
+
+			IMGUI_BIG_SPACING;
+
+			ImGui::Text("Head Motion");
+			if (ImGui::RadioButton("Static###SynthStatic", cameraConfig.Synthetic_PoseScript == SyntheticPoseScript_Static))
+			{
+				cameraConfig.Synthetic_PoseScript = SyntheticPoseScript_Static;
+			}
+			ImGui::SameLine();
+			if (ImGui::RadioButton("Yaw Sweep###SynthYaw", cameraConfig.Synthetic_PoseScript == SyntheticPoseScript_YawSweep))
+			{
+				cameraConfig.Synthetic_PoseScript = SyntheticPoseScript_YawSweep;
+			}
+			ImGui::SameLine();
+			if (ImGui::RadioButton("Strafe###SynthStrafe", cameraConfig.Synthetic_PoseScript == SyntheticPoseScript_Strafe))
+			{
+				cameraConfig.Synthetic_PoseScript = SyntheticPoseScript_Strafe;
+			}
+			ImGui::DragFloat("Motion Speed###SynthSpeed", &cameraConfig.Synthetic_PoseScriptSpeed, 0.01f, 0.0f, 10.0f, "%.2f");
+			TextDescription("Scripted camera motion, used for the frame poses instead of the HMD. Applies to replay files as well.");
+
+			IMGUI_BIG_SPACING;
+		}
+
 		if (CollapsingHeaderPersistent("SteamVR Camera Configuration"))
 		{
 			ImGui::Checkbox("Use OpenVR Block Queue Interface for Depth Frames", &cameraConfig.OpenVR_UseBlockQueueForDepth);
@@ -1891,6 +2046,9 @@ if (bIsActiveTab) { ImGui::PopStyleColor(1); bIsActiveTab = false; }
 			BeginSoftDisabled(!cameraConfig.OpenVR_UseBlockQueueForDepth);
 			ImGui::Checkbox("Use OpenVR Block Queue Interface for Camera Frames", &cameraConfig.OpenVR_UseBlockQueueForColor);
 			TextDescription("Uses a lower latency interface for color frames. Disable if there are block queue related errors in the log.");
+
+			ImGui::Checkbox("Read Block Queue Frames Without Copying", &cameraConfig.OpenVR_BorrowBlockQueueFrames);
+			TextDescription("Keeps camera frames in the block queue memory until they have been processed, instead of copying them. Frames are still copied if too many are held.");
 			EndSoftDisabled(!cameraConfig.OpenVR_UseBlockQueueForDepth);
 
 			IMGUI_BIG_SPACING;
@@ -2145,6 +2303,21 @@ if (bIsActiveTab) { ImGui::PopStyleColor(1); bIsActiveTab = false; }
 			ImGui::Text("Passthrough CPU render duration: %.2fms", displayValues.RenderTimeMS);
 			ImGui::Text("Stereo reconstruction CPU duration: %.2fms", displayValues.StereoReconstructionTimeMS);
 			ImGui::Text("Stereo reconstruction GPU duration: %.2fms", displayValues.StereoRenderTimeMS);
+			ImGui::Text("Stereo matcher rebuilds: %u", displayValues.StereoMatcherRebuildCount);
+			ImGui::Text("Stereo stage durations: input %.2fms, matching %.2fms, output %.2fms", displayValues.StereoInputStageTimeMS, displayValues.StereoMatchingStageTimeMS, displayValues.StereoOutputStageTimeMS);
+			ImGui::Text("Stereo input queue: %u frames (max %u), %.2fms latency", displayValues.StereoInputQueueDepth, displayValues.StereoInputQueueMaxDepth, displayValues.StereoInputQueueLatencyMS);
+			ImGui::Text("Stereo disparity queue: %u frames (max %u), %.2fms latency", displayValues.StereoDisparityQueueDepth, displayValues.StereoDisparityQueueMaxDepth, displayValues.StereoDisparityQueueLatencyMS);
+			ImGui::Text("Stereo input thread wakeups: %.0f/s", displayValues.StereoInputWakeupsPerSec);
+			ImGui::Text("Stereo disparity search range: %.0f%%", displayValues.StereoDisparitySearchFraction * 100.0f);
+			ImGui::Text("Stereo recomputed area: %.0f%%", displayValues.StereoRecomputedFraction * 100.0f);
+			if (displayValues.bStereoGovernorActive)
+			{
+				ImGui::Text("Stereo quality governor: level %d, %.2fms average", displayValues.StereoGovernorLevel, displayValues.StereoGovernorTimeMS);
+			}
+			if (displayValues.bStereoGroundTruthAvailable)
+			{
+				ImGui::Text("Stereo ground truth: %.2f%% bad pixels, %.2f%% invalid", displayValues.StereoBadPixelRate * 100.0f, displayValues.StereoInvalidPixelRate * 100.0f);
+			}
 
 			ImGui::PopFont();
 
@@ -2191,6 +2364,25 @@ if (bIsActiveTab) { ImGui::PopStyleColor(1); bIsActiveTab = false; }
 			}
 			ImGui::EndGroup();
 
+			ImGui::Spacing();
+			ImGui::Checkbox("Match Camera Frame to Depth", &mainConfig.StereoMatchCameraFrameToDepth);
+			TextDescription("Displays the camera frame the depth was calculated from, instead of the newest one. Reduces misalignment during fast motion, at the cost of some camera latency.");
+
+			ImGui::Checkbox("Adaptive Quality", &mainConfig.StereoGovernor_Enable);
+			TextDescription("Lowers the quality of the selected preset when the reconstruction takes longer than the target time per camera frame, for example when the game is using most of the CPU. The quality is raised back when there is enough headroom.");
+
+			BeginSoftDisabled(!mainConfig.StereoGovernor_Enable);
+			ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x * 0.45f);
+			ScrollableSlider("Target Reconstruction Time (ms)", &mainConfig.StereoGovernor_TargetMS, 2.0f, 100.0f, "%.0f", 1.0f);
+			EndSoftDisabled(!mainConfig.StereoGovernor_Enable);
+
+			ImGui::Spacing();
+			if (ImGui::Button("Benchmark Presets"))
+			{
+				stereoBenchmarkPending = true;
+			}
+			TextDescription("Runs the depth reconstruction with each preset in turn, and writes the per-stage timings to the log. Use the synthetic camera provider for repeatable results.");
+
 			IMGUI_BIG_SPACING;
 		}
 
@@ -2240,6 +2432,33 @@ if (bIsActiveTab) { ImGui::PopStyleColor(1); bIsActiveTab = false; }
 				ScrollableSliderInt("Frame Skip Ratio", &stereoCustomConfig.StereoFrameSkip, 0, 14, "%d", 1);
 				TextDescription("Skip stereo processing of this many frames for each frame processed. This does not affect the frame rate of viewed camera frames, every frame will still be reprojected on the latest stereo data.");
 
+				ImGui::Checkbox("Coarse-to-Fine Disparity Search", &stereoCustomConfig.StereoCoarseToFine_Enable);
+				TextDescription("Estimates the disparity at half resolution first, and then only searches a narrow range around the estimate for each band of rows. Allows a lower downscale factor for the same CPU time, but may miss small objects that are much closer than their surroundings.");
+
+				BeginSoftDisabled(!stereoCustomConfig.StereoCoarseToFine_Enable);
+				ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x * 0.45f);
+				ScrollableSliderInt("Coarse-to-Fine Search Margin", &stereoCustomConfig.StereoCoarseToFine_Margin, 1, 32, "%d", 1);
+				TextDescription("Extra disparity range in pixels searched on both sides of the coarse estimate.");
+				EndSoftDisabled(!stereoCustomConfig.StereoCoarseToFine_Enable);
+
+				ImGui::Checkbox("Motion Predicted Disparity Search", &stereoCustomConfig.StereoMotionPrediction_Enable);
+				TextDescription("Predicts the disparity range for each band of rows by moving the previous result with the headset motion. Every few frames the full range is searched to pick up moving objects. Takes priority over the coarse-to-fine search.");
+
+				BeginSoftDisabled(!stereoCustomConfig.StereoMotionPrediction_Enable);
+				ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x * 0.45f);
+				ScrollableSliderInt("Motion Prediction Search Margin", &stereoCustomConfig.StereoMotionPrediction_Margin, 1, 32, "%d", 1);
+				TextDescription("Extra disparity range in pixels searched on both sides of the predicted range.");
+				EndSoftDisabled(!stereoCustomConfig.StereoMotionPrediction_Enable);
+
+				ImGui::Checkbox("Static Scene Change Detection", &stereoCustomConfig.StereoChangeDetection_Enable);
+				TextDescription("When the headset is still, only recomputes the parts of the image that have changed, and reuses the previous result elsewhere. Everything is recomputed when the headset moves.");
+
+				BeginSoftDisabled(!stereoCustomConfig.StereoChangeDetection_Enable);
+				ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x * 0.45f);
+				ScrollableSlider("Change Detection Threshold", &stereoCustomConfig.StereoChangeDetection_Threshold, 1.0f, 32.0f, "%.1f", 0.5f);
+				TextDescription("Average intensity difference of an image tile above which it is considered changed. Increase if camera noise causes constant recomputation.");
+				EndSoftDisabled(!stereoCustomConfig.StereoChangeDetection_Enable);
+
 				IMGUI_BIG_SPACING;
 				ImGui::TreePop();
 			}
@@ -2701,6 +2920,17 @@ if (bIsActiveTab) { ImGui::PopStyleColor(1); bIsActiveTab = false; }
 				ImGui::Text("Stereo reconstruction GPU duration: %.2fms", displayValues.StereoRenderTimeMS);
 				ImGui::Text("CPU Camera frame retrieval duration: %.2fms", displayValues.CPUFrameRetrievalTimeMS);
 				ImGui::Text("GPU Camera frame retrieval duration: %.2fms", displayValues.GPUFrameRetrievalTimeMS);
+				if (displayValues.CameraCaptureStageLatencyMS >= 0.0f)
+				{
+					ImGui::Text("Camera capture stage latency: %.2fms, upload queue wait: %.2fms", displayValues.CameraCaptureStageLatencyMS, displayValues.CameraUploadQueueLatencyMS);
+				}
+				ImGui::Text("Camera thread wakeups: %.0f/s", displayValues.CameraServeWakeupsPerSec);
+				ImGui::Text("Camera GPU queue: %u underruns, %u dropped, %u max in use, %.1fms read age",
+					displayValues.CameraGPUQueueStats.NumUnderruns, displayValues.CameraGPUQueueStats.NumDroppedFrames, displayValues.CameraGPUQueueStats.MaxOccupancy, displayValues.CameraGPUQueueStats.AverageReadAgeMS);
+				ImGui::Text("Camera CPU queue: %u underruns, %u dropped, %u max in use, %.1fms read age",
+					displayValues.CameraCPUQueueStats.NumUnderruns, displayValues.CameraCPUQueueStats.NumDroppedFrames, displayValues.CameraCPUQueueStats.MaxOccupancy, displayValues.CameraCPUQueueStats.AverageReadAgeMS);
+				ImGui::Text("Depth queue: %u underruns, %u dropped, %u max in use, %.1fms read age",
+					displayValues.DepthQueueStats.NumUnderruns, displayValues.DepthQueueStats.NumDroppedFrames, displayValues.DepthQueueStats.MaxOccupancy, displayValues.DepthQueueStats.AverageReadAgeMS);
 			}
 			else
 			{
@@ -3180,6 +3410,14 @@ if (bIsActiveTab) { ImGui::PopStyleColor(1); bIsActiveTab = false; }
 		m_IPCServer->BroadcastMessage(message);
 	}
 
+	if (stereoBenchmarkPending)
+	{
+		MenuIPCMessage message = {};
+		message.Header.Type = MessageType_SendCommand_RunStereoBenchmark;
+		message.Header.PayloadSize = 0;
+		m_IPCServer->BroadcastMessage(message);
+	}
+
 	ImGui::PopFont();
 }
 
@@ -23,7 +23,11 @@ ConfigManager::~ConfigManager()
 bool ConfigManager::ReadConfigFile()
 {
 	bool bIsInitial = false;
+#ifdef _WIN32
 	SI_Error result = m_iniData.LoadFile(ToWideString(m_configFile).data());
+#else
+	SI_Error result = m_iniData.LoadFile(m_configFile.data());
+#endif
 	if (result < 0)
 	{
 		if (m_bAllowWrite)
@@ -48,6 +52,7 @@ bool ConfigManager::ReadConfigFile()
 		m_configDepth.ParseConfig(m_iniData, "Depth");
 	}
 	m_bConfigUpdated = false;
+	CameraConfigChanged();
 
 	m_stereoPresets[0] = m_configCustomStereo;
 
@@ -72,7 +77,11 @@ void ConfigManager::UpdateConfigFile()
 		}
 		else
 		{
+#ifdef _WIN32
 			SI_Error result = m_iniData.SaveFile(ToWideString(m_configFile).c_str());
+#else
+			SI_Error result = m_iniData.SaveFile(m_configFile.c_str());
+#endif
 			if (result < 0)
 			{
 				if (result == -3)
@@ -121,6 +130,7 @@ void ConfigManager::ResetToDefaults()
 	m_configCustomStereo = Config_Stereo();
 	m_configDepth = Config_Depth();
 	UpdateConfigFile();
+	CameraConfigChanged();
 
 	m_stereoPresets[0] = m_configCustomStereo;
 }
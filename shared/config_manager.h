@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <atomic>
 #include "shared_structs.h"
 #include "SimpleIni.h"
 
@@ -14,6 +15,26 @@ enum ECameraDistortionMode
 	CameraDistortionMode_Fisheye = 2
 };
 
+enum ECameraCaptureFormat
+{
+	CameraCaptureFormat_Converted = 0,
+	CameraCaptureFormat_NativeYUYV = 1,
+	CameraCaptureFormat_NativeMJPEG = 2
+};
+
+enum ESyntheticCameraSource
+{
+	SyntheticCameraSource_TestScene = 0,
+	SyntheticCameraSource_ReplayFile = 1
+};
+
+enum ESyntheticPoseScript
+{
+	SyntheticPoseScript_Static = 0,
+	SyntheticPoseScript_YawSweep = 1,
+	SyntheticPoseScript_Strafe = 2
+};
+
 enum ESelectedDebugSource
 {
 	DebugSource_None = 0,
@@ -120,6 +141,9 @@ struct alignas(4) Config_Main
 	bool EnableAsyncVulkanValidation = false;
 
 	EStereoPreset StereoPreset = StereoPreset_Medium;
+	bool StereoMatchCameraFrameToDepth = false;
+	bool StereoGovernor_Enable = false;
+	float StereoGovernor_TargetMS = 20.0f;
 
 	// Transient settings not written to file
 	bool DebugStereoReconstructionFreeze = false;
@@ -167,6 +191,9 @@ struct alignas(4) Config_Main
 		EnableAsyncVulkanValidation = ini.GetBoolValue(section, "EnableAsyncVulkanValidation", EnableAsyncVulkanValidation);
 
 		StereoPreset = (EStereoPreset)ini.GetLongValue(section, "StereoPreset", StereoPreset);
+		StereoMatchCameraFrameToDepth = ini.GetBoolValue(section, "StereoMatchCameraFrameToDepth", StereoMatchCameraFrameToDepth);
+		StereoGovernor_Enable = ini.GetBoolValue(section, "StereoGovernor_Enable", StereoGovernor_Enable);
+		StereoGovernor_TargetMS = (float)ini.GetDoubleValue(section, "StereoGovernor_TargetMS", StereoGovernor_TargetMS);
 	}
 
 	void UpdateConfig(CSimpleIniA& ini, const char* section)
@@ -209,10 +236,14 @@ struct alignas(4) Config_Main
 		ini.SetBoolValue(section, "EnableAsyncVulkanValidation", EnableAsyncVulkanValidation);
 
 		ini.SetLongValue(section, "StereoPreset", StereoPreset);
+		ini.SetBoolValue(section, "StereoMatchCameraFrameToDepth", StereoMatchCameraFrameToDepth);
+		ini.SetBoolValue(section, "StereoGovernor_Enable", StereoGovernor_Enable);
+		ini.SetDoubleValue(section, "StereoGovernor_TargetMS", StereoGovernor_TargetMS);
 	}
 };
 
 #define MAX_CAMERA_SERIAL_NUMBER_SIZE 127
+#define MAX_SYNTHETIC_REPLAY_PATH_SIZE 259
 
 struct alignas(4) Config_Camera
 {
@@ -225,6 +256,7 @@ struct alignas(4) Config_Camera
 	int CustomFrameDimensions[2] = { 0 };
 
 	int CustomFrameRate = 0;
+	ECameraCaptureFormat CameraCaptureFormat = CameraCaptureFormat_Converted;
 	float FrameDelayOffset = 0.08f;
 
 	bool AutoExposureEnable = false;
@@ -250,8 +282,21 @@ struct alignas(4) Config_Camera
 	float Camera1_IntrinsicsDist[4] = { 0.0f };
 	int Camera1_IntrinsicsSensorPixels[2] = { 1, 1 };
 
+	ESyntheticCameraSource Synthetic_Source = SyntheticCameraSource_TestScene;
+	char Synthetic_ReplayFile[MAX_SYNTHETIC_REPLAY_PATH_SIZE + 1] = "";
+	ECameraFrameFormat Synthetic_FrameFormat = FrameFormat_RGBX32;
+	EStereoFrameLayout Synthetic_FrameLayout = FrameLayout_StereoHorizontal;
+	int Synthetic_FrameDimensions[2] = { 640, 480 };
+	float Synthetic_FrameRate = 60.0f;
+	float Synthetic_FieldOfView = 90.0f;
+	float Synthetic_Baseline = 0.064f;
+	float Synthetic_Distortion[4] = { 0.0f };
+	ESyntheticPoseScript Synthetic_PoseScript = SyntheticPoseScript_Static;
+	float Synthetic_PoseScriptSpeed = 1.0f;
+
 	bool OpenVR_UseBlockQueueForColor = true;
 	bool OpenVR_UseBlockQueueForDepth = true;
+	bool OpenVR_BorrowBlockQueueFrames = false;
 	bool OpenVRCustomCalibration = false;
 	bool OpenVR_CameraHasFisheyeLens = true;
 
@@ -276,13 +321,14 @@ struct alignas(4) Config_Camera
 		UseTrackedDevice = ini.GetBoolValue(section, "UseTrackedDevice", UseTrackedDevice);
 
 		const char* val = ini.GetValue(section, "TrackedDeviceSerialNumber", TrackedDeviceSerialNumber);
-		strncpy_s(TrackedDeviceSerialNumber, val, MAX_CAMERA_SERIAL_NUMBER_SIZE);
+		snprintf(TrackedDeviceSerialNumber, sizeof(TrackedDeviceSerialNumber), "%s", val);
 		
 
 		RequestCustomFrameSize = ini.GetBoolValue(section, "RequestCustomFrameSize", RequestCustomFrameSize);
 		CustomFrameDimensions[0] = (int)ini.GetLongValue(section, "CustomFrameWidth", CustomFrameDimensions[0]);
 		CustomFrameDimensions[1] = (int)ini.GetLongValue(section, "CustomFrameHeight", CustomFrameDimensions[1]);
 		CustomFrameRate = (int)ini.GetLongValue(section, "CustomFrameRate", CustomFrameRate);
+		CameraCaptureFormat = (ECameraCaptureFormat)ini.GetLongValue(section, "CameraCaptureFormat", CameraCaptureFormat);
 		FrameDelayOffset = (float)ini.GetDoubleValue(section, "FrameDelayOffset", FrameDelayOffset);
 
 		AutoExposureEnable = ini.GetBoolValue(section, "AutoExposureEnable", AutoExposureEnable);
@@ -330,8 +376,26 @@ struct alignas(4) Config_Camera
 		Camera1_IntrinsicsSensorPixels[0] = (int)ini.GetLongValue(section, "Camera1_IntrinsicsSensorPixelsX", Camera1_IntrinsicsSensorPixels[0]);
 		Camera1_IntrinsicsSensorPixels[1] = (int)ini.GetLongValue(section, "Camera1_IntrinsicsSensorPixelsY", Camera1_IntrinsicsSensorPixels[1]);
 
+		Synthetic_Source = (ESyntheticCameraSource)ini.GetLongValue(section, "Synthetic_Source", Synthetic_Source);
+		const char* replayFile = ini.GetValue(section, "Synthetic_ReplayFile", Synthetic_ReplayFile);
+		snprintf(Synthetic_ReplayFile, sizeof(Synthetic_ReplayFile), "%s", replayFile);
+		Synthetic_FrameFormat = (ECameraFrameFormat)ini.GetLongValue(section, "Synthetic_FrameFormat", Synthetic_FrameFormat);
+		Synthetic_FrameLayout = (EStereoFrameLayout)ini.GetLongValue(section, "Synthetic_FrameLayout", Synthetic_FrameLayout);
+		Synthetic_FrameDimensions[0] = (int)ini.GetLongValue(section, "Synthetic_FrameWidth", Synthetic_FrameDimensions[0]);
+		Synthetic_FrameDimensions[1] = (int)ini.GetLongValue(section, "Synthetic_FrameHeight", Synthetic_FrameDimensions[1]);
+		Synthetic_FrameRate = (float)ini.GetDoubleValue(section, "Synthetic_FrameRate", Synthetic_FrameRate);
+		Synthetic_FieldOfView = (float)ini.GetDoubleValue(section, "Synthetic_FieldOfView", Synthetic_FieldOfView);
+		Synthetic_Baseline = (float)ini.GetDoubleValue(section, "Synthetic_Baseline", Synthetic_Baseline);
+		Synthetic_Distortion[0] = (float)ini.GetDoubleValue(section, "Synthetic_DistortionR1", Synthetic_Distortion[0]);
+		Synthetic_Distortion[1] = (float)ini.GetDoubleValue(section, "Synthetic_DistortionR2", Synthetic_Distortion[1]);
+		Synthetic_Distortion[2] = (float)ini.GetDoubleValue(section, "Synthetic_DistortionT1", Synthetic_Distortion[2]);
+		Synthetic_Distortion[3] = (float)ini.GetDoubleValue(section, "Synthetic_DistortionT2", Synthetic_Distortion[3]);
+		Synthetic_PoseScript = (ESyntheticPoseScript)ini.GetLongValue(section, "Synthetic_PoseScript", Synthetic_PoseScript);
+		Synthetic_PoseScriptSpeed = (float)ini.GetDoubleValue(section, "Synthetic_PoseScriptSpeed", Synthetic_PoseScriptSpeed);
+
 		OpenVR_UseBlockQueueForColor = ini.GetBoolValue(section, "OpenVR_UseBlockQueueForColor", OpenVR_UseBlockQueueForColor);
 		OpenVR_UseBlockQueueForDepth = ini.GetBoolValue(section, "OpenVR_UseBlockQueueForDepth", OpenVR_UseBlockQueueForDepth);
+		OpenVR_BorrowBlockQueueFrames = ini.GetBoolValue(section, "OpenVR_BorrowBlockQueueFrames", OpenVR_BorrowBlockQueueFrames);
 		OpenVRCustomCalibration = ini.GetBoolValue(section, "OpenVRCustomCalibration", OpenVRCustomCalibration);
 		OpenVR_CameraHasFisheyeLens = ini.GetBoolValue(section, "OpenVR_CameraHasFisheyeLens", OpenVR_CameraHasFisheyeLens);
 
@@ -383,6 +447,7 @@ struct alignas(4) Config_Camera
 		ini.SetLongValue(section, "CustomFrameWidth", (long)CustomFrameDimensions[0]);
 		ini.SetLongValue(section, "CustomFrameHeight", (long)CustomFrameDimensions[1]);
 		ini.SetLongValue(section, "CustomFrameRate", (long)CustomFrameRate);
+		ini.SetLongValue(section, "CameraCaptureFormat", (long)CameraCaptureFormat);
 		ini.SetDoubleValue(section, "FrameDelayOffset", FrameDelayOffset);
 
 		ini.SetBoolValue(section, "AutoExposureEnable", AutoExposureEnable);
@@ -430,8 +495,25 @@ struct alignas(4) Config_Camera
 		ini.SetLongValue(section, "Camera1_IntrinsicsSensorPixelsX", Camera1_IntrinsicsSensorPixels[0]);
 		ini.SetLongValue(section, "Camera1_IntrinsicsSensorPixelsY", Camera1_IntrinsicsSensorPixels[1]);
 
+		ini.SetLongValue(section, "Synthetic_Source", (long)Synthetic_Source);
+		ini.SetValue(section, "Synthetic_ReplayFile", Synthetic_ReplayFile);
+		ini.SetLongValue(section, "Synthetic_FrameFormat", (long)Synthetic_FrameFormat);
+		ini.SetLongValue(section, "Synthetic_FrameLayout", (long)Synthetic_FrameLayout);
+		ini.SetLongValue(section, "Synthetic_FrameWidth", (long)Synthetic_FrameDimensions[0]);
+		ini.SetLongValue(section, "Synthetic_FrameHeight", (long)Synthetic_FrameDimensions[1]);
+		ini.SetDoubleValue(section, "Synthetic_FrameRate", Synthetic_FrameRate);
+		ini.SetDoubleValue(section, "Synthetic_FieldOfView", Synthetic_FieldOfView);
+		ini.SetDoubleValue(section, "Synthetic_Baseline", Synthetic_Baseline);
+		ini.SetDoubleValue(section, "Synthetic_DistortionR1", Synthetic_Distortion[0]);
+		ini.SetDoubleValue(section, "Synthetic_DistortionR2", Synthetic_Distortion[1]);
+		ini.SetDoubleValue(section, "Synthetic_DistortionT1", Synthetic_Distortion[2]);
+		ini.SetDoubleValue(section, "Synthetic_DistortionT2", Synthetic_Distortion[3]);
+		ini.SetLongValue(section, "Synthetic_PoseScript", (long)Synthetic_PoseScript);
+		ini.SetDoubleValue(section, "Synthetic_PoseScriptSpeed", Synthetic_PoseScriptSpeed);
+
 		ini.SetBoolValue(section, "OpenVR_UseBlockQueueForColor", OpenVR_UseBlockQueueForColor);
 		ini.SetBoolValue(section, "OpenVR_UseBlockQueueForDepth", OpenVR_UseBlockQueueForDepth);
+		ini.SetBoolValue(section, "OpenVR_BorrowBlockQueueFrames", OpenVR_BorrowBlockQueueFrames);
 		ini.SetBoolValue(section, "OpenVRCustomCalibration", OpenVRCustomCalibration);
 		ini.SetBoolValue(section, "OpenVR_CameraHasFisheyeLens", OpenVR_CameraHasFisheyeLens);
 
@@ -648,6 +730,12 @@ struct alignas(4) Config_Stereo
 	int StereoSGBM_UniquenessRatio = 1;
 	int StereoSGBM_SpeckleWindowSize = 80;
 	int StereoSGBM_SpeckleRange = 3;
+	bool StereoCoarseToFine_Enable = false;
+	int StereoCoarseToFine_Margin = 4;
+	bool StereoMotionPrediction_Enable = false;
+	int StereoMotionPrediction_Margin = 6;
+	bool StereoChangeDetection_Enable = false;
+	float StereoChangeDetection_Threshold = 4.0f;
 
 	bool StereoFilteringWLS_Enable = true;
 	float StereoFilteringWLS_Lambda = 8000.0f;
@@ -706,6 +794,12 @@ struct alignas(4) Config_Stereo
 		StereoSGBM_UniquenessRatio = ini.GetLongValue(section, "StereoSGBM_UniquenessRatio", StereoSGBM_UniquenessRatio);
 		StereoSGBM_SpeckleWindowSize = ini.GetLongValue(section, "StereoSGBM_SpeckleWindowSize", StereoSGBM_SpeckleWindowSize);
 		StereoSGBM_SpeckleRange = ini.GetLongValue(section, "StereoSGBM_SpeckleRange", StereoSGBM_SpeckleRange);
+		StereoCoarseToFine_Enable = ini.GetBoolValue(section, "StereoCoarseToFine_Enable", StereoCoarseToFine_Enable);
+		StereoCoarseToFine_Margin = ini.GetLongValue(section, "StereoCoarseToFine_Margin", StereoCoarseToFine_Margin);
+		StereoMotionPrediction_Enable = ini.GetBoolValue(section, "StereoMotionPrediction_Enable", StereoMotionPrediction_Enable);
+		StereoMotionPrediction_Margin = ini.GetLongValue(section, "StereoMotionPrediction_Margin", StereoMotionPrediction_Margin);
+		StereoChangeDetection_Enable = ini.GetBoolValue(section, "StereoChangeDetection_Enable", StereoChangeDetection_Enable);
+		StereoChangeDetection_Threshold = (float)ini.GetDoubleValue(section, "StereoChangeDetection_Threshold", StereoChangeDetection_Threshold);
 
 		StereoFilteringWLS_Enable = ini.GetBoolValue(section, "StereoFilteringWLS_Enable", StereoFilteringWLS_Enable);
 		StereoFilteringWLS_Lambda = (float)ini.GetDoubleValue(section, "StereoFilteringWLS_Lambda", StereoFilteringWLS_Lambda);
@@ -765,6 +859,12 @@ struct alignas(4) Config_Stereo
 		ini.SetLongValue(section, "StereoSGBM_UniquenessRatio", StereoSGBM_UniquenessRatio);
 		ini.SetLongValue(section, "StereoSGBM_SpeckleWindowSize", StereoSGBM_SpeckleWindowSize);
 		ini.SetLongValue(section, "StereoSGBM_SpeckleRange", StereoSGBM_SpeckleRange);
+		ini.SetBoolValue(section, "StereoCoarseToFine_Enable", StereoCoarseToFine_Enable);
+		ini.SetLongValue(section, "StereoCoarseToFine_Margin", StereoCoarseToFine_Margin);
+		ini.SetBoolValue(section, "StereoMotionPrediction_Enable", StereoMotionPrediction_Enable);
+		ini.SetLongValue(section, "StereoMotionPrediction_Margin", StereoMotionPrediction_Margin);
+		ini.SetBoolValue(section, "StereoChangeDetection_Enable", StereoChangeDetection_Enable);
+		ini.SetDoubleValue(section, "StereoChangeDetection_Threshold", StereoChangeDetection_Threshold);
 
 		ini.SetBoolValue(section, "StereoFilteringWLS_Enable", StereoFilteringWLS_Enable);
 		ini.SetDoubleValue(section, "StereoFilteringWLS_Lambda", StereoFilteringWLS_Lambda);
@@ -843,6 +943,10 @@ public:
 		return bPending;
 	}
 
+	// Incremented whenever the camera config is replaced, so per-frame code can cache values derived from it.
+	void CameraConfigChanged() { m_cameraConfigRevision++; }
+	uint32_t GetCameraConfigRevision() const { return m_cameraConfigRevision; }
+
 	void SetFrameTextureDumpPending() { m_bFrameTextureDumpPending = true; }
 	bool CheckFrameTextureDumpPending()
 	{
@@ -851,6 +955,14 @@ public:
 		return bPending;
 	}
 
+	void SetStereoBenchmarkPending() { m_bStereoBenchmarkPending = true; }
+	bool CheckStereoBenchmarkPending()
+	{
+		bool bPending = m_bStereoBenchmarkPending;
+		m_bStereoBenchmarkPending = false;
+		return bPending;
+	}
+
 	// TODO: make better system for things like this
 	void SetEnableAsyncColorAdjustment(bool bEnable) { m_bEnableAsyncColorAdjustment = bEnable; }
 	bool CheckEnableAsyncColorAdjustment()
@@ -864,6 +976,7 @@ public:
 	Config_Extensions& GetConfig_Extensions() { return m_configExtensions; }
 	Config_Stereo& GetConfig_Stereo() { return m_stereoPresets[m_configMain.StereoPreset]; }
 	Config_Stereo& GetConfig_CustomStereo() { return m_configCustomStereo; }
+	Config_Stereo& GetConfig_StereoPreset(const EStereoPreset preset) { return m_stereoPresets[preset]; }
 	Config_Depth& GetConfig_Depth() { return m_configDepth; }
 
 	DebugTexture& GetDebugTexture() { return m_debugTexture; }
@@ -880,7 +993,9 @@ private:
 	bool m_bRendererResetPending = false;
 	bool m_bCameraParamChangesPending = false;
 	bool m_bFrameTextureDumpPending = false;
+	bool m_bStereoBenchmarkPending = false;
 	bool m_bEnableAsyncColorAdjustment = true;
+	std::atomic<uint32_t> m_cameraConfigRevision = 0;
 
 	Config_Main m_configMain;
 	Config_Camera m_configCamera;
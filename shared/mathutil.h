@@ -157,6 +157,36 @@ inline XrMatrix4x4f ToXRMatrix4x4Inverted(const vr::HmdMatrix34_t& input)
 }
 
 
+// Interpolates between two rigid transforms, with SLERP for the rotation and LERP for the translation.
+inline vr::HmdMatrix34_t InterpolateHMDMatrix(const vr::HmdMatrix34_t& a, const vr::HmdMatrix34_t& b, const float t)
+{
+    auto toQuat = [](const vr::HmdMatrix34_t& m)
+    {
+        cv::Matx33d R(m.m[0][0], m.m[0][1], m.m[0][2],
+                      m.m[1][0], m.m[1][1], m.m[1][2],
+                      m.m[2][0], m.m[2][1], m.m[2][2]);
+        return cv::Quatd::createFromRotMat(R).normalize();
+    };
+
+    cv::Quatd qa = toQuat(a);
+    cv::Quatd qb = toQuat(b);
+
+    // Slerp takes the shortest path between the rotations.
+    cv::Quatd q = cv::Quatd::slerp(qa, qb, t, cv::QUAT_ASSUME_UNIT, true);
+    cv::Matx33d R = q.toRotMat3x3(cv::QUAT_ASSUME_UNIT);
+
+    vr::HmdMatrix34_t result;
+    for (int row = 0; row < 3; row++)
+    {
+        for (int col = 0; col < 3; col++)
+        {
+            result.m[row][col] = (float)R(row, col);
+        }
+        result.m[row][3] = a.m[row][3] + (b.m[row][3] - a.m[row][3]) * t;
+    }
+    return result;
+}
+
 inline XrMatrix4x4f CVMatToXrMatrix(const cv::Mat& inMatrix)
 {
     XrMatrix4x4f outMatrix;
@@ -26,6 +26,7 @@ enum MenuIPCMessageType
 	MessageType_SendCommand_ApplyRendererReset,
 	MessageType_SendCommand_ApplyCameraParamChanges,
 	MessageType_SendCommand_DumpFrameTexture,
+	MessageType_SendCommand_RunStereoBenchmark,
 	MessageType_MAX
 };
 
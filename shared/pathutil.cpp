@@ -2,6 +2,9 @@
 #include "pch.h"
 #include "pathutil.h"
 
+// The string conversions and known folders are only available on Windows.
+#ifdef _WIN32
+
 #include <pathcch.h>
 #include <shlobj_core.h>
 
@@ -65,6 +68,8 @@ std::string GetProcessFileName(bool bIncludeExtension)
     }
 }
 
+#endif
+
 bool CreateDirectoryPath(const std::string_view& path)
 {
     return std::filesystem::create_directories((char8_t const*)path.data());
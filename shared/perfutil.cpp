@@ -6,20 +6,29 @@
 static uint64_t systemTickFrequency = 0;
 
 
+// The steady clock is used where the performance counter is not available.
 uint64_t GetCurrentTimeSytemTicks()
 {
+#ifdef _WIN32
 	LARGE_INTEGER time;
 	QueryPerformanceCounter(&time);
 	return time.QuadPart;
+#else
+	return (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
 }
 
 uint64_t GetSytemTickFrequency()
 {
 	if (systemTickFrequency == 0)
 	{
+#ifdef _WIN32
 		LARGE_INTEGER frequency;
 		QueryPerformanceFrequency(&frequency);
 		systemTickFrequency = frequency.QuadPart;
+#else
+		systemTickFrequency = std::chrono::steady_clock::period::den / std::chrono::steady_clock::period::num;
+#endif
 	}
 	return systemTickFrequency;
 }
@@ -56,19 +65,16 @@ PerfTimer::PerfTimer(int numAverages)
 
 uint64_t PerfTimer::StartPerfTimer()
 {
-	LARGE_INTEGER startTime;
-	QueryPerformanceCounter(&startTime);
-	m_startTime = startTime.QuadPart;
-	return startTime.QuadPart;
+	m_startTime = GetCurrentTimeSytemTicks();
+	return m_startTime;
 }
 
 uint64_t PerfTimer::EndPerfTimer()
 {
-	LARGE_INTEGER endTime;
-	QueryPerformanceCounter(&endTime);
+	uint64_t endTime = GetCurrentTimeSytemTicks();
 
-	uint64_t perfTimeTicks = endTime.QuadPart - m_startTime;
-	float perfTime = (float)(endTime.QuadPart - m_startTime);
+	uint64_t perfTimeTicks = endTime - m_startTime;
+	float perfTime = (float)(endTime - m_startTime);
 	perfTime *= 1000.0f;
 	perfTime /= systemTickFrequency;
 
@@ -94,10 +100,9 @@ uint64_t PerfTimer::EndPerfTimer()
 
 float PerfTimer::EndPerfTimerMS()
 {
-	LARGE_INTEGER endTime;
-	QueryPerformanceCounter(&endTime);
+	uint64_t endTime = GetCurrentTimeSytemTicks();
 
-	float perfTime = (float)(endTime.QuadPart - m_startTime);
+	float perfTime = (float)(endTime - m_startTime);
 	perfTime *= 1000.0f;
 	perfTime /= systemTickFrequency;
 
@@ -176,3 +181,53 @@ float PerfTimer::GetAverageTimeMS() const
 	}
 	return average / m_lastTimesMS.size();
 }
+
+
+void PerfSampleSet::AddTimeInterval(const uint64_t startTime, const uint64_t endTime)
+{
+	m_samplesMS.push_back((float)(GetPerfTimeDiffSeconds(startTime, endTime) * 1000.0));
+}
+
+float PerfSampleSet::GetPercentileMS(const float percentile)
+{
+	if (m_samplesMS.empty())
+	{
+		return 0.0f;
+	}
+
+	size_t rank = (size_t)ceilf(percentile / 100.0f * m_samplesMS.size());
+	size_t index = std::clamp(rank, (size_t)1, m_samplesMS.size()) - 1;
+
+	// Partially sort a copy so that samples can still be added after reading.
+	m_sortBuffer = m_samplesMS;
+	std::nth_element(m_sortBuffer.begin(), m_sortBuffer.begin() + index, m_sortBuffer.end());
+	return m_sortBuffer[index];
+}
+
+
+RateCounter::RateCounter(float intervalSeconds)
+	: m_intervalSeconds(intervalSeconds)
+{
+	GetSytemTickFrequency();
+}
+
+void RateCounter::AddEvent()
+{
+	uint64_t currentTime = GetCurrentTimeSytemTicks();
+
+	if (m_intervalStartTime == 0)
+	{
+		m_intervalStartTime = currentTime;
+	}
+
+	m_numEvents++;
+
+	double elapsedSeconds = GetPerfTimeDiffSeconds(m_intervalStartTime, currentTime);
+
+	if (elapsedSeconds >= m_intervalSeconds)
+	{
+		m_ratePerSecond = (float)(m_numEvents / elapsedSeconds);
+		m_numEvents = 0;
+		m_intervalStartTime = currentTime;
+	}
+}
@@ -1,6 +1,8 @@
 
 #pragma once
 
+#include <atomic>
+
 uint64_t GetCurrentTimeSytemTicks();
 uint64_t GetSytemTickFrequency();
 
@@ -27,3 +29,37 @@ private:
 	std::vector<float> m_lastTimesMS;
 	uint32_t m_lastTimeIndex = 0;
 };
+
+// Collects timing samples for computing percentiles over a run, such as a benchmark.
+// Not thread safe, the samples need to be added and read from the same thread.
+class PerfSampleSet
+{
+public:
+	void AddSample(const float timeMS) { m_samplesMS.push_back(timeMS); }
+	void AddTimeInterval(const uint64_t startTime, const uint64_t endTime);
+	void Clear() { m_samplesMS.clear(); }
+	size_t GetNumSamples() const { return m_samplesMS.size(); }
+
+	// Nearest-rank percentile, with the percentile given in the range 0-100.
+	float GetPercentileMS(const float percentile);
+
+private:
+	std::vector<float> m_samplesMS;
+	std::vector<float> m_sortBuffer;
+};
+
+// Counts events, such as thread wakeups, and measures their rate over a fixed interval.
+// Events are added from a single thread, the rate can be read from any thread.
+class RateCounter
+{
+public:
+	RateCounter(float intervalSeconds = 1.0f);
+	void AddEvent();
+	float GetRatePerSecond() const { return m_ratePerSecond; }
+
+private:
+	float m_intervalSeconds;
+	uint64_t m_intervalStartTime = 0;
+	uint32_t m_numEvents = 0;
+	std::atomic<float> m_ratePerSecond = 0.0f;
+};
@@ -32,7 +32,8 @@ enum ECameraProvider
 	CameraProvider_None = -1,
 	CameraProvider_OpenVR = 0,
 	CameraProvider_OpenCV = 1,
-	CameraProvider_Augmented = 2
+	CameraProvider_Augmented = 2,
+	CameraProvider_Synthetic = 3
 };
 
 enum EProjectionMode
@@ -142,6 +143,15 @@ struct BlockQueueDebugProperties
 	double ElapsedTime;
 };
 
+// Diagnostic counters for a frame queue.
+struct FrameQueueStats
+{
+	uint32_t NumUnderruns = 0;
+	uint32_t NumDroppedFrames = 0;
+	uint32_t MaxOccupancy = 0;
+	float AverageReadAgeMS = 0.0f;
+};
+
 struct DeviceIdentProperties
 {
 	uint32_t DeviceId;
@@ -177,8 +187,33 @@ struct alignas(8) ClientDataValues
 	float RenderTimeMS = 0.0f;
 	float StereoReconstructionTimeMS = 0.0f;
 	float StereoRenderTimeMS = 0.0f;
+	uint32_t StereoMatcherRebuildCount = 0;
+	float StereoInputStageTimeMS = 0.0f;
+	float StereoMatchingStageTimeMS = 0.0f;
+	float StereoOutputStageTimeMS = 0.0f;
+	uint32_t StereoInputQueueDepth = 0;
+	uint32_t StereoDisparityQueueDepth = 0;
+	uint32_t StereoInputQueueMaxDepth = 0;
+	uint32_t StereoDisparityQueueMaxDepth = 0;
+	float StereoInputQueueLatencyMS = 0.0f;
+	float StereoDisparityQueueLatencyMS = 0.0f;
 	float GPUFrameRetrievalTimeMS = 0.0f;
 	float CPUFrameRetrievalTimeMS = 0.0f;
+	float CameraCaptureStageLatencyMS = 0.0f;
+	float CameraUploadQueueLatencyMS = 0.0f;
+	float CameraServeWakeupsPerSec = 0.0f;
+	FrameQueueStats CameraGPUQueueStats;
+	FrameQueueStats CameraCPUQueueStats;
+	FrameQueueStats DepthQueueStats;
+	float StereoInputWakeupsPerSec = 0.0f;
+	bool bStereoGroundTruthAvailable = false;
+	float StereoBadPixelRate = 0.0f;
+	float StereoInvalidPixelRate = 0.0f;
+	float StereoDisparitySearchFraction = 1.0f;
+	float StereoRecomputedFraction = 1.0f;
+	bool bStereoGovernorActive = false;
+	int StereoGovernorLevel = 0;
+	float StereoGovernorTimeMS = 0.0f;
 	uint64_t LastFrameTimestamp = 0;
 	uint64_t LastCameraTimestamp = 0;
 
@@ -0,0 +1,71 @@
+#include "pch.h"
+#include "depth_reconstruction.h"
+
+
+// Runs the stereo preset benchmark on the synthetic camera, without the OpenXR and OpenVR runtimes or a GPU.
+// Usage: stereo-benchmark [config file]
+// The camera and stereo settings are read from the given layer config file, or left at the defaults.
+// Returns nonzero if the benchmark could not be run, so that it can be used for regression runs.
+
+// The synthetic camera is run as fast as it allows, so that the reconstruction is the limit.
+#define BENCHMARK_CAMERA_FRAME_RATE 1000.0f
+
+#define BENCHMARK_POLL_INTERVAL (std::chrono::milliseconds(100))
+#define BENCHMARK_TIMEOUT (std::chrono::minutes(10))
+
+
+std::shared_ptr<spdlog::logger> g_logger;
+std::shared_ptr<spdlog::sinks::dup_filter_sink_mt> g_logSinkAggregator;
+
+
+int main(int argc, char* argv[])
+{
+	g_logger = spdlog::default_logger();
+
+	std::shared_ptr<ConfigManager> configManager = std::make_shared<ConfigManager>(argc > 1 ? argv[1] : "", false);
+
+	if (argc > 1 && configManager->ReadConfigFile())
+	{
+		g_logger->error("Failed to read config file: {}", argv[1]);
+		return 1;
+	}
+
+	configManager->GetConfig_Main().ProjectionMode = Projection_StereoReconstruction;
+	configManager->GetConfig_Main().DebugStereoReconstructionFreeze = false;
+	configManager->GetConfig_Camera().Synthetic_FrameRate = BENCHMARK_CAMERA_FRAME_RATE;
+
+	// Without an async renderer the frames are only kept on the CPU, which is all the reconstruction reads.
+	std::shared_ptr<CameraManagerSynthetic> cameraManager = std::make_shared<CameraManagerSynthetic>(nullptr, configManager);
+
+	if (!cameraManager->InitCamera())
+	{
+		g_logger->error("Failed to initialize the synthetic camera");
+		return 1;
+	}
+
+	int result = 0;
+
+	{
+		std::shared_ptr<DepthReconstruction> depthReconstruction = std::make_shared<DepthReconstruction>(configManager, nullptr, cameraManager, nullptr);
+
+		configManager->SetStereoBenchmarkPending();
+
+		auto startTime = std::chrono::steady_clock::now();
+
+		while (depthReconstruction->GetBenchmarkSweepCount() == 0)
+		{
+			if (std::chrono::steady_clock::now() - startTime > BENCHMARK_TIMEOUT)
+			{
+				g_logger->error("Stereo preset benchmark timed out");
+				result = 1;
+				break;
+			}
+
+			std::this_thread::sleep_for(BENCHMARK_POLL_INTERVAL);
+		}
+	}
+
+	cameraManager->DeinitCamera();
+
+	return result;
+}